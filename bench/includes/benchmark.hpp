@@ -0,0 +1,94 @@
+#ifndef SEARCH_ENGINE_BENCHMARK_HPP
+#define SEARCH_ENGINE_BENCHMARK_HPP
+
+#include "../../includes/common.hpp"
+#include <filesystem>
+#include <functional>
+#include <ostream>
+
+#define BENCH_DEFAULT_MIN_TIME std::chrono::milliseconds(500)
+#define BENCH_MIN_ITERATIONS 3
+#define BENCH_RESULTS_VERSION 1
+
+namespace SearchEngine
+{
+    // Times a body repeatedly, after one untimed call, until it has run for the minimum time
+    // & at least BENCH_MIN_ITERATIONS times, then reports per-iteration statistics
+    class Benchmark
+    {
+    public:
+        struct Result
+        {
+            std::string name;
+            std::size_t iterations;
+            std::size_t bytes; // Processed per iteration, 0 when throughput doesn't apply
+            double mean_ns;
+            double median_ns;
+            double min_ns;
+            double max_ns;
+        };
+
+        // Extra top level JSON fields describing the run, values are written verbatim
+        using Metadata = std::vector<std::pair<std::string, std::string>>;
+
+    private:
+        std::chrono::nanoseconds m_min_time;
+        std::string m_filter;
+        std::vector<Result> m_results;
+
+    public:
+        Benchmark(std::chrono::nanoseconds min_time, const std::string& filter);
+
+        // Benchmarks whose name doesn't contain the filter are skipped
+        bool
+        selected(const std::string& name)
+        const;
+
+        void
+        run(const std::string& name, std::size_t bytes, const std::function<void()>& body);
+
+        const std::vector<Result>&
+        results()
+        const noexcept;
+
+        void
+        print(std::ostream& out)
+        const;
+
+        bool
+        write_json(const std::string& filename, const Metadata& metadata)
+        const;
+    };
+
+    // Sends std::cout nowhere while alive, for code that reports progress as it runs
+    class SilencedOutput
+    {
+    private:
+        std::streambuf* m_previous;
+
+    public:
+        SilencedOutput();
+        SilencedOutput(const SilencedOutput&) = delete;
+        SilencedOutput& operator=(const SilencedOutput&) = delete;
+        ~SilencedOutput();
+    };
+
+    // Removes the directory & everything in it when it goes out of scope, whichever way it's left
+    class TemporaryDirectory
+    {
+    private:
+        std::filesystem::path m_path;
+
+    public:
+        explicit TemporaryDirectory(std::filesystem::path path);
+        TemporaryDirectory(const TemporaryDirectory&) = delete;
+        TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+        ~TemporaryDirectory();
+
+        const std::filesystem::path&
+        path()
+        const noexcept;
+    };
+}
+
+#endif // SEARCH_ENGINE_BENCHMARK_HPP
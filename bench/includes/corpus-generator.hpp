@@ -0,0 +1,92 @@
+#ifndef SEARCH_ENGINE_CORPUS_GENERATOR_HPP
+#define SEARCH_ENGINE_CORPUS_GENERATOR_HPP
+
+#include "../../includes/common.hpp"
+#include <cstdint>
+
+#define CORPUS_DEFAULT_DOCUMENTS 2000
+#define CORPUS_DEFAULT_WORDS 400
+#define CORPUS_DEFAULT_VOCABULARY 50000
+#define CORPUS_DEFAULT_EXPONENT 1.0
+#define CORPUS_DEFAULT_SEED 42
+#define CORPUS_DOCUMENTS_PER_DIRECTORY 100
+#define CORPUS_PARAGRAPH_WORDS 60
+
+namespace SearchEngine
+{
+    // Synthetic HTML documents whose words follow a Zipf distribution over a made-up vocabulary.
+    // Sampling uses its own splitmix64 generator instead of the standard distributions, whose
+    // output differs between standard libraries, so a seed gives the same corpus on every build.
+    class CorpusGenerator
+    {
+    public:
+        struct Options
+        {
+            std::size_t documents;
+            std::size_t words; // Average words per document, actual counts vary by +/- 50%
+            std::size_t vocabulary;
+            double exponent;
+            std::uint64_t seed;
+        };
+
+    private:
+        class Random
+        {
+        private:
+            std::uint64_t m_state;
+
+        public:
+            explicit Random(std::uint64_t seed);
+
+            std::uint64_t
+            next()
+            noexcept;
+
+            // Uniform in [0, 1)
+            double
+            next_unit()
+            noexcept;
+        };
+
+        Options m_options;
+        std::vector<std::string> m_vocabulary;
+        std::vector<double> m_cumulative; // Zipf CDF over the vocabulary ranks
+
+    private:
+        const std::string&
+        draw_word(Random& random)
+        const;
+
+    public:
+        explicit CorpusGenerator(const Options& options);
+
+        static Options
+        default_options()
+        noexcept;
+
+        const Options&
+        options()
+        const noexcept;
+
+        std::string
+        filename(std::size_t index)
+        const;
+
+        // The same index always produces the same document
+        std::string
+        document(std::size_t index)
+        const;
+
+        // Queries of 1 to 4 words drawn from the same distribution as the documents
+        std::vector<std::string>
+        queries(std::size_t count)
+        const;
+
+        // Documents go to <directory>/<group>/doc-<index>.html, a hundred per group
+        bool
+        write(const std::string& directory)
+        const;
+    };
+}
+
+#endif // SEARCH_ENGINE_CORPUS_GENERATOR_HPP
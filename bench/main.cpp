@@ -0,0 +1,366 @@
+#include "includes/benchmark.hpp"
+#include "includes/corpus-generator.hpp"
+#include "../includes/engine.hpp"
+#include <sstream>
+#include <filesystem>
+#include <unistd.h>
+
+#define BENCH_SAMPLE_DOCUMENTS 64
+#define BENCH_QUERIES 256
+
+namespace
+{
+    struct Options
+    {
+        SearchEngine::CorpusGenerator::Options corpus;
+        std::chrono::nanoseconds min_time;
+        std::string filter;
+    };
+
+    void
+    usage()
+    {
+        std::cout << "Usage: se-bench COMMAND <Args...>\n";
+        std::cout << "Commands:\n";
+        std::cout << "\tcorpus <directory>                 Write the synthetic corpus to the directory.\n";
+        std::cout << "\trun    <output_file>               Benchmark a fresh synthetic corpus and save the results as JSON.\n";
+        std::cout << "Options:\n";
+        std::cout << "\t--documents <count>                Documents in the corpus (default: " << CORPUS_DEFAULT_DOCUMENTS << ").\n";
+        std::cout << "\t--words <count>                    Average words per document (default: " << CORPUS_DEFAULT_WORDS << ").\n";
+        std::cout << "\t--vocabulary <count>               Distinct words to draw from (default: " << CORPUS_DEFAULT_VOCABULARY << ").\n";
+        std::cout << "\t--zipf <exponent>                  Exponent of the word frequency distribution (default: " << CORPUS_DEFAULT_EXPONENT << ").\n";
+        std::cout << "\t--seed <number>                    Seed of the corpus & queries (default: " << CORPUS_DEFAULT_SEED << ").\n";
+        std::cout << "\t--min-time <milliseconds>          Minimum time spent timing each benchmark (default: 500).\n";
+        std::cout << "\t--filter <text>                    Only run the benchmarks whose name contains the text.\n";
+    }
+
+    bool
+    parse_options(int argc, char** argv, Options& options, std::vector<std::string>& args)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            if (strncmp(argv[i], "--", 2) != 0)
+            {
+                args.push_back(argv[i]);
+                continue;
+            }
+
+            if (i + 1 >= argc)
+            {
+                std::cerr << "ERROR: Option '" << argv[i] << "' expects a value\n";
+                return false;
+            }
+
+            const char* value = argv[++i];
+            if (strcmp(argv[i - 1], "--documents") == 0)
+            {
+                options.corpus.documents = strtoul(value, nullptr, 10);
+            }
+            else if (strcmp(argv[i - 1], "--words") == 0)
+            {
+                options.corpus.words = strtoul(value, nullptr, 10);
+            }
+            else if (strcmp(argv[i - 1], "--vocabulary") == 0)
+            {
+                options.corpus.vocabulary = strtoul(value, nullptr, 10);
+            }
+            else if (strcmp(argv[i - 1], "--zipf") == 0)
+            {
+                options.corpus.exponent = strtod(value, nullptr);
+            }
+            else if (strcmp(argv[i - 1], "--seed") == 0)
+            {
+                options.corpus.seed = strtoull(value, nullptr, 10);
+            }
+            else if (strcmp(argv[i - 1], "--min-time") == 0)
+            {
+                options.min_time = std::chrono::milliseconds(strtoul(value, nullptr, 10));
+            }
+            else if (strcmp(argv[i - 1], "--filter") == 0)
+            {
+                options.filter = value;
+            }
+            else
+            {
+                std::cerr << "ERROR: Unknown option '" << argv[i - 1] << "'\n";
+                return false;
+            }
+        }
+
+        if (options.corpus.documents == 0 || options.corpus.words == 0)
+        {
+            std::cerr << "ERROR: The corpus needs at least one document and one word per document\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    // Runs a command through the engine's own entry point, as `se` would
+    int
+    run_engine(std::vector<std::string> args)
+    {
+        args.insert(args.begin(), "se");
+
+        std::vector<char*> argv;
+        for (std::string& arg : args)
+        {
+            argv.push_back(arg.data());
+        }
+        argv.push_back(nullptr);
+
+        SearchEngine::Engine engine;
+        return engine.start(static_cast<int>(args.size()), argv.data());
+    }
+
+    // Same steps as the engine's extraction, on documents already in memory
+    void
+    add_document(const std::string& filename, const std::string& html, SearchEngine::Dictionary& dictionary)
+    {
+        SearchEngine::Tokenizer tokenizer;
+        SearchEngine::Dictionary::TermFreqMap term_freq_map;
+        SearchEngine::Dictionary::TermSequence sequence;
+
+        SearchEngine::XmlParser parser(filename, html);
+        parser.parse([&](std::string_view text)
+        {
+            tokenizer.feed(text, dictionary.terms(), term_freq_map, &sequence);
+            tokenizer.flush(dictionary.terms(), term_freq_map, &sequence);
+        });
+
+        for (const auto& term_freq : term_freq_map)
+        {
+            dictionary.increase_term_occurrence(term_freq.first);
+        }
+
+        dictionary.insert_file({ filename, std::move(term_freq_map) }, SearchEngine::FileInfo {}, std::move(sequence));
+    }
+
+    std::string
+    corpus_metadata(const SearchEngine::CorpusGenerator::Options& corpus)
+    {
+        std::ostringstream out;
+        out << "{\"documents\": " << corpus.documents
+            << ", \"words\": " << corpus.words
+            << ", \"vocabulary\": " << corpus.vocabulary
+            << ", \"zipf\": " << corpus.exponent
+            << ", \"seed\": " << corpus.seed << "}";
+
+        return out.str();
+    }
+
+    int
+    write_corpus(const Options& options, const std::string& directory)
+    {
+        SearchEngine::CorpusGenerator generator(options.corpus);
+        if (!generator.write(directory)) return 1;
+
+        std::cout << "Wrote " << options.corpus.documents << " documents to '" << directory << "'\n";
+        return 0;
+    }
+
+    int
+    run_benchmarks(const Options& options, const std::string& output_filename)
+    {
+        namespace fs = std::filesystem;
+
+        SearchEngine::CorpusGenerator generator(options.corpus);
+        SearchEngine::Benchmark benchmark(options.min_time, options.filter);
+
+        // Removed on every way out, the generated corpus is as large as the benchmark made it
+        SearchEngine::TemporaryDirectory work_directory(fs::temp_directory_path() / ("se-bench-" + std::to_string(getpid())));
+        const std::string corpus_directory = (work_directory.path() / "corpus").string();
+        const std::string index_filename = (work_directory.path() / "bench.idx").string();
+        const std::string engine_index_filename = (work_directory.path() / "engine.idx").string();
+
+        std::cerr << "Generating " << options.corpus.documents << " documents in '" << corpus_directory << "'...\n";
+        if (!generator.write(corpus_directory)) return 1;
+
+        std::vector<std::string> documents;
+        for (std::size_t i = 0; i < options.corpus.documents; ++i)
+        {
+            documents.push_back(generator.document(i));
+        }
+
+        // Parsing & tokenizing are timed on a sample, the whole corpus takes the index benchmarks
+        std::size_t sample_count = std::min<std::size_t>(BENCH_SAMPLE_DOCUMENTS, documents.size());
+        std::size_t sample_bytes = 0;
+        std::vector<std::string> sample_texts(sample_count);
+        for (std::size_t i = 0; i < sample_count; ++i)
+        {
+            sample_bytes += documents[i].size();
+
+            SearchEngine::HtmlExtractor extractor { std::string_view(documents[i]) };
+            extractor.parse([&](std::string_view text)
+            {
+                sample_texts[i].append(text);
+                sample_texts[i].push_back(' ');
+            });
+        }
+
+        std::size_t text_bytes = 0;
+        for (const auto& text : sample_texts) text_bytes += text.size();
+
+        benchmark.run("tokenizer/scan_terms_in_file", text_bytes, [&]()
+        {
+            SearchEngine::TermPool terms;
+            for (const auto& text : sample_texts)
+            {
+                SearchEngine::Tokenizer tokenizer(text);
+                tokenizer.scan_terms_in_file(terms);
+            }
+        });
+
+        benchmark.run("xml-parser/parse", sample_bytes, [&]()
+        {
+            std::size_t text_size = 0;
+            for (std::size_t i = 0; i < sample_count; ++i)
+            {
+                SearchEngine::XmlParser parser(generator.filename(i), documents[i]);
+                parser.parse([&text_size](std::string_view text) { text_size += text.size(); });
+            }
+        });
+
+        benchmark.run("html-extractor/parse", sample_bytes, [&]()
+        {
+            std::size_t text_size = 0;
+            for (std::size_t i = 0; i < sample_count; ++i)
+            {
+                SearchEngine::HtmlExtractor extractor { std::string_view(documents[i]) };
+                extractor.parse([&text_size](std::string_view text) { text_size += text.size(); });
+            }
+        });
+
+        std::size_t corpus_bytes = 0;
+        for (const auto& document : documents) corpus_bytes += document.size();
+
+        benchmark.run("dictionary/build", corpus_bytes, [&]()
+        {
+            SearchEngine::Dictionary dictionary;
+            for (std::size_t i = 0; i < documents.size(); ++i)
+            {
+                add_document(generator.filename(i), documents[i], dictionary);
+            }
+            dictionary.build_inverted_index();
+        });
+
+        SearchEngine::Dictionary dictionary;
+        for (std::size_t i = 0; i < documents.size(); ++i)
+        {
+            add_document(generator.filename(i), documents[i], dictionary);
+        }
+        dictionary.build_inverted_index();
+        dictionary.write_to(index_filename);
+
+        std::error_code error;
+        std::size_t index_bytes = fs::file_size(index_filename, error);
+
+        benchmark.run("index/write", index_bytes, [&]()
+        {
+            dictionary.write_to(index_filename);
+        });
+
+        benchmark.run("index/open", 0, [&]()
+        {
+            SearchEngine::IndexReader reader;
+            reader.open(index_filename);
+        });
+
+        benchmark.run("dictionary/read_from", index_bytes, [&]()
+        {
+            SearchEngine::Dictionary loaded;
+            loaded.read_from(index_filename);
+        });
+
+        SearchEngine::IndexReader reader;
+        if (!reader.open(index_filename)) return 1;
+
+        std::vector<std::string> queries = generator.queries(BENCH_QUERIES);
+        std::vector<SearchEngine::IndexReader::QueryTerms> query_terms;
+        for (const auto& query : queries)
+        {
+            SearchEngine::Tokenizer tokenizer(query);
+            query_terms.push_back(reader.find_terms(tokenizer.scan_text()));
+        }
+
+        benchmark.run("index-reader/tf_idf", 0, [&]()
+        {
+            for (const auto& terms : query_terms)
+            {
+                reader.tf_idf(terms, 0, reader.document_count());
+            }
+        });
+
+        benchmark.run("index-reader/top_k", 0, [&]()
+        {
+            for (const auto& terms : query_terms)
+            {
+                reader.top_k(terms, DEFAULT_TOP_K, EP, 0, reader.document_count());
+            }
+        });
+
+        benchmark.run("end-to-end/index", corpus_bytes, [&]()
+        {
+            SearchEngine::SilencedOutput silenced;
+            run_engine({ "index", corpus_directory, engine_index_filename });
+        });
+
+        if (benchmark.selected("end-to-end/search") && !fs::exists(engine_index_filename))
+        {
+            SearchEngine::SilencedOutput silenced;
+            run_engine({ "index", corpus_directory, engine_index_filename });
+        }
+
+        std::string query_log;
+        for (const auto& query : queries) query_log += query + "\n";
+
+        // Loading the index & answering the whole query log, the cache is off so every query is scored
+        benchmark.run("end-to-end/search", 0, [&]()
+        {
+            std::istringstream input(query_log);
+            std::streambuf* previous = std::cin.rdbuf(input.rdbuf());
+            {
+                SearchEngine::SilencedOutput silenced;
+                run_engine({ "search", engine_index_filename, "--query-cache", "0" });
+            }
+            std::cin.rdbuf(previous);
+            std::cin.clear();
+        });
+
+        benchmark.print(std::cout);
+
+        std::ostringstream compiler;
+        compiler << "\"" << __VERSION__ << "\"";
+
+        return benchmark.write_json(output_filename, {
+            { "corpus", corpus_metadata(options.corpus) },
+            { "compiler", compiler.str() },
+            { "hardware_threads", std::to_string(SearchEngine::ThreadPool::default_size()) },
+        }) ? 0 : 1;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    LIBXML_TEST_VERSION;
+
+    Options options { SearchEngine::CorpusGenerator::default_options(), BENCH_DEFAULT_MIN_TIME, "" };
+    std::vector<std::string> args;
+    if (!parse_options(argc, argv, options, args))
+    {
+        usage();
+        return 1;
+    }
+
+    if (args.size() == 2 && args[0] == "corpus")
+    {
+        return write_corpus(options, args[1]);
+    }
+    else if (args.size() == 2 && args[0] == "run")
+    {
+        return run_benchmarks(options, args[1]);
+    }
+
+    usage();
+    return 1;
+}
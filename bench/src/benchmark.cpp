@@ -0,0 +1,194 @@
+#include "../includes/benchmark.hpp"
+#include <fstream>
+#include <iomanip>
+
+namespace
+{
+    class NullBuffer : public std::streambuf
+    {
+    protected:
+        int
+        overflow(int c)
+        override
+        {
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize
+        xsputn(const char*, std::streamsize count)
+        override
+        {
+            return count;
+        }
+    };
+
+    NullBuffer s_null_buffer;
+
+    std::string
+    json_string(const std::string& text)
+    {
+        std::string quoted = "\"";
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\') quoted += '\\';
+            quoted += c;
+        }
+        quoted += '"';
+
+        return quoted;
+    }
+}
+
+SearchEngine::Benchmark::Benchmark(std::chrono::nanoseconds min_time, const std::string& filter)
+    : m_min_time(min_time),
+      m_filter(filter)
+{
+}
+
+bool
+SearchEngine::Benchmark::selected(const std::string& name)
+const
+{
+    return name.find(m_filter) != std::string::npos;
+}
+
+void
+SearchEngine::Benchmark::run(const std::string& name, std::size_t bytes, const std::function<void()>& body)
+{
+    if (!selected(name)) return;
+
+    std::cerr << "Running '" << name << "'...\n";
+    body();
+
+    std::vector<double> samples;
+    std::chrono::nanoseconds total(0);
+    while (total < m_min_time || samples.size() < BENCH_MIN_ITERATIONS)
+    {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        total += elapsed;
+        samples.push_back(std::chrono::duration<double, std::nano>(elapsed).count());
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    Result result;
+    result.name = name;
+    result.iterations = samples.size();
+    result.bytes = bytes;
+    result.mean_ns = std::chrono::duration<double, std::nano>(total).count() / samples.size();
+    result.median_ns = samples.size() % 2 == 1
+        ? samples[samples.size() / 2]
+        : (samples[samples.size() / 2 - 1] + samples[samples.size() / 2]) / 2;
+    result.min_ns = samples.front();
+    result.max_ns = samples.back();
+
+    m_results.push_back(result);
+}
+
+const std::vector<SearchEngine::Benchmark::Result>&
+SearchEngine::Benchmark::results()
+const noexcept
+{
+    return m_results;
+}
+
+void
+SearchEngine::Benchmark::print(std::ostream& out)
+const
+{
+    out << std::left << std::setw(32) << "Benchmark" << std::right
+        << std::setw(10) << "Iters"
+        << std::setw(14) << "Median (us)"
+        << std::setw(14) << "Min (us)"
+        << std::setw(14) << "Max (us)"
+        << std::setw(12) << "MB/s" << "\n";
+
+    out << std::fixed << std::setprecision(1);
+    for (const Result& result : m_results)
+    {
+        out << std::left << std::setw(32) << result.name << std::right
+            << std::setw(10) << result.iterations
+            << std::setw(14) << result.median_ns / 1000
+            << std::setw(14) << result.min_ns / 1000
+            << std::setw(14) << result.max_ns / 1000;
+
+        if (result.bytes > 0)
+        {
+            out << std::setw(12) << result.bytes / result.median_ns * 1000;
+        }
+        out << "\n";
+    }
+    out << std::defaultfloat;
+}
+
+bool
+SearchEngine::Benchmark::write_json(const std::string& filename, const Metadata& metadata)
+const
+{
+    std::ofstream out(filename);
+    if (!out)
+    {
+        std::cerr << "ERROR: Could not open '" << filename << "' for writing\n";
+        return false;
+    }
+
+    out << "{\n  \"version\": " << BENCH_RESULTS_VERSION << ",\n";
+    for (const auto& [key, value] : metadata)
+    {
+        out << "  " << json_string(key) << ": " << value << ",\n";
+    }
+
+    out << "  \"benchmarks\": [\n" << std::fixed << std::setprecision(1);
+    for (std::size_t i = 0; i < m_results.size(); ++i)
+    {
+        const Result& result = m_results[i];
+        out << "    {\"name\": " << json_string(result.name)
+            << ", \"iterations\": " << result.iterations
+            << ", \"bytes\": " << result.bytes
+            << ", \"mean_ns\": " << result.mean_ns
+            << ", \"median_ns\": " << result.median_ns
+            << ", \"min_ns\": " << result.min_ns
+            << ", \"max_ns\": " << result.max_ns
+            << "}" << (i + 1 < m_results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+
+    if (!out)
+    {
+        std::cerr << "ERROR: Could not write '" << filename << "'\n";
+        return false;
+    }
+
+    return true;
+}
+
+SearchEngine::SilencedOutput::SilencedOutput()
+    : m_previous(std::cout.rdbuf(&s_null_buffer))
+{
+}
+
+SearchEngine::SilencedOutput::~SilencedOutput()
+{
+    std::cout.rdbuf(m_previous);
+}
+
+SearchEngine::TemporaryDirectory::TemporaryDirectory(std::filesystem::path path)
+    : m_path(std::move(path))
+{
+}
+
+SearchEngine::TemporaryDirectory::~TemporaryDirectory()
+{
+    std::error_code error;
+    std::filesystem::remove_all(m_path, error);
+}
+
+const std::filesystem::path&
+SearchEngine::TemporaryDirectory::path()
+const noexcept
+{
+    return m_path;
+}
@@ -0,0 +1,202 @@
+#include "../includes/corpus-generator.hpp"
+#include <cmath>
+#include <cctype>
+#include <fstream>
+#include <filesystem>
+
+namespace
+{
+    const char* const SYLLABLES[] = {
+        "ka", "lo", "mi", "ne", "ru", "sa", "ti", "vo",
+        "ze", "pa", "do", "fu", "gi", "he", "ju", "be",
+    };
+
+    constexpr std::size_t SYLLABLE_COUNT = sizeof(SYLLABLES) / sizeof(SYLLABLES[0]);
+
+    // Rank i is spelled as i + SYLLABLE_COUNT in base SYLLABLE_COUNT, so every word is unique
+    // & at least two syllables long
+    std::string
+    make_word(std::size_t rank)
+    {
+        std::string word;
+        for (std::size_t value = rank + SYLLABLE_COUNT; value > 0; value /= SYLLABLE_COUNT)
+        {
+            word.insert(0, SYLLABLES[value % SYLLABLE_COUNT]);
+        }
+
+        return word;
+    }
+}
+
+SearchEngine::CorpusGenerator::Random::Random(std::uint64_t seed)
+    : m_state(seed)
+{
+}
+
+std::uint64_t
+SearchEngine::CorpusGenerator::Random::next()
+noexcept
+{
+    std::uint64_t z = (m_state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+double
+SearchEngine::CorpusGenerator::Random::next_unit()
+noexcept
+{
+    return (next() >> 11) * 0x1.0p-53;
+}
+
+SearchEngine::CorpusGenerator::CorpusGenerator(const Options& options)
+    : m_options(options)
+{
+    m_options.vocabulary = std::max<std::size_t>(m_options.vocabulary, 1);
+
+    m_vocabulary.reserve(m_options.vocabulary);
+    m_cumulative.reserve(m_options.vocabulary);
+
+    double total = 0.0;
+    for (std::size_t rank = 0; rank < m_options.vocabulary; ++rank)
+    {
+        m_vocabulary.push_back(make_word(rank));
+
+        total += 1.0 / std::pow(static_cast<double>(rank + 1), m_options.exponent);
+        m_cumulative.push_back(total);
+    }
+
+    for (double& value : m_cumulative)
+    {
+        value /= total;
+    }
+}
+
+SearchEngine::CorpusGenerator::Options
+SearchEngine::CorpusGenerator::default_options()
+noexcept
+{
+    return { CORPUS_DEFAULT_DOCUMENTS, CORPUS_DEFAULT_WORDS, CORPUS_DEFAULT_VOCABULARY,
+        CORPUS_DEFAULT_EXPONENT, CORPUS_DEFAULT_SEED };
+}
+
+const SearchEngine::CorpusGenerator::Options&
+SearchEngine::CorpusGenerator::options()
+const noexcept
+{
+    return m_options;
+}
+
+const std::string&
+SearchEngine::CorpusGenerator::draw_word(Random& random)
+const
+{
+    std::size_t rank = std::upper_bound(m_cumulative.begin(), m_cumulative.end(), random.next_unit())
+        - m_cumulative.begin();
+
+    return m_vocabulary[std::min(rank, m_vocabulary.size() - 1)];
+}
+
+std::string
+SearchEngine::CorpusGenerator::filename(std::size_t index)
+const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%03zu/doc-%06zu.html", index / CORPUS_DOCUMENTS_PER_DIRECTORY, index);
+    return name;
+}
+
+std::string
+SearchEngine::CorpusGenerator::document(std::size_t index)
+const
+{
+    Random random(m_options.seed ^ (index * 0xd1342543de82ef95ull));
+
+    std::size_t words = m_options.words / 2 + random.next() % (m_options.words + 1);
+
+    std::string html = "<!DOCTYPE html>\n<html>\n<head>\n<title>";
+    for (std::size_t i = 0; i < 4; ++i)
+    {
+        html += (i == 0 ? "" : " ") + draw_word(random);
+    }
+    html += "</title>\n<script>var ignored = \"" + draw_word(random) + "\";</script>\n</head>\n<body>\n";
+
+    // Paragraphs mix in some capitalized words & numbers so the tokenizer sees more than lowercase runs
+    for (std::size_t written = 0; written < words;)
+    {
+        html += "<p>";
+        std::size_t paragraph = std::min<std::size_t>(CORPUS_PARAGRAPH_WORDS, words - written);
+        for (std::size_t i = 0; i < paragraph; ++i)
+        {
+            if (i > 0) html += ' ';
+
+            std::uint64_t kind = random.next() % 32;
+            if (kind == 0)
+            {
+                html += std::to_string(random.next() % 10000);
+            }
+            else
+            {
+                std::string word = draw_word(random);
+                if (kind == 1) word[0] = std::toupper(static_cast<unsigned char>(word[0]));
+                html += word;
+            }
+        }
+        html += "</p>\n";
+        written += paragraph;
+    }
+    html += "</body>\n</html>\n";
+
+    return html;
+}
+
+std::vector<std::string>
+SearchEngine::CorpusGenerator::queries(std::size_t count)
+const
+{
+    Random random(m_options.seed ^ 0x5155455259ull);
+
+    std::vector<std::string> queries;
+    queries.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::string query;
+        std::size_t words = 1 + random.next() % 4;
+        for (std::size_t j = 0; j < words; ++j)
+        {
+            query += (j == 0 ? "" : " ") + draw_word(random);
+        }
+        queries.push_back(std::move(query));
+    }
+
+    return queries;
+}
+
+bool
+SearchEngine::CorpusGenerator::write(const std::string& directory)
+const
+{
+    for (std::size_t index = 0; index < m_options.documents; ++index)
+    {
+        std::filesystem::path path = std::filesystem::path(directory) / filename(index);
+
+        std::error_code error;
+        std::filesystem::create_directories(path.parent_path(), error);
+        if (error)
+        {
+            std::cerr << "ERROR: Could not create directory '" << path.parent_path().string() << "': " << error.message() << "\n";
+            return false;
+        }
+
+        std::ofstream file(path, std::ios::binary);
+        file << document(index);
+        if (!file)
+        {
+            std::cerr << "ERROR: Could not write '" << path.string() << "'\n";
+            return false;
+        }
+    }
+
+    return true;
+}
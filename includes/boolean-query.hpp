@@ -0,0 +1,87 @@
+#ifndef SEARCH_ENGINE_BOOLEAN_QUERY_HPP
+#define SEARCH_ENGINE_BOOLEAN_QUERY_HPP
+
+#include "common.hpp"
+#include "index-reader.hpp"
+#include <optional>
+
+namespace SearchEngine
+{
+    // Query with AND, OR & NOT (upper case), parentheses and quoted phrases, e.g.
+    //   vector AND (insert OR "push back") NOT deque
+    // Adjacent terms must all match, as if joined by AND, and a word the tokenizer splits
+    // in several terms (std::vector) is a phrase. Conjunctions are intersected from their
+    // rarest term: it proposes every candidate document and the other terms' postings jump to
+    // it through their skip tables, subexpressions' documents with a galloping search, so only
+    // documents holding the rarest term are ever looked at. Phrases are then checked against
+    // the positions of their terms. Matching documents are ranked by tf-idf of the terms that
+    // aren't negated.
+    class BooleanQuery
+    {
+    public:
+        enum class Type
+        {
+            Term,
+            Phrase,
+            And,
+            Or,
+            Not,
+        };
+
+        struct Node
+        {
+            Type type;
+            std::vector<std::string> terms; // Stemmed, one for a term, in order for a phrase
+            std::vector<Node> children;
+        };
+
+        using DocumentId = IndexReader::DocumentId;
+        using Documents = std::vector<DocumentId>; // Sorted
+        using IdfMap = std::unordered_map<std::string, float>;
+
+    private:
+        std::optional<Node> m_root;
+
+    private:
+        Documents
+        evaluate(const Node& node, const IndexReader& reader)
+        const;
+
+        Documents
+        intersect(const std::vector<const Node*>& nodes, const IndexReader& reader)
+        const;
+
+    public:
+        explicit BooleanQuery(std::string_view query);
+
+        // Whether the query uses any operator, quotes or parentheses
+        static bool
+        has_syntax(std::string_view query);
+
+        bool
+        empty()
+        const noexcept;
+
+        // Canonical form of the parsed query, for the query cache
+        std::string
+        key()
+        const;
+
+        // Terms the score is made of, every term not under a NOT once
+        std::vector<std::string>
+        scored_terms()
+        const;
+
+        Documents
+        match(const IndexReader& reader, const IndexReader::Tombstones* deleted = nullptr)
+        const;
+
+        // The best k matches (all of them for 0), `idf` replaces the index's own idf when given
+        std::vector<IndexReader::ScoredDocument>
+        search(const IndexReader& reader, std::size_t k, const IndexReader::Tombstones* deleted = nullptr,
+            const IdfMap* idf = nullptr)
+        const;
+    };
+}
+
+#endif // SEARCH_ENGINE_BOOLEAN_QUERY_HPP
@@ -0,0 +1,77 @@
+#ifndef SEARCH_ENGINE_BOUNDED_QUEUE_HPP
+#define SEARCH_ENGINE_BOUNDED_QUEUE_HPP
+
+#include "common.hpp"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace SearchEngine
+{
+    // Blocking multi-producer/multi-consumer queue, producers wait while it's full
+    // and consumers drain it until it's closed and empty
+    template <typename T>
+    class BoundedQueue
+    {
+    private:
+        std::size_t m_capacity;
+        std::deque<T> m_items;
+        bool m_closed;
+        std::mutex m_mutex;
+        std::condition_variable m_not_full;
+        std::condition_variable m_not_empty;
+
+    public:
+        explicit BoundedQueue(std::size_t capacity)
+            : m_capacity(std::max<std::size_t>(capacity, 1)),
+              m_closed(false)
+        {
+        }
+
+        void
+        push(T item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_full.wait(lock, [this]() { return m_items.size() < m_capacity || m_closed; });
+
+            m_items.push_back(std::move(item));
+            lock.unlock();
+            m_not_empty.notify_one();
+        }
+
+        bool
+        pop(T& item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_empty.wait(lock, [this]() { return !m_items.empty() || m_closed; });
+
+            if (m_items.empty()) return false;
+
+            item = std::move(m_items.front());
+            m_items.pop_front();
+            lock.unlock();
+            m_not_full.notify_one();
+            return true;
+        }
+
+        void
+        close()
+        {
+            {
+                std::lock_guard<std::mutex> guard(m_mutex);
+                m_closed = true;
+            }
+            m_not_full.notify_all();
+            m_not_empty.notify_all();
+        }
+
+        std::size_t
+        size()
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            return m_items.size();
+        }
+    };
+}
+
+#endif // SEARCH_ENGINE_BOUNDED_QUEUE_HPP
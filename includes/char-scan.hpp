@@ -0,0 +1,47 @@
+#ifndef SEARCH_ENGINE_CHAR_SCAN_HPP
+#define SEARCH_ENGINE_CHAR_SCAN_HPP
+
+#include <cstddef>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define CHAR_SCAN_AVX2 1
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+    #define CHAR_SCAN_SSE2 1
+#endif
+
+namespace SearchEngine
+{
+    // Character class scans used by the tokenizer, vectorized with AVX2 or SSE2
+    // when the target supports it and falling back to a scalar loop otherwise
+    namespace CharScan
+    {
+        // First character that can start a token, an ASCII letter or digit
+        const char*
+        skip_separators(const char* begin, const char* end)
+        noexcept;
+
+        // First character that isn't an ASCII digit
+        const char*
+        scan_digits(const char* begin, const char* end)
+        noexcept;
+
+        // First character that isn't an ASCII letter, digit or '_'
+        const char*
+        scan_word(const char* begin, const char* end)
+        noexcept;
+
+        // First '<' or '&', where HTML text stops being plain characters
+        const char*
+        find_markup(const char* begin, const char* end)
+        noexcept;
+
+        // Lowercases ASCII letters from `src` into `dst`, other bytes are copied as they are
+        void
+        to_lower(char* dst, const char* src, std::size_t length)
+        noexcept;
+    }
+}
+
+#endif // SEARCH_ENGINE_CHAR_SCAN_HPP
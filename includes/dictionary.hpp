@@ -5,29 +5,72 @@
 #include <cstdlib>
 #include <cmath>
 #include <libxml/xmlwriter.h>
+#include "index-reader.hpp"
+#include "term-pool.hpp"
+#include "file-info.hpp"
 
 #define XML_ENCODING "UTF-8"
+// Rough heap cost of a document & of each of its term frequencies in the file map
+#define DICTIONARY_FILE_BYTES 160
+#define DICTIONARY_TERM_FREQ_BYTES 40
 
 namespace SearchEngine
 {
     class Dictionary
     {
     public:
-        using TermFreq = std::pair<std::string, std::size_t>;
-        using TermFreqMap = std::unordered_map<std::string, std::size_t>;
+        using TermId = TermPool::TermId;
+        using TermPoolPtr = std::shared_ptr<TermPool>;
+
+        using Frequency = std::uint32_t;
+        using TermFreq = std::pair<TermId, Frequency>;
+        using TermFreqMap = std::unordered_map<TermId, Frequency>;
 
         using File = std::pair<std::string, TermFreqMap>;
         using FileMap = std::unordered_map<std::string, TermFreqMap>;
         using FileMapPtr = std::unique_ptr<FileMap>;
 
-        using TermOccurrence = std::pair<std::string, std::size_t>;
-        using TermOccurrenceMap = std::unordered_map<std::string, std::size_t>;
+        // A document's terms in the order they appear, kept for positional postings
+        using TermSequence = std::vector<TermId>;
+        using SequenceMap = std::unordered_map<std::string, TermSequence>;
+        using SequenceMapPtr = std::unique_ptr<SequenceMap>;
+        using Positions = std::vector<std::uint32_t>;
+        using TermPositionsMap = std::unordered_map<TermId, Positions>;
+
+        using TermOccurrence = std::pair<TermId, std::size_t>;
+        using TermOccurrenceMap = std::unordered_map<TermId, std::size_t>;
         using TermOccurrenceMapPtr = std::unique_ptr<TermOccurrenceMap>;
 
+        using FileInfoMap = std::unordered_map<std::string, FileInfo>;
+        using FileInfoMapPtr = std::unique_ptr<FileInfoMap>;
+
+        using DocumentId = std::size_t;
+        using DocumentTable = std::vector<std::string>;
+        using DocumentLengthTable = std::vector<std::size_t>;
+
+        // Postings are kept compressed in the same blocks the binary index stores
+        struct TermEntry
+        {
+            float idf;
+            float max_tf;
+            PostingsEncoder postings;
+            PositionsEncoder positions;
+        };
+
+        using InvertedIndex = std::unordered_map<TermId, TermEntry>;
+        using InvertedIndexPtr = std::unique_ptr<InvertedIndex>;
+
     private:
+        TermPoolPtr m_terms;
         FileMapPtr m_file_map_ptr;
+        SequenceMapPtr m_sequence_map_ptr;
         TermOccurrenceMapPtr m_term_occurrence_map_ptr;
-        
+        FileInfoMapPtr m_file_info_ptr;
+        InvertedIndexPtr m_inverted_index_ptr;
+        DocumentTable m_documents;
+        DocumentLengthTable m_document_lengths;
+        std::size_t m_memory_usage;
+
     private:
         void
         write_to_xml(const std::string& output_filename)
@@ -36,26 +79,88 @@ namespace SearchEngine
         void
         read_from_xml(const std::string& filename);
 
-        float
-        tf(const std::string& term, const std::string& filename)
+        void
+        write_to_binary(const std::string& output_filename)
         const;
 
+        void
+        read_from_binary(const std::string& filename);
+
         float
-        idf(const std::string& term)
+        idf(std::size_t term_occurrence)
         const;
 
+        static std::size_t
+        file_memory_usage(const std::string& filename, const TermFreqMap& term_freq_map, std::size_t sequence_length)
+        noexcept;
+
+        void
+        recount_memory_usage()
+        noexcept;
+
+        DocumentId
+        index_document(const std::string& filename,
+            const TermFreqMap& term_freq_map,
+            std::size_t length,
+            const TermSequence* sequence);
+
     public:
         Dictionary();
+        explicit Dictionary(TermPoolPtr terms);
+
+        TermPool&
+        terms()
+        const noexcept;
+
+        const TermPoolPtr&
+        term_pool()
+        const noexcept;
+
+        std::size_t
+        document_count()
+        const noexcept;
+
+        // Estimated bytes held by the documents' term frequencies, before the inverted index is built
+        std::size_t
+        memory_usage()
+        const noexcept;
+
+        static float
+        idf(std::size_t document_count, std::size_t term_occurrence);
+
+        static bool
+        is_xml_file(const std::string& filename);
+
+        // Where each term of the sequence appears, in increasing order
+        static TermPositionsMap
+        term_positions(const TermSequence& sequence);
 
         void
         print()
         const noexcept;
 
+        // Documents inserted without their term sequence are indexed without positions
+        void
+        insert_file(File&& file, const FileInfo& info, TermSequence&& sequence = {});
+
         void
-        insert_file(File&& file);
+        remove_file(const std::string& filename);
+
+        const FileInfo*
+        file_info(const std::string& filename)
+        const;
 
         void
-        increase_term_occurrence(const std::string&);
+        set_file_info(const std::string& filename, const FileInfo& info);
+
+        void
+        increase_term_occurrence(TermId);
+
+        void
+        merge(Dictionary&& other);
+
+        void
+        build_inverted_index();
 
         void
         write_to(const std::string& output_filename)
@@ -64,11 +169,15 @@ namespace SearchEngine
         void
         read_from(const std::string& filename);
 
-        float
-        tf_idf(const std::string& filename, const std::list<std::string>& tokens)
+        void
+        read_from(const IndexReader& reader);
+
+        std::vector<char>
+        serialize()
         const;
 
         friend class Engine;
+        friend class IndexRuns;
     };
 }
 
@@ -0,0 +1,42 @@
+#ifndef SEARCH_ENGINE_DIRECTORY_WALKER_HPP
+#define SEARCH_ENGINE_DIRECTORY_WALKER_HPP
+
+#include "common.hpp"
+#include "thread-pool.hpp"
+#include "bounded-queue.hpp"
+#include "indexing-stats.hpp"
+#include <filesystem>
+
+#define WALK_QUEUE_CAPACITY 4096
+
+namespace SearchEngine
+{
+    // Walks a directory tree with one pool task per directory, streaming every file
+    // with the wanted extension into a bounded queue that's closed once the walk ends
+    class DirectoryWalker
+    {
+    public:
+        using Queue = BoundedQueue<std::string>;
+
+    private:
+        ThreadPool& m_pool;
+        Queue& m_queue;
+        std::string m_extension;
+        std::atomic<std::size_t> m_pending;
+
+    private:
+        void
+        walk_directory(const std::filesystem::path& dirname);
+
+        void
+        finish_directory();
+
+    public:
+        DirectoryWalker(ThreadPool& pool, Queue& queue, const std::string& extension);
+
+        void
+        start(const std::string& dirname);
+    };
+}
+
+#endif // SEARCH_ENGINE_DIRECTORY_WALKER_HPP
@@ -2,51 +2,211 @@
 #define SEARCH_ENGINE_ENGINE_HPP
 
 #include <thread>
-#include <mutex>
 #include <filesystem>
 #include "common.hpp"
 #include "tokenizer.hpp"
+#include "boolean-query.hpp"
 #include "xml-parser.hpp"
-#include "xml-parser.hpp"
+#include "html-extractor.hpp"
+#include "index-reader.hpp"
+#include "thread-pool.hpp"
+#include "file-reader.hpp"
+#include "directory-walker.hpp"
+#include "segmented-index.hpp"
+#include "query-cache.hpp"
+#include "query-server.hpp"
+#include "indexing-stats.hpp"
+#include "index-runs.hpp"
+#include "indexing-pipeline.hpp"
 
 #define FILE_EXTENSION ".html"
 #define EP 1.0e-03f
-#define MAX_THREADS 250 
+#define QUERY_CHUNKS_PER_THREAD 4
+#define DEFAULT_TOP_K 10
+#define DEFAULT_WARMUP_PASSES 1
 
 namespace SearchEngine
 {
     class Engine
     {
+    public:
+        enum class Parser
+        {
+            LibXml,
+            Native,
+        };
+
+        enum class StatsFormat
+        {
+            None,
+            Table,
+            Json,
+        };
+
+        // How queries without operators match, queries with them are always boolean
+        enum class Match
+        {
+            Any, // Ranked, documents holding any of the terms
+            All, // Boolean, documents holding every term
+        };
+
+        struct Options
+        {
+            std::size_t threads;
+            std::size_t query_threads;
+            std::size_t top;
+            Parser parser;
+            std::size_t io_depth;
+            std::size_t query_cache; // Bytes
+            std::size_t warmup; // Passes over the query log before bench-query times it
+            StatsFormat stats;
+            bool quiet;
+            std::size_t memory_budget; // Bytes, 0 builds the whole index in memory
+            IndexingPipeline::Stages stages; // All 0 splits --threads with IndexingPipeline::default_stages
+            Match match;
+        };
+
+        struct Changes
+        {
+            std::list<std::string> changed;
+            std::vector<std::string> removed;
+            std::size_t added;
+            std::size_t modified;
+            std::size_t unchanged;
+        };
+
     private:
+        Options m_options;
         Dictionary m_dictionary;
-    #if MULTITHREADING
-        std::mutex m_mutex;
-    #endif // MULTITHREADING
+        IndexReader m_index;
+        SegmentedIndex m_segments;
+        bool m_segmented;
+        std::unique_ptr<ThreadPool> m_query_pool;
+        std::unique_ptr<QueryCache> m_query_cache;
+        std::unique_ptr<IndexRuns> m_runs; // Only while indexing under a memory budget
 
     private:
         void
-        extract_from_file(const std::string &filename);
+        extract_from_file(const std::string &filename, Dictionary& dictionary);
+
+        void
+        extract_text(const std::string &filename,
+            const FileInfo& info,
+            const std::function<void(const XmlParser::TextHandler&)>& parse,
+            Dictionary& dictionary);
+
+        void
+        get_files_from_dir(const std::string& dirname, std::list<std::string>& files);
+
+        void
+        walk_files(const std::string& dirname, const std::function<void(const FileReader::FileSource&)>& consume);
+
+        Dictionary
+        extract_files(const FileReader::FileSource& next_file);
+
+        void
+        calculate_tf_idf_result(const std::list<std::string>& tokens,
+            std::list<std::pair<std::string, float>>& results,
+            QueryTimings* timings = nullptr);
+
+        void
+        calculate_tf_idf_result_parallel(const std::list<std::string>& tokens,
+            std::list<std::pair<std::string, float>>& results,
+            QueryTimings* timings = nullptr);
 
-        std::list<std::string>
-        get_files_from_dir(const std::string&);
+        // Looks the query up in the cache and otherwise runs `search`, then sorts its results
+        void
+        run_cached(const std::function<std::string()>& make_key,
+            const std::function<void()>& search,
+            std::list<std::pair<std::string, float>>& results,
+            QueryTimings* timings);
+
+        void
+        run_query(const std::list<std::string>& tokens,
+            std::list<std::pair<std::string, float>>& results,
+            QueryTimings* timings = nullptr);
 
         void
-        calculate_tf_idf_result(const std::string& filename,
-            const std::list<std::string>& tokens,
-            std::list<std::pair<std::string, float>>& results);
+        run_query(const BooleanQuery& query,
+            std::list<std::pair<std::string, float>>& results,
+            QueryTimings* timings = nullptr);
+
+        // Parses the query as ranked tokens or as a boolean query and runs it
+        void
+        execute_query(const std::string& query,
+            std::list<std::pair<std::string, float>>& results,
+            QueryTimings* timings = nullptr);
 
         void
         usage()
         const noexcept;
 
+        bool
+        parse_options(int argc, char** argv, std::vector<std::string>& args);
+
         int
         index(const std::string& dirname, const std::string& out_filename);
 
+        bool
+        merge_runs(const std::string& out_filename);
+
+        IndexingPipeline::Stages
+        pipeline_stages()
+        const;
+
+        // Taken out of the memory budget when there's one
+        std::size_t
+        pipeline_queue_bytes()
+        const;
+
+        void
+        log_file(const std::string& filename)
+        const;
+
+        void
+        print_stats()
+        const;
+
+        static bool
+        is_segmented_output(const std::string& filename);
+
+        bool
+        write_index(const std::string& out_filename);
+
+        Changes
+        find_changes(const std::string& dirname,
+            const std::unordered_set<std::string>& known_files,
+            const std::function<const FileInfo*(const std::string&)>& known_info,
+            const std::function<void(const std::string&, const FileInfo&)>& on_touched);
+
+        int
+        update(const std::string& dirname, const std::string& index_filename);
+
+        int
+        update_segments(const std::string& dirname, const std::string& index_directory);
+
+        bool
+        load_index(const std::string& index);
+
         int
         search(const std::string& index);
 
+        std::string
+        answer_query(const std::string& query);
+
+        int
+        serve(const std::string& index, const std::string& socket_path);
+
+        int
+        bench_query(const std::string& index, const std::string& queries_filename);
+
+        int
+        convert(const std::string& in_filename, const std::string& out_filename);
+
 
     public:
+        Engine();
+
         int
         start(int, char**);
     };
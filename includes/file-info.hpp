@@ -0,0 +1,34 @@
+#ifndef SEARCH_ENGINE_FILE_INFO_HPP
+#define SEARCH_ENGINE_FILE_INFO_HPP
+
+#include "common.hpp"
+#include <cstdint>
+#include <string_view>
+
+namespace SearchEngine
+{
+    // What an index remembers about a source file to tell whether it changed since
+    struct FileInfo
+    {
+        std::uint64_t size;
+        std::int64_t mtime; // Nanoseconds since the epoch
+        std::uint64_t hash;
+
+        // Fills size & mtime, leaves the hash untouched
+        static bool
+        stat(const std::string& filename, FileInfo& info);
+
+        static std::uint64_t
+        hash_content(std::string_view content)
+        noexcept;
+
+        static bool
+        hash_file(const std::string& filename, std::uint64_t& hash);
+
+        bool
+        same_stat(const FileInfo& other)
+        const noexcept;
+    };
+}
+
+#endif // SEARCH_ENGINE_FILE_INFO_HPP
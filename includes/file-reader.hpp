@@ -0,0 +1,76 @@
+#ifndef SEARCH_ENGINE_FILE_READER_HPP
+#define SEARCH_ENGINE_FILE_READER_HPP
+
+#include "common.hpp"
+#include "indexing-stats.hpp"
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+    #define IO_URING_AVAILABLE 1
+#endif
+
+#define FILE_READER_DEFAULT_DEPTH 64
+#define FILE_READER_MAX_THREADS 16
+
+namespace SearchEngine
+{
+    // Reads whole files ahead of the parsing workers, keeping up to `depth` files
+    // between being read and being released by their consumer. Reads are batched
+    // through io_uring when the kernel allows it, or done with pread on a few threads.
+    class FileReader
+    {
+    public:
+        using Buffer = std::vector<char>;
+        using FileSource = std::function<bool(std::string& filename)>;
+        using ReadHandler = std::function<void(std::string&& filename, Buffer&& content)>;
+
+    private:
+        std::size_t m_depth;
+        std::size_t m_outstanding;
+        std::mutex m_mutex;
+        std::condition_variable m_released;
+        std::mutex m_source_mutex;
+        const char* m_backend;
+
+    private:
+        void
+        acquire();
+
+        bool
+        try_acquire();
+
+        bool
+        next_file(const FileSource& source, std::string& filename);
+
+        static bool
+        read_with_pread(int fd, Buffer& buffer);
+
+        void
+        read_all_pread(const FileSource& source, const ReadHandler& on_read);
+
+    #if IO_URING_AVAILABLE
+        bool
+        read_all_uring(const FileSource& source, const ReadHandler& on_read);
+    #endif // IO_URING_AVAILABLE
+
+    public:
+        explicit FileReader(std::size_t depth);
+
+        const char*
+        backend()
+        const noexcept;
+
+        // Pulls filenames from `source` until it runs dry and calls `on_read` once per
+        // readable file, possibly from several threads. Every delivered buffer has
+        // to be followed by a call to `release`.
+        void
+        read_all(const FileSource& source, const ReadHandler& on_read);
+
+        void
+        release();
+    };
+}
+
+#endif // SEARCH_ENGINE_FILE_READER_HPP
@@ -0,0 +1,46 @@
+#ifndef SEARCH_ENGINE_HTML_EXTRACTOR_HPP
+#define SEARCH_ENGINE_HTML_EXTRACTOR_HPP
+
+#include "common.hpp"
+#include "xml-parser.hpp"
+#include <string_view>
+
+namespace SearchEngine
+{
+    // Lenient single pass HTML text extractor, an alternative to XmlParser that
+    // works on a memory-mapped file (or any buffer) and doesn't stop on malformed markup
+    class HtmlExtractor
+    {
+    private:
+        const char* m_begin;
+        const char* m_end;
+        void* m_mapping;
+        std::size_t m_mapping_size;
+        std::string m_buffer;
+
+    private:
+        const char*
+        skip_tag(const char* current, std::string& name, bool& closing)
+        const;
+
+        const char*
+        skip_element(const char* current, const std::string& name)
+        const;
+
+        const char*
+        decode_entity(const char* current);
+
+    public:
+        HtmlExtractor(const std::string& filename);
+        HtmlExtractor(std::string_view content);
+        HtmlExtractor(const HtmlExtractor&) = delete;
+        HtmlExtractor& operator=(const HtmlExtractor&) = delete;
+        ~HtmlExtractor();
+
+        // Same contract as XmlParser::parse, one call per text node
+        void
+        parse(const XmlParser::TextHandler& on_text);
+    };
+}
+
+#endif // SEARCH_ENGINE_HTML_EXTRACTOR_HPP
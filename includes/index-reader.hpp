@@ -0,0 +1,185 @@
+#ifndef SEARCH_ENGINE_INDEX_READER_HPP
+#define SEARCH_ENGINE_INDEX_READER_HPP
+
+#include "common.hpp"
+#include "postings-codec.hpp"
+#include <cstdint>
+#include <string_view>
+
+#define INDEX_MAGIC 0x58444953u // "SIDX"
+#define INDEX_VERSION 5u
+#define INDEX_TEMPORARY_SUFFIX ".tmp" // Written beside the index, then renamed over it
+#define MAXSCORE_SLACK 1.0e-05f
+
+namespace SearchEngine
+{
+    // On-disk layout of a binary index, every section is 8-byte aligned:
+    //   Header | DocumentRecord[document_count] | TermRecord[term_count] (sorted by key)
+    //   | compressed postings[postings_size bytes] (one run per term, see PostingsEncoder)
+    //   | positions[positions_size bytes] (one run per term, see PositionsEncoder) | strings
+    namespace IndexFormat
+    {
+        struct Header
+        {
+            std::uint32_t magic;
+            std::uint32_t version;
+            std::uint64_t document_count;
+            std::uint64_t term_count;
+            std::uint64_t postings_size;
+            std::uint64_t documents_offset;
+            std::uint64_t terms_offset;
+            std::uint64_t postings_offset;
+            std::uint64_t positions_offset;
+            std::uint64_t positions_size;
+            std::uint64_t strings_offset;
+            std::uint64_t strings_size;
+        };
+
+        struct DocumentRecord
+        {
+            std::uint64_t name_offset;
+            std::uint64_t length;
+            std::uint64_t size;  // Source file size, mtime & content hash for incremental updates
+            std::int64_t mtime;
+            std::uint64_t hash;
+            std::uint32_t name_length;
+            std::uint32_t reserved;
+        };
+
+        struct TermRecord
+        {
+            std::uint64_t key_offset;
+            std::uint64_t postings_offset; // Bytes into the postings section
+            std::uint64_t positions_offset; // Bytes into the positions section
+            std::uint32_t key_length;
+            std::uint32_t document_frequency;
+            float idf;
+            float max_score; // Upper bound of tf * idf over the term's postings
+        };
+    }
+
+    // Time a query spends in each stage, summed when a stage runs more than once
+    struct QueryTimings
+    {
+        std::chrono::nanoseconds tokenize;
+        std::chrono::nanoseconds candidates; // Term lookup & idf
+        std::chrono::nanoseconds scoring;    // Postings traversal, top-k & document names
+        std::chrono::nanoseconds sort;
+    };
+
+    class IndexReader
+    {
+    public:
+        using DocumentId = std::uint32_t;
+        using ScoredDocument = std::pair<DocumentId, float>;
+        using Tombstones = std::vector<bool>;
+
+        // The idf & bound default to the record's, a segmented index scores with collection-wide ones
+        struct QueryTerm
+        {
+            const IndexFormat::TermRecord* record;
+            float idf;
+            float max_score;
+        };
+
+        using QueryTerms = std::vector<QueryTerm>;
+
+    private:
+        const char* m_data;
+        std::size_t m_size;
+        bool m_mapped;
+        std::vector<char> m_buffer;
+
+        const IndexFormat::Header* m_header;
+        const IndexFormat::DocumentRecord* m_documents;
+        const IndexFormat::TermRecord* m_terms;
+        const char* m_postings;
+        const char* m_positions;
+        const char* m_strings;
+
+    private:
+        bool
+        load();
+
+    public:
+        IndexReader();
+        IndexReader(const IndexReader&) = delete;
+        IndexReader& operator=(const IndexReader&) = delete;
+        ~IndexReader();
+
+        static bool
+        is_index_file(const std::string& filename);
+
+        bool
+        open(const std::string& filename);
+
+        bool
+        open(std::vector<char>&& buffer);
+
+        void
+        close()
+        noexcept;
+
+        std::size_t
+        document_count()
+        const noexcept;
+
+        std::size_t
+        term_count()
+        const noexcept;
+
+        std::string_view
+        document_name(DocumentId id)
+        const;
+
+        std::size_t
+        document_length(DocumentId id)
+        const;
+
+        const IndexFormat::DocumentRecord&
+        document_record(DocumentId id)
+        const;
+
+        const IndexFormat::TermRecord&
+        term_record(std::size_t index)
+        const;
+
+        std::string_view
+        term(const IndexFormat::TermRecord& record)
+        const;
+
+        const IndexFormat::TermRecord*
+        find_term(std::string_view key)
+        const;
+
+        PostingCursor
+        postings(const IndexFormat::TermRecord& record)
+        const;
+
+        PositionsReader
+        positions(const IndexFormat::TermRecord& record)
+        const;
+
+        QueryTerms
+        find_terms(const std::list<std::string>& tokens)
+        const;
+
+        std::vector<ScoredDocument>
+        tf_idf(const QueryTerms& terms, DocumentId first, DocumentId last, const Tombstones* deleted = nullptr)
+        const;
+
+        std::vector<ScoredDocument>
+        tf_idf(const std::list<std::string>& tokens)
+        const;
+
+        std::vector<ScoredDocument>
+        top_k(const QueryTerms& terms, std::size_t k, float min_score, DocumentId first, DocumentId last,
+            const Tombstones* deleted = nullptr)
+        const;
+
+        static void
+        sort_by_score(std::vector<ScoredDocument>& scores, std::size_t k);
+    };
+}
+
+#endif // SEARCH_ENGINE_INDEX_READER_HPP
@@ -0,0 +1,141 @@
+#ifndef SEARCH_ENGINE_INDEX_RUNS_HPP
+#define SEARCH_ENGINE_INDEX_RUNS_HPP
+
+#include "common.hpp"
+#include "dictionary.hpp"
+#include "index-reader.hpp"
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+
+#define RUN_MAGIC 0x4e555253u // "SRUN"
+#define RUNS_DIRECTORY_SUFFIX ".runs"
+#define RUNS_MERGE_FAN_IN 64
+
+namespace SearchEngine
+{
+    // Indexing under a memory budget: dictionaries that outgrow their share of the budget are
+    // spilled to sorted runs on disk and emptied, the runs are merged into the binary index
+    // at the end. A run is
+    //   magic | document count | documents sorted by name | terms sorted by key, each one with
+    //   its postings as (document id gap, frequency, position count, position gaps...) varints
+    // where document ids are the document's position in the run. The merged index is the same
+    // one Dictionary::build_inverted_index & write_to would have written from memory.
+    class IndexRuns
+    {
+    public:
+        struct Posting
+        {
+            std::uint32_t document_id;
+            std::uint32_t freq;
+            Dictionary::Positions positions; // Empty for a document indexed without positions
+        };
+
+        using Postings = std::vector<Posting>;
+
+        struct Document
+        {
+            std::string name;
+            std::uint64_t length;
+            FileInfo info;
+        };
+
+        class Writer
+        {
+        private:
+            std::ofstream m_file;
+            std::uint64_t m_document_count;
+
+        public:
+            bool
+            open(const std::string& filename);
+
+            void
+            add_document(const Document& document);
+
+            // Terms must come in key order, after every document
+            void
+            add_term(std::string_view key, const Postings& postings);
+
+            bool
+            close();
+        };
+
+        class Reader
+        {
+        private:
+            std::ifstream m_file;
+            std::uint64_t m_document_count;
+            std::uint64_t m_documents_read;
+
+        public:
+            bool
+            open(const std::string& filename);
+
+            std::uint64_t
+            document_count()
+            const noexcept;
+
+            bool
+            next_document(Document& document);
+
+            // Only once every document has been read
+            bool
+            next_term(std::string& key, Postings& postings);
+        };
+
+    private:
+        std::string m_directory;
+        std::size_t m_dictionary_budget;
+        std::mutex m_mutex;
+        std::vector<std::string> m_runs;
+        std::size_t m_next_run;
+        bool m_failed;
+        bool m_created;
+
+    private:
+        std::string
+        next_run_name();
+
+        // K-way merge of the runs' documents by name, then of their terms by key, with every
+        // document renumbered to its position among all of them
+        bool
+        merge(const std::vector<std::string>& runs,
+            const std::function<void(const Document&)>& on_document,
+            const std::function<void(const std::string&, const Postings&)>& on_term);
+
+        static bool
+        append_file(std::ofstream& out, const std::string& filename, std::uint64_t size);
+
+        bool
+        merge_to_run(const std::vector<std::string>& runs, const std::string& run);
+
+    public:
+        // Runs go in a new directory named after `directory`, removed with everything in it
+        IndexRuns(const std::string& directory, std::size_t dictionary_budget);
+        IndexRuns(const IndexRuns&) = delete;
+        IndexRuns& operator=(const IndexRuns&) = delete;
+        ~IndexRuns();
+
+        bool
+        create();
+
+        std::size_t
+        size();
+
+        // Writes the dictionary's documents as a run & empties it, safe to call from several threads
+        bool
+        flush(Dictionary& dictionary);
+
+        bool
+        flush_if_full(Dictionary& dictionary);
+
+        // Runs beyond RUNS_MERGE_FAN_IN are first merged into bigger runs, so only that many
+        // files are ever open at once
+        bool
+        merge_to(const std::string& output_filename);
+    };
+}
+
+#endif // SEARCH_ENGINE_INDEX_RUNS_HPP
@@ -0,0 +1,198 @@
+#ifndef SEARCH_ENGINE_INDEXING_PIPELINE_HPP
+#define SEARCH_ENGINE_INDEXING_PIPELINE_HPP
+
+#include "common.hpp"
+#include "dictionary.hpp"
+#include "file-reader.hpp"
+#include "index-runs.hpp"
+#include "ring-buffer.hpp"
+#include "xml-parser.hpp"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <ostream>
+
+#define PIPELINE_QUEUE_CAPACITY 256
+#define PIPELINE_QUEUE_BYTES (128 * 1024 * 1024)
+#define PIPELINE_QUEUE_BUDGET_SHARE 4 // A memory budget gives the queues a quarter of it
+#define PIPELINE_SAMPLE_INTERVAL std::chrono::milliseconds(5)
+
+namespace SearchEngine
+{
+    // Indexing split into stages, each one with its own threads, handing files to the next
+    // through bounded lock-free queues:
+    //   read (FileReader) -> extract text -> tokenize & stem -> accumulate into dictionaries
+    // Full queues hold back the stages before them, so the slowest stage sets the pace and
+    // the queues' depths & waits show which one it is. The files' content and extracted text
+    // are held whole between stages, so those two queues are also bounded by their bytes. The
+    // dictionaries are merged pairwise on parallel threads once every stage is done, writing
+    // the index is left to the caller.
+    class IndexingPipeline
+    {
+    public:
+        struct Stages
+        {
+            std::size_t extract;
+            std::size_t tokenize;
+            std::size_t accumulate;
+        };
+
+        struct QueueStats
+        {
+            const char* name;
+            std::size_t capacity;
+            double mean_depth; // Sampled every PIPELINE_SAMPLE_INTERVAL
+            std::size_t max_depth;
+            std::uint64_t full_waits; // Pushes that waited on the next stage
+            std::uint64_t empty_waits; // Pops that waited on the previous stage
+        };
+
+        struct StageStats
+        {
+            const char* name;
+            std::size_t threads;
+            std::chrono::nanoseconds busy; // Working on files, summed over the stage's threads
+            std::chrono::nanoseconds idle; // Waiting on the queues around the stage
+        };
+
+        using ExtractText = std::function<void(const std::string& filename,
+            std::string_view content,
+            const XmlParser::TextHandler& on_text)>;
+
+    private:
+        struct ReadFile
+        {
+            std::string filename;
+            FileReader::Buffer content;
+        };
+
+        // Text nodes back to back, tokenized one at a time as they were parsed
+        struct ExtractedFile
+        {
+            std::string filename;
+            FileInfo info;
+            std::string text;
+            std::vector<std::size_t> node_ends;
+        };
+
+        struct TokenizedFile
+        {
+            std::string filename;
+            FileInfo info;
+            Dictionary::TermFreqMap term_freq_map;
+            Dictionary::TermSequence sequence;
+        };
+
+        // Bytes held in a queue, a push waits until they're under the limit. A queue holding
+        // nothing always takes the next file, so one larger than the limit still gets through
+        class QueueBytes
+        {
+        private:
+            std::mutex m_mutex;
+            std::condition_variable m_released;
+            std::size_t m_limit;
+            std::size_t m_bytes;
+
+        public:
+            explicit QueueBytes(std::size_t limit);
+
+            void
+            reserve(std::size_t bytes);
+
+            void
+            release(std::size_t bytes);
+        };
+
+        struct Depths
+        {
+            std::size_t total;
+            std::size_t max;
+        };
+
+        // Nanoseconds summed over a stage's threads, added by each one when it's done
+        struct StageTimes
+        {
+            std::atomic<std::int64_t> busy;
+            std::atomic<std::int64_t> total;
+        };
+
+        static constexpr std::size_t QUEUES = 3;
+        static constexpr std::size_t STAGES = 3;
+
+        Dictionary::TermPoolPtr m_terms;
+        Stages m_stages;
+        std::size_t m_io_depth;
+        ExtractText m_extract_text;
+        IndexRuns* m_runs;
+        const char* m_read_backend;
+
+        RingBuffer<ReadFile> m_read;
+        RingBuffer<ExtractedFile> m_extracted;
+        RingBuffer<TokenizedFile> m_tokenized;
+        QueueBytes m_read_bytes;
+        QueueBytes m_extracted_bytes;
+        std::vector<Dictionary> m_dictionaries;
+
+        mutable std::mutex m_monitor_mutex;
+        std::condition_variable m_monitor_wakeup;
+        bool m_monitor_stop;
+        std::size_t m_samples;
+        std::array<Depths, QUEUES> m_depths;
+        std::array<StageTimes, STAGES> m_stage_times;
+
+    private:
+        void
+        extract_stage();
+
+        void
+        tokenize_stage();
+
+        void
+        accumulate_stage(Dictionary& dictionary);
+
+        void
+        add_stage_time(std::size_t stage,
+            std::chrono::steady_clock::time_point started,
+            std::chrono::nanoseconds busy);
+
+        void
+        monitor();
+
+        std::array<std::size_t, QUEUES>
+        depths()
+        const noexcept;
+
+    public:
+        // `queue_bytes` is split between the read & extract queues
+        IndexingPipeline(Dictionary::TermPoolPtr terms,
+            const Stages& stages,
+            std::size_t io_depth,
+            std::size_t queue_bytes,
+            ExtractText extract_text,
+            IndexRuns* runs);
+
+        // Splits the indexing threads between the stages, tokenizing & stemming get the most
+        static Stages
+        default_stages(std::size_t threads);
+
+        // Indexes every file from the source, `runs` (when given) spills full dictionaries to disk
+        Dictionary
+        run(const FileReader::FileSource& next_file);
+
+        std::vector<QueueStats>
+        queue_stats()
+        const;
+
+        std::vector<StageStats>
+        stage_stats()
+        const;
+
+        void
+        print(std::ostream& out)
+        const;
+    };
+}
+
+#endif // SEARCH_ENGINE_INDEXING_PIPELINE_HPP
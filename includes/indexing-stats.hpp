@@ -0,0 +1,123 @@
+#ifndef SEARCH_ENGINE_INDEXING_STATS_HPP
+#define SEARCH_ENGINE_INDEXING_STATS_HPP
+
+#include "common.hpp"
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <cstdint>
+
+namespace SearchEngine
+{
+    // Time spent in each indexing stage & work done, counted per thread without any shared
+    // writes and only summed when read. Stage timers nest: a stage started inside another
+    // pauses it, so the stage times never overlap on one thread.
+    class IndexingStats
+    {
+    public:
+        enum class Stage
+        {
+            Walk,
+            Read,
+            Parse,
+            Tokenize,
+            Stem, // Only stemmer calls for words missing from the stem cache
+            Merge,
+            Write,
+            Count,
+        };
+
+        enum class Counter
+        {
+            Files,
+            Bytes,
+            Tokens,
+            Count,
+        };
+
+        struct Totals
+        {
+            std::array<std::chrono::nanoseconds, static_cast<std::size_t>(Stage::Count)> times;
+            std::array<std::uint64_t, static_cast<std::size_t>(Counter::Count)> counts;
+        };
+
+        class Timer
+        {
+        private:
+            static thread_local Timer* s_current;
+
+            Stage m_stage;
+            Timer* m_parent;
+            std::chrono::steady_clock::time_point m_start;
+            std::chrono::nanoseconds m_nested;
+
+        public:
+            explicit Timer(Stage stage);
+            Timer(const Timer&) = delete;
+            Timer& operator=(const Timer&) = delete;
+            ~Timer();
+        };
+
+    private:
+        struct alignas(64) Slot
+        {
+            std::array<std::atomic<std::int64_t>, static_cast<std::size_t>(Stage::Count)> times;
+            std::array<std::atomic<std::uint64_t>, static_cast<std::size_t>(Counter::Count)> counts;
+        };
+
+        // Registers the thread's slot on first use & folds it into the retired totals on exit
+        struct ThreadSlot
+        {
+            Slot slot;
+
+            ThreadSlot();
+            ~ThreadSlot();
+        };
+
+        static std::mutex s_mutex;
+        static std::vector<Slot*> s_slots;
+        static Totals s_retired;
+        static std::chrono::steady_clock::time_point s_started_at;
+
+    private:
+        static Slot&
+        thread_slot();
+
+        static void
+        clear(Slot& slot)
+        noexcept;
+
+    public:
+        static void
+        add(Stage stage, std::chrono::nanoseconds time)
+        noexcept;
+
+        static void
+        add(Counter counter, std::uint64_t count)
+        noexcept;
+
+        // Zeroes every thread's counts, only while no other thread is counting
+        static void
+        reset();
+
+        static Totals
+        totals();
+
+        static std::chrono::nanoseconds
+        elapsed();
+
+        // Peak resident set size of the process so far
+        static std::size_t
+        peak_memory()
+        noexcept;
+
+        static void
+        print_table(std::ostream& out);
+
+        static void
+        print_json(std::ostream& out);
+    };
+}
+
+#endif // SEARCH_ENGINE_INDEXING_STATS_HPP
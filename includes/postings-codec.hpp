@@ -0,0 +1,200 @@
+#ifndef SEARCH_ENGINE_POSTINGS_CODEC_HPP
+#define SEARCH_ENGINE_POSTINGS_CODEC_HPP
+
+#include "common.hpp"
+#include <cstdint>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+    #define POSTINGS_CODEC_SSE2 1
+#endif
+
+#define POSTINGS_BLOCK_SIZE 128
+#define POSTINGS_LANES 4
+
+namespace SearchEngine
+{
+    // A term's postings are a skip table followed by the encoded blocks:
+    //   SkipEntry[full_blocks] | full blocks | tail block | padding to 4 bytes
+    // Document ids are stored as gaps minus one, frequencies minus one. Full blocks of
+    // POSTINGS_BLOCK_SIZE postings are bit-packed in POSTINGS_LANES interleaved lanes, so
+    // one SSE2 word holds the same bits of four consecutive values. The remaining postings
+    // are stored as (gap, freq) varints.
+    namespace IndexFormat
+    {
+        struct SkipEntry
+        {
+            std::uint32_t last_document_id;
+            std::uint32_t offset; // Bytes from the first block
+            std::uint8_t document_bits;
+            std::uint8_t freq_bits;
+            std::uint16_t reserved;
+        };
+    }
+
+    class PostingsEncoder
+    {
+    private:
+        std::vector<std::uint8_t> m_data; // Packed full blocks, then the tail's varints
+        std::vector<IndexFormat::SkipEntry> m_skips;
+        std::uint32_t m_tail_offset;
+        std::uint32_t m_document_frequency;
+        std::uint32_t m_last_id;
+
+    private:
+        void
+        pack_tail();
+
+    public:
+        PostingsEncoder();
+
+        // Ids must be added in increasing order
+        void
+        add(std::uint32_t id, std::uint32_t freq);
+
+        std::uint32_t
+        document_frequency()
+        const noexcept;
+
+        std::size_t
+        encoded_size()
+        const noexcept;
+
+        void
+        write(char* out)
+        const;
+    };
+
+    // A term's positions, kept apart from its postings so only phrase queries read them:
+    //   block offset[blocks] (uint32, bytes from the first posting's positions) | per posting:
+    //   position count, then the positions as gaps, all varints | padding to 4 bytes
+    // Postings are counted in the same blocks of POSTINGS_BLOCK_SIZE as PostingsEncoder's, a
+    // posting's positions are found from its ordinal by skipping within its block only.
+    // Documents indexed without positions store a count of 0.
+    class PositionsEncoder
+    {
+    private:
+        std::vector<std::uint8_t> m_data;
+        std::vector<std::uint32_t> m_block_offsets;
+        std::uint32_t m_count;
+
+    public:
+        PositionsEncoder();
+
+        // Positions in increasing order, one call per posting in posting order
+        void
+        add(const std::uint32_t* positions, std::size_t count);
+
+        std::size_t
+        encoded_size()
+        const noexcept;
+
+        void
+        write(char* out)
+        const;
+    };
+
+    class PositionsReader
+    {
+    private:
+        const std::uint32_t* m_block_offsets;
+        const std::uint8_t* m_data;
+        const std::uint8_t* m_next; // Where the posting after the last one read starts
+        std::uint32_t m_next_ordinal;
+
+    public:
+        PositionsReader();
+        PositionsReader(const char* positions, std::uint32_t document_frequency);
+
+        // Positions of the `ordinal`th posting of the term, reading forward within a block
+        // carries on from the last posting read instead of the block's start
+        void
+        read(std::uint32_t ordinal, std::vector<std::uint32_t>& positions);
+    };
+
+    class PostingCursor
+    {
+    private:
+        const IndexFormat::SkipEntry* m_skips;
+        const std::uint8_t* m_blocks;
+        std::uint32_t m_document_frequency;
+        std::uint32_t m_full_blocks;
+        std::uint32_t m_block_count;
+        std::uint32_t m_block;
+        std::uint32_t m_size;
+        std::uint32_t m_position;
+        std::uint32_t m_ids[POSTINGS_BLOCK_SIZE];
+        std::uint32_t m_freqs[POSTINGS_BLOCK_SIZE];
+
+    private:
+        void
+        decode_block(std::uint32_t block);
+
+    public:
+        PostingCursor();
+        PostingCursor(const char* postings, std::uint32_t document_frequency);
+
+        bool
+        at_end()
+        const noexcept;
+
+        std::uint32_t
+        document_id()
+        const noexcept;
+
+        std::uint32_t
+        freq()
+        const noexcept;
+
+        // Index of the current posting in the term's postings
+        std::uint32_t
+        ordinal()
+        const noexcept;
+
+        void
+        next();
+
+        // Moves to the first posting with an id >= `id`, whole blocks are skipped through the skip table
+        void
+        advance_to(std::uint32_t id);
+    };
+
+    inline bool
+    PostingCursor::at_end()
+    const noexcept
+    {
+        return m_position >= m_size;
+    }
+
+    inline std::uint32_t
+    PostingCursor::document_id()
+    const noexcept
+    {
+        return m_ids[m_position];
+    }
+
+    inline std::uint32_t
+    PostingCursor::freq()
+    const noexcept
+    {
+        return m_freqs[m_position];
+    }
+
+    inline std::uint32_t
+    PostingCursor::ordinal()
+    const noexcept
+    {
+        return m_block * POSTINGS_BLOCK_SIZE + m_position;
+    }
+
+    inline void
+    PostingCursor::next()
+    {
+        if (++m_position == m_size && m_block + 1 < m_block_count)
+        {
+            decode_block(m_block + 1);
+        }
+    }
+}
+
+#endif // SEARCH_ENGINE_POSTINGS_CODEC_HPP
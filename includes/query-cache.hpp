@@ -0,0 +1,77 @@
+#ifndef SEARCH_ENGINE_QUERY_CACHE_HPP
+#define SEARCH_ENGINE_QUERY_CACHE_HPP
+
+#include "common.hpp"
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#define QUERY_CACHE_DEFAULT_MB 16
+
+namespace SearchEngine
+{
+    // Ranked results of recent queries, keyed on their sorted stemmed tokens so word order
+    // doesn't matter. Bounded by an estimate of the memory held and evicted least recently used.
+    class QueryCache
+    {
+    public:
+        using Result = std::pair<std::string, float>;
+        using Results = std::list<Result>;
+
+    private:
+        struct Entry
+        {
+            std::string key;
+            Results results;
+            std::size_t bytes;
+        };
+
+        using Entries = std::list<Entry>;
+
+        std::mutex m_mutex;
+        Entries m_entries; // Most recently used first
+        std::unordered_map<std::string, Entries::iterator> m_entries_by_key;
+        std::size_t m_capacity;
+        std::size_t m_size;
+        std::uint64_t m_generation;
+        std::atomic<std::size_t> m_hits;
+        std::atomic<std::size_t> m_misses;
+
+    private:
+        static std::size_t
+        estimate_size(const std::string& key, const Results& results)
+        noexcept;
+
+    public:
+        explicit QueryCache(std::size_t capacity);
+        QueryCache(const QueryCache&) = delete;
+        QueryCache& operator=(const QueryCache&) = delete;
+
+        static std::string
+        make_key(const std::list<std::string>& tokens);
+
+        bool
+        find(const std::string& key, Results& results);
+
+        // Results scored on an older index generation than the cache's are dropped
+        void
+        insert(const std::string& key, const Results& results, std::uint64_t generation);
+
+        // Moving to another index generation drops every entry
+        void
+        set_generation(std::uint64_t generation);
+
+        void
+        clear();
+
+        std::size_t
+        hits()
+        const noexcept;
+
+        std::size_t
+        misses()
+        const noexcept;
+    };
+}
+
+#endif // SEARCH_ENGINE_QUERY_CACHE_HPP
@@ -0,0 +1,99 @@
+#ifndef SEARCH_ENGINE_QUERY_SERVER_HPP
+#define SEARCH_ENGINE_QUERY_SERVER_HPP
+
+#include "common.hpp"
+#include "thread-pool.hpp"
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+#define SERVER_LISTEN_BACKLOG 128
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_SIZE 4096
+#define SERVER_MAX_REQUEST (64 * 1024)
+
+namespace SearchEngine
+{
+    // Serves one request per line over a Unix domain socket. A single thread multiplexes every
+    // client with epoll while the requests run on a thread pool; each client's requests are
+    // answered one at a time so responses come back in order. SIGINT & SIGTERM stop the server.
+    class QueryServer
+    {
+    public:
+        using Handler = std::function<std::string(const std::string&)>;
+
+    private:
+        struct Connection
+        {
+            int fd;
+            std::string input;
+            std::string output;
+            std::deque<std::string> requests;
+            std::uint32_t events;
+            bool busy;
+            bool input_closed;
+        };
+
+        struct Response
+        {
+            std::uint64_t connection;
+            std::string content;
+        };
+
+        Handler m_handler;
+        std::size_t m_threads;
+        std::unique_ptr<ThreadPool> m_pool;
+        std::string m_socket_path;
+        int m_listen_fd;
+        int m_epoll_fd;
+        int m_wakeup_fd;
+        int m_signal_fd;
+        std::uint64_t m_next_connection;
+        std::unordered_map<std::uint64_t, Connection> m_connections;
+
+        std::mutex m_mutex;
+        std::vector<Response> m_responses;
+
+    private:
+        bool
+        watch(int fd, std::uint64_t id, std::uint32_t events, bool modify);
+
+        void
+        accept_clients();
+
+        void
+        read_requests(std::uint64_t id);
+
+        void
+        dispatch(std::uint64_t id);
+
+        void
+        deliver_responses();
+
+        void
+        flush(std::uint64_t id);
+
+        void
+        update_events(std::uint64_t id);
+
+        void
+        close_connection(std::uint64_t id);
+
+    public:
+        QueryServer(Handler handler, std::size_t threads);
+        QueryServer(const QueryServer&) = delete;
+        QueryServer& operator=(const QueryServer&) = delete;
+        ~QueryServer();
+
+        // Threads started after this call, including the pool's, never take SIGINT or SIGTERM
+        bool
+        listen(const std::string& socket_path);
+
+        // Returns once the server gets SIGINT or SIGTERM and the running requests are answered
+        void
+        run();
+    };
+}
+
+#endif // SEARCH_ENGINE_QUERY_SERVER_HPP
@@ -0,0 +1,219 @@
+#ifndef SEARCH_ENGINE_RING_BUFFER_HPP
+#define SEARCH_ENGINE_RING_BUFFER_HPP
+
+#include "common.hpp"
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+#define RING_BUFFER_SPINS 64
+#define RING_BUFFER_YIELDS 16
+#define RING_BUFFER_SLEEP std::chrono::microseconds(100)
+
+namespace SearchEngine
+{
+    // Bounded lock-free queue for several producers & consumers. Every slot carries a sequence
+    // number telling whether it's free for the push or holds the value for the pop claiming its
+    // position, so a push & a pop only ever contend on their own position counter. The blocking
+    // push & pop back off from spinning to yielding to short sleeps, and count how often they
+    // had to wait, which tells whether the stage on either side is the bottleneck.
+    template <typename T>
+    class RingBuffer
+    {
+    private:
+        struct alignas(64) Slot
+        {
+            std::atomic<std::size_t> sequence;
+            T value;
+        };
+
+        class Backoff
+        {
+        private:
+            std::size_t m_attempts = 0;
+
+        public:
+            void
+            wait()
+            {
+                if (m_attempts < RING_BUFFER_SPINS)
+                {
+                    // Spin briefly, the other side is usually only a few instructions away
+                }
+                else if (m_attempts < RING_BUFFER_SPINS + RING_BUFFER_YIELDS)
+                {
+                    std::this_thread::yield();
+                }
+                else
+                {
+                    std::this_thread::sleep_for(RING_BUFFER_SLEEP);
+                }
+                ++m_attempts;
+            }
+        };
+
+        std::unique_ptr<Slot[]> m_slots;
+        std::size_t m_mask;
+        alignas(64) std::atomic<std::size_t> m_head; // Next position to push
+        alignas(64) std::atomic<std::size_t> m_tail; // Next position to pop
+        alignas(64) std::atomic<bool> m_closed;
+        std::atomic<std::uint64_t> m_full_waits;
+        std::atomic<std::uint64_t> m_empty_waits;
+
+    public:
+        // The capacity is rounded up to a power of two
+        explicit RingBuffer(std::size_t capacity)
+            : m_head(0),
+              m_tail(0),
+              m_closed(false),
+              m_full_waits(0),
+              m_empty_waits(0)
+        {
+            std::size_t size = 1;
+            while (size < capacity) size *= 2;
+
+            m_slots.reset(new Slot[size]);
+            m_mask = size - 1;
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                m_slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        RingBuffer(const RingBuffer&) = delete;
+        RingBuffer& operator=(const RingBuffer&) = delete;
+
+        // Moves the item in only when there's room
+        bool
+        try_push(T& item)
+        {
+            std::size_t position = m_head.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Slot& slot = m_slots[position & m_mask];
+                std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                auto difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+
+                if (difference == 0)
+                {
+                    if (m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        slot.value = std::move(item);
+                        slot.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false; // The slot still holds the value pushed one lap earlier
+                }
+                else
+                {
+                    position = m_head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool
+        try_pop(T& item)
+        {
+            std::size_t position = m_tail.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Slot& slot = m_slots[position & m_mask];
+                std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                auto difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position + 1);
+
+                if (difference == 0)
+                {
+                    if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        item = std::move(slot.value);
+                        slot.sequence.store(position + m_mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false; // Nothing pushed at this position yet
+                }
+                else
+                {
+                    position = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        void
+        push(T item)
+        {
+            if (try_push(item)) return;
+
+            m_full_waits.fetch_add(1, std::memory_order_relaxed);
+            Backoff backoff;
+            do
+            {
+                backoff.wait();
+            }
+            while (!try_push(item));
+        }
+
+        // Waits for an item, fails once the queue is closed & drained
+        bool
+        pop(T& item)
+        {
+            if (try_pop(item)) return true;
+
+            m_empty_waits.fetch_add(1, std::memory_order_relaxed);
+            Backoff backoff;
+            while (true)
+            {
+                // Pushes all happen before the close, so one more try after seeing it is enough
+                if (m_closed.load(std::memory_order_acquire)) return try_pop(item);
+
+                backoff.wait();
+                if (try_pop(item)) return true;
+            }
+        }
+
+        // Only once every producer is done
+        void
+        close()
+        {
+            m_closed.store(true, std::memory_order_release);
+        }
+
+        std::size_t
+        capacity()
+        const noexcept
+        {
+            return m_mask + 1;
+        }
+
+        // Approximate while items move through it
+        std::size_t
+        size()
+        const noexcept
+        {
+            std::size_t tail = m_tail.load(std::memory_order_relaxed);
+            std::size_t head = m_head.load(std::memory_order_relaxed);
+            return head > tail ? std::min(head - tail, capacity()) : 0;
+        }
+
+        std::uint64_t
+        full_waits()
+        const noexcept
+        {
+            return m_full_waits.load(std::memory_order_relaxed);
+        }
+
+        std::uint64_t
+        empty_waits()
+        const noexcept
+        {
+            return m_empty_waits.load(std::memory_order_relaxed);
+        }
+    };
+}
+
+#endif // SEARCH_ENGINE_RING_BUFFER_HPP
@@ -0,0 +1,169 @@
+#ifndef SEARCH_ENGINE_SEGMENTED_INDEX_HPP
+#define SEARCH_ENGINE_SEGMENTED_INDEX_HPP
+
+#include "common.hpp"
+#include "boolean-query.hpp"
+#include "dictionary.hpp"
+#include "index-reader.hpp"
+#include "thread-pool.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <filesystem>
+
+#define SEGMENTS_MANIFEST "MANIFEST"
+#define SEGMENTS_LOCK "LOCK"
+#define SEGMENTS_VERSION 1u
+#define TOMBSTONES_MAGIC 0x4c454453u // "SDEL"
+#define SEGMENT_MERGE_FACTOR 4
+#define SEGMENT_MERGE_MIN_DOCUMENTS 256
+#define SEGMENT_MAX_DELETED_RATIO 0.3
+#define SEGMENT_MERGE_INTERVAL std::chrono::seconds(5)
+
+namespace SearchEngine
+{
+    // A directory of immutable segments, each one a binary index, listed by a manifest that's
+    // only ever replaced atomically. Deleted documents are tombstoned per segment and dropped
+    // once a tiered merge rewrites their segment. Readers work on snapshots of the segment
+    // list, so merges & updates never pause a search.
+    class SegmentedIndex
+    {
+    public:
+        struct Segment
+        {
+            std::string name;
+            std::string tombstones_name;
+            std::shared_ptr<IndexReader> reader;
+            std::shared_ptr<const IndexReader::Tombstones> deleted;
+            std::size_t deleted_count;
+            // Postings of each term, by term index, that aren't tombstoned. Null without deletions
+            std::shared_ptr<const std::vector<std::uint32_t>> live_document_frequencies;
+
+            std::size_t
+            live_count()
+            const noexcept;
+        };
+
+        using Segments = std::vector<Segment>;
+        using Snapshot = std::shared_ptr<const Segments>;
+        using Result = std::pair<std::string, float>;
+
+    private:
+        std::string m_directory;
+        mutable std::mutex m_mutex;
+        Snapshot m_segments;
+        std::uint64_t m_generation;
+        std::uint64_t m_next_segment;
+        std::filesystem::file_time_type m_manifest_time;
+        int m_lock_fd;
+
+        std::thread m_merger;
+        std::mutex m_merger_mutex;
+        std::condition_variable m_merger_wakeup;
+        bool m_merger_stop;
+
+    private:
+        std::string
+        path(const std::string& name)
+        const;
+
+        bool
+        read_manifest(Segments& segments, std::uint64_t& generation, std::uint64_t& next_segment)
+        const;
+
+        bool
+        open_segment(Segment& segment)
+        const;
+
+        bool
+        write_tombstones(Segment& segment, std::uint64_t generation)
+        const;
+
+        void
+        remove_unreferenced(const Segments& segments)
+        const;
+
+        void
+        merge_in_background();
+
+        // Recounted whenever the tombstones change, so queries never decode postings to get idf
+        static void
+        count_live_document_frequencies(Segment& segment);
+
+        static std::size_t
+        live_document_frequency(const Segment& segment, const IndexFormat::TermRecord& record);
+
+        // Segment results are tagged with a collection-wide id to pick the global top k
+        static std::list<Result>
+        merge_results(const Segments& segments,
+            const std::vector<std::vector<IndexReader::ScoredDocument>>& segment_results,
+            std::size_t top);
+
+    public:
+        SegmentedIndex();
+        SegmentedIndex(const SegmentedIndex&) = delete;
+        SegmentedIndex& operator=(const SegmentedIndex&) = delete;
+        ~SegmentedIndex();
+
+        static bool
+        is_segmented_index(const std::string& path);
+
+        bool
+        create(const std::string& directory);
+
+        bool
+        open(const std::string& directory);
+
+        bool
+        refresh();
+
+        Snapshot
+        snapshot()
+        const;
+
+        std::uint64_t
+        generation()
+        const;
+
+        // Writers hold the directory lock between reading the latest manifest and committing
+        bool
+        lock(bool wait);
+
+        void
+        unlock()
+        noexcept;
+
+        bool
+        write_segment(const Dictionary& dictionary, Segment& segment);
+
+        void
+        delete_documents(Segment& segment, const std::vector<IndexReader::DocumentId>& ids)
+        const;
+
+        bool
+        commit(const Segments& segments);
+
+        static void
+        read_documents(const Segments& segments, Dictionary& dictionary);
+
+        bool
+        merge();
+
+        void
+        start_merging();
+
+        void
+        stop_merging();
+
+        std::list<Result>
+        search(const std::list<std::string>& tokens, std::size_t top, float min_score, ThreadPool* pool,
+            QueryTimings* timings = nullptr)
+        const;
+
+        std::list<Result>
+        search(const BooleanQuery& query, std::size_t top, ThreadPool* pool, QueryTimings* timings = nullptr)
+        const;
+    };
+}
+
+#endif // SEARCH_ENGINE_SEGMENTED_INDEX_HPP
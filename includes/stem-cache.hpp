@@ -0,0 +1,68 @@
+#ifndef SEARCH_ENGINE_STEM_CACHE_HPP
+#define SEARCH_ENGINE_STEM_CACHE_HPP
+
+#include "common.hpp"
+#include <string_view>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+
+#define STEM_CACHE_CAPACITY (64 * 1024)
+#define STEM_CACHE_SHARDS 64
+
+namespace SearchEngine
+{
+    // Concurrent word -> stem cache, bounded to a fixed number of entries per
+    // shard and evicting with the CLOCK approximation of LRU
+    class StemCache
+    {
+    private:
+        struct Slot
+        {
+            std::string word;
+            std::string stem;
+            std::atomic<bool> referenced;
+        };
+
+        struct Shard
+        {
+            std::shared_mutex mutex;
+            std::unordered_map<std::string_view, std::size_t> slots_by_word;
+            std::unique_ptr<Slot[]> slots;
+            std::size_t used;
+            std::size_t hand;
+            std::atomic<std::size_t> hits;
+            std::atomic<std::size_t> misses;
+        };
+
+        std::size_t m_shard_capacity;
+        std::unique_ptr<Shard[]> m_shards;
+
+    private:
+        Shard&
+        shard_for(std::string_view word)
+        const noexcept;
+
+    public:
+        explicit StemCache(std::size_t capacity);
+        StemCache(const StemCache&) = delete;
+        StemCache& operator=(const StemCache&) = delete;
+
+        bool
+        find(std::string_view word, std::string& stem)
+        const;
+
+        void
+        insert(std::string_view word, std::string_view stem);
+
+        std::size_t
+        hits()
+        const noexcept;
+
+        std::size_t
+        misses()
+        const noexcept;
+    };
+}
+
+#endif // SEARCH_ENGINE_STEM_CACHE_HPP
@@ -0,0 +1,61 @@
+#ifndef SEARCH_ENGINE_TERM_POOL_HPP
+#define SEARCH_ENGINE_TERM_POOL_HPP
+
+#include "common.hpp"
+#include <cstdint>
+#include <string_view>
+#include <mutex>
+#include <shared_mutex>
+#include <deque>
+#include <optional>
+
+#define TERM_POOL_SHARDS 64
+#define TERM_POOL_BLOCK_SIZE (64 * 1024)
+
+namespace SearchEngine
+{
+    // Interns every distinct term once into arena blocks and hands out dense ids,
+    // safe to share between indexing threads
+    class TermPool
+    {
+    public:
+        using TermId = std::uint32_t;
+
+    private:
+        struct Shard
+        {
+            std::shared_mutex mutex;
+            std::unordered_map<std::string_view, TermId> ids;
+            std::vector<std::unique_ptr<char[]>> blocks;
+            std::size_t block_used;
+            std::size_t block_size;
+        };
+
+        std::unique_ptr<Shard[]> m_shards;
+        std::mutex m_terms_mutex;
+        std::deque<std::string_view> m_terms;
+
+    private:
+        std::string_view
+        store(Shard& shard, std::string_view term);
+
+    public:
+        TermPool();
+        TermPool(const TermPool&) = delete;
+        TermPool& operator=(const TermPool&) = delete;
+
+        TermId
+        intern(std::string_view term);
+
+        std::optional<TermId>
+        find(std::string_view term);
+
+        std::string_view
+        term(TermId id);
+
+        std::size_t
+        size();
+    };
+}
+
+#endif // SEARCH_ENGINE_TERM_POOL_HPP
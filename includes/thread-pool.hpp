@@ -0,0 +1,75 @@
+#ifndef SEARCH_ENGINE_THREAD_POOL_HPP
+#define SEARCH_ENGINE_THREAD_POOL_HPP
+
+#include "common.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <atomic>
+
+namespace SearchEngine
+{
+    class ThreadPool
+    {
+    public:
+        using Task = std::function<void()>;
+
+    private:
+        // Each worker owns a deque: it pushes & pops at the back, idle workers steal from the front
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+            std::thread thread;
+        };
+
+        static thread_local ThreadPool* s_current_pool;
+        static thread_local std::size_t s_current_worker;
+
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        std::atomic<std::size_t> m_next_worker;
+        std::atomic<std::size_t> m_pending;
+        std::atomic<bool> m_stop;
+        std::mutex m_mutex;
+        std::condition_variable m_work_available;
+        std::condition_variable m_all_done;
+
+    private:
+        void
+        run(std::size_t index);
+
+        bool
+        pop_local(std::size_t index, Task& task);
+
+        bool
+        steal(std::size_t index, Task& task);
+
+    public:
+        explicit ThreadPool(std::size_t threads);
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool();
+
+        static std::size_t
+        default_size()
+        noexcept;
+
+        std::size_t
+        size()
+        const noexcept;
+
+        static std::size_t
+        current_worker()
+        noexcept;
+
+        void
+        submit(Task task);
+
+        void
+        wait();
+    };
+}
+
+#endif // SEARCH_ENGINE_THREAD_POOL_HPP
@@ -3,6 +3,8 @@
 
 #include "common.hpp"
 #include "dictionary.hpp"
+#include "stem-cache.hpp"
+#include "indexing-stats.hpp"
 #include <string_view>
 #include <optional>
 #include <mutex>
@@ -19,41 +21,59 @@ namespace SearchEngine
 
     private:
         static std::string s_language;
+        static StemCache s_stem_cache;
 
         std::string_view m_content;
         std::size_t m_current;
-        StemmerPtr m_stemmer_ptr;
+        std::string m_buffer;
+        std::string m_stem;
+        std::string m_pending;
     #if MULTITHREADING
         std::mutex m_mutex;
     #endif // MULTITHREADING
 
     private:
-        bool
-        is_digit(const char c)
-            const noexcept;
+        static StemmerPtr
+        thread_stemmer();
 
-        bool
-        is_alpha(const char c)
-            const noexcept;
+        std::string_view
+        stem(std::string_view word);
 
-        std::string
-        scan_number();
-
-        std::string
-        scan_alpha_numeric();
+        std::string_view
+        normalize(std::string_view token);
 
     public:
-        Tokenizer(const std::string& content);
-        ~Tokenizer();
+        Tokenizer();
+        Tokenizer(std::string_view content);
+
+        static const StemCache&
+        stem_cache()
+        noexcept;
 
         std::pair<bool, std::optional<std::string>>
         next_token();
 
+        // Allocation free variant of `next_token`, the view stays valid until the next call
+        std::optional<std::string_view>
+        next_term();
+
         Dictionary::TermFreqMap
-        scan_terms_in_file();
+        scan_terms_in_file(TermPool& terms);
 
         std::list<std::string> scan_text();
+
+        // Streaming mode: chunks are tokenized as they arrive, a token cut by the
+        // end of a chunk is kept and continued by the next one until `flush`. When a
+        // sequence is given, every term is also appended to it in order, for positions
+        void
+        feed(std::string_view chunk,
+            TermPool& terms,
+            Dictionary::TermFreqMap& term_freq_map,
+            Dictionary::TermSequence* sequence = nullptr);
+
+        void
+        flush(TermPool& terms, Dictionary::TermFreqMap& term_freq_map, Dictionary::TermSequence* sequence = nullptr);
     };
 }
 
-#endif // SEARCH_ENGINE_TOKENIZER_HPP
\ No newline at end of file
+#endif // SEARCH_ENGINE_TOKENIZER_HPP
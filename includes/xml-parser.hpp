@@ -3,21 +3,34 @@
 
 #include "common.hpp"
 #include <libxml/xmlreader.h>
+#include <array>
+#include <functional>
+#include <string_view>
 
 namespace SearchEngine
 {
     class XmlParser
     {
+    public:
+        using TextHandler = std::function<void(std::string_view)>;
+
     private:
-        static const std::unordered_set<std::string> s_ignore_tags;
+        static const std::array<std::string_view, 4> s_ignore_tags;
 
         xmlTextReaderPtr m_reader;
 
     public:
         XmlParser(const std::string &filename);
+        XmlParser(const std::string &filename, std::string_view content);
+
+        static bool
+        is_ignored_tag(std::string_view name);
 
         std::string parse();
 
+        // Streams every text node to `on_text` as it's read, without building the whole content
+        void parse(const TextHandler& on_text);
+
         ~XmlParser();
     };
 }
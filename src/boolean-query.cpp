@@ -0,0 +1,664 @@
+#include "../includes/boolean-query.hpp"
+#include "../includes/tokenizer.hpp"
+#include <numeric>
+
+namespace
+{
+    using Node = SearchEngine::BooleanQuery::Node;
+    using Type = SearchEngine::BooleanQuery::Type;
+    using DocumentId = SearchEngine::BooleanQuery::DocumentId;
+    using Documents = SearchEngine::BooleanQuery::Documents;
+
+    enum class TokenType
+    {
+        Word,
+        Quoted,
+        Open,
+        Close,
+        And,
+        Or,
+        Not,
+    };
+
+    struct QueryToken
+    {
+        TokenType type;
+        std::string_view text;
+    };
+
+    std::vector<QueryToken>
+    lex(std::string_view query)
+    {
+        std::vector<QueryToken> tokens;
+        std::size_t i = 0;
+        while (i < query.size())
+        {
+            char c = query[i];
+            if (std::isspace(static_cast<unsigned char>(c)))
+            {
+                ++i;
+            }
+            else if (c == '(' || c == ')')
+            {
+                tokens.push_back({ c == '(' ? TokenType::Open : TokenType::Close, query.substr(i, 1) });
+                ++i;
+            }
+            else if (c == '"')
+            {
+                // An unterminated quote runs to the end of the query
+                std::size_t end = std::min(query.find('"', i + 1), query.size());
+                tokens.push_back({ TokenType::Quoted, query.substr(i + 1, end - i - 1) });
+                i = end + 1;
+            }
+            else
+            {
+                std::size_t end = i;
+                while (end < query.size()
+                    && !std::isspace(static_cast<unsigned char>(query[end]))
+                    && query[end] != '(' && query[end] != ')' && query[end] != '"')
+                {
+                    ++end;
+                }
+
+                std::string_view word = query.substr(i, end - i);
+                TokenType type = word == "AND" ? TokenType::And
+                    : word == "OR" ? TokenType::Or
+                    : word == "NOT" ? TokenType::Not
+                    : TokenType::Word;
+                tokens.push_back({ type, word });
+                i = end;
+            }
+        }
+
+        return tokens;
+    }
+
+    // Nested operators of the same kind are flattened, and an operator left with a single
+    // operand is replaced by it
+    std::optional<Node>
+    combine(Type type, std::vector<Node>&& operands)
+    {
+        std::vector<Node> children;
+        for (Node& operand : operands)
+        {
+            if (operand.type == type)
+            {
+                std::move(operand.children.begin(), operand.children.end(), std::back_inserter(children));
+            }
+            else
+            {
+                children.push_back(std::move(operand));
+            }
+        }
+
+        if (children.empty()) return std::nullopt;
+        if (children.size() == 1) return std::move(children.front());
+
+        return Node { type, {}, std::move(children) };
+    }
+
+    std::optional<Node>
+    terms_node(std::string_view text)
+    {
+        SearchEngine::Tokenizer tokenizer(text);
+        std::list<std::string> tokens = tokenizer.scan_text();
+        if (tokens.empty()) return std::nullopt;
+
+        return Node
+        {
+            tokens.size() == 1 ? Type::Term : Type::Phrase,
+            std::vector<std::string>(tokens.begin(), tokens.end()),
+            {}
+        };
+    }
+
+    // Recursive descent, lenient with malformed queries: missing operands and unbalanced
+    // parentheses are skipped over rather than rejected
+    //   or    := and ("OR" and)*
+    //   and   := unary (["AND"] unary)*
+    //   unary := "NOT" unary | "(" or ")" | "phrase" | word
+    class Parser
+    {
+    private:
+        std::vector<QueryToken> m_tokens;
+        std::size_t m_position;
+
+    private:
+        bool
+        at(TokenType type)
+        const noexcept
+        {
+            return m_position < m_tokens.size() && m_tokens[m_position].type == type;
+        }
+
+    public:
+        explicit Parser(std::string_view query)
+            : m_tokens(lex(query)),
+              m_position(0)
+        {
+        }
+
+        std::optional<Node>
+        parse()
+        {
+            std::vector<Node> parts;
+            while (m_position < m_tokens.size())
+            {
+                if (auto node = parse_or()) parts.push_back(std::move(*node));
+
+                // Only a stray closing parenthesis stops an expression before the end
+                if (at(TokenType::Close)) ++m_position;
+            }
+
+            return combine(Type::And, std::move(parts));
+        }
+
+        std::optional<Node>
+        parse_or()
+        {
+            std::vector<Node> operands;
+            while (true)
+            {
+                if (auto node = parse_and()) operands.push_back(std::move(*node));
+                if (!at(TokenType::Or)) break;
+                ++m_position;
+            }
+
+            return combine(Type::Or, std::move(operands));
+        }
+
+        std::optional<Node>
+        parse_and()
+        {
+            std::vector<Node> operands;
+            while (m_position < m_tokens.size() && !at(TokenType::Or) && !at(TokenType::Close))
+            {
+                if (at(TokenType::And))
+                {
+                    ++m_position;
+                    continue;
+                }
+
+                if (auto node = parse_unary()) operands.push_back(std::move(*node));
+            }
+
+            return combine(Type::And, std::move(operands));
+        }
+
+        std::optional<Node>
+        parse_unary()
+        {
+            if (m_position >= m_tokens.size()) return std::nullopt;
+
+            const QueryToken& token = m_tokens[m_position];
+            switch (token.type)
+            {
+                case TokenType::Not:
+                {
+                    ++m_position;
+                    std::optional<Node> operand = parse_unary();
+                    if (!operand) return std::nullopt;
+
+                    return Node { Type::Not, {}, { std::move(*operand) } };
+                }
+                case TokenType::Open:
+                {
+                    ++m_position;
+                    std::optional<Node> node = parse_or();
+                    if (at(TokenType::Close)) ++m_position;
+                    return node;
+                }
+                case TokenType::Word:
+                case TokenType::Quoted:
+                    ++m_position;
+                    return terms_node(token.text);
+                default:
+                    // An operator where an operand was expected, left to the caller
+                    return std::nullopt;
+            }
+        }
+    };
+
+    // A term's postings, or a subexpression's documents, walked in increasing id order
+    struct Cursor
+    {
+        SearchEngine::PostingCursor postings;
+        SearchEngine::PositionsReader positions;
+        const Documents* documents; // Set for a subexpression
+        std::size_t position;
+        std::size_t cost; // Documents it can match, cursors are led by the cheapest
+
+        bool
+        at_end()
+        const noexcept
+        {
+            return documents != nullptr ? position >= documents->size() : postings.at_end();
+        }
+
+        DocumentId
+        document_id()
+        const noexcept
+        {
+            return documents != nullptr ? (*documents)[position] : postings.document_id();
+        }
+
+        // Postings jump through their skip table, documents with a galloping search
+        void
+        advance_to(DocumentId id)
+        {
+            if (documents == nullptr)
+            {
+                postings.advance_to(id);
+                return;
+            }
+
+            const Documents& ids = *documents;
+            if (position >= ids.size() || ids[position] >= id) return;
+
+            std::size_t low = position;
+            std::size_t step = 1;
+            while (low + step < ids.size() && ids[low + step] < id)
+            {
+                low += step;
+                step *= 2;
+            }
+
+            std::size_t high = std::min(low + step, ids.size());
+            position = std::lower_bound(ids.begin() + low, ids.begin() + high, id) - ids.begin();
+        }
+    };
+
+    Cursor
+    documents_cursor(const Documents& documents)
+    {
+        return { SearchEngine::PostingCursor(), SearchEngine::PositionsReader(), &documents, 0, documents.size() };
+    }
+
+    // Whether the phrase's terms, with their cursors all on the same document, appear there
+    // one after the other. Documents indexed without positions (imported from XML) have none
+    // for any term, holding every term of the phrase is all they can be checked for
+    bool
+    phrase_matches(std::vector<Cursor>& cursors,
+        const std::vector<std::size_t>& phrase,
+        std::vector<std::uint32_t>& starts,
+        std::vector<std::uint32_t>& positions)
+    {
+        Cursor& first = cursors[phrase.front()];
+        first.positions.read(first.postings.ordinal(), starts);
+        if (starts.empty()) return true;
+
+        for (std::uint32_t offset = 1; offset < phrase.size() && !starts.empty(); ++offset)
+        {
+            Cursor& cursor = cursors[phrase[offset]];
+            cursor.positions.read(cursor.postings.ordinal(), positions);
+            if (positions.empty()) return true;
+
+            // Only starts followed by this term `offset` positions later are kept, both are sorted
+            std::size_t kept = 0;
+            auto position = positions.begin();
+            for (std::uint32_t start : starts)
+            {
+                while (position != positions.end() && *position < start + offset) ++position;
+                if (position == positions.end()) break;
+
+                if (*position == start + offset)
+                {
+                    starts[kept++] = start;
+                }
+            }
+            starts.resize(kept);
+        }
+
+        return !starts.empty();
+    }
+
+    Documents
+    all_documents(const SearchEngine::IndexReader& reader)
+    {
+        Documents documents(reader.document_count());
+        std::iota(documents.begin(), documents.end(), 0);
+        return documents;
+    }
+
+    void
+    write_key(const Node& node, std::string& key)
+    {
+        switch (node.type)
+        {
+            case Type::Term:
+                key += node.terms.front();
+                return;
+            case Type::Phrase:
+                key += '"';
+                for (std::size_t i = 0; i < node.terms.size(); ++i)
+                {
+                    key += (i > 0 ? " " : "") + node.terms[i];
+                }
+                key += '"';
+                return;
+            default:
+                break;
+        }
+
+        // Operands of AND & OR are sorted, so their order doesn't matter to the cache
+        std::vector<std::string> operands;
+        for (const Node& child : node.children)
+        {
+            write_key(child, operands.emplace_back());
+        }
+        std::sort(operands.begin(), operands.end());
+
+        key += node.type == Type::And ? "AND(" : node.type == Type::Or ? "OR(" : "NOT(";
+        for (std::size_t i = 0; i < operands.size(); ++i)
+        {
+            key += (i > 0 ? "," : "") + operands[i];
+        }
+        key += ')';
+    }
+
+    void
+    collect_terms(const Node& node, std::vector<std::string>& terms)
+    {
+        if (node.type == Type::Not) return;
+
+        for (const auto& term : node.terms)
+        {
+            if (std::find(terms.begin(), terms.end(), term) == terms.end())
+            {
+                terms.push_back(term);
+            }
+        }
+
+        for (const Node& child : node.children)
+        {
+            collect_terms(child, terms);
+        }
+    }
+}
+
+SearchEngine::BooleanQuery::BooleanQuery(std::string_view query)
+    : m_root(Parser(query).parse())
+{
+}
+
+bool
+SearchEngine::BooleanQuery::has_syntax(std::string_view query)
+{
+    for (const QueryToken& token : lex(query))
+    {
+        if (token.type != TokenType::Word) return true;
+    }
+
+    return false;
+}
+
+bool
+SearchEngine::BooleanQuery::empty()
+const noexcept
+{
+    return !m_root.has_value();
+}
+
+std::string
+SearchEngine::BooleanQuery::key()
+const
+{
+    // Upper case & punctuation keep these apart from ranked queries' keys, made of terms only
+    std::string key = "MATCH ";
+    if (m_root)
+    {
+        write_key(*m_root, key);
+    }
+
+    return key;
+}
+
+std::vector<std::string>
+SearchEngine::BooleanQuery::scored_terms()
+const
+{
+    std::vector<std::string> terms;
+    if (m_root)
+    {
+        collect_terms(*m_root, terms);
+    }
+
+    return terms;
+}
+
+SearchEngine::BooleanQuery::Documents
+SearchEngine::BooleanQuery::intersect(const std::vector<const Node*>& nodes, const IndexReader& reader)
+const
+{
+    std::vector<Cursor> cursors;
+    std::vector<Cursor> excluded;
+    std::vector<std::vector<std::size_t>> phrases; // Each phrase's cursors, in the phrase's order
+
+    // Cursors point into the subexpressions' documents, which mustn't move
+    std::vector<Documents> subexpressions;
+    subexpressions.reserve(nodes.size());
+
+    for (const Node* node : nodes)
+    {
+        switch (node->type)
+        {
+            case Type::Term:
+            case Type::Phrase:
+            {
+                std::vector<std::size_t> phrase;
+                for (const auto& term : node->terms)
+                {
+                    const IndexFormat::TermRecord* record = reader.find_term(term);
+                    if (record == nullptr) return {};
+
+                    phrase.push_back(cursors.size());
+                    cursors.push_back({ reader.postings(*record), reader.positions(*record), nullptr, 0, record->document_frequency });
+                }
+
+                if (node->type == Type::Phrase)
+                {
+                    phrases.push_back(std::move(phrase));
+                }
+                break;
+            }
+            case Type::Not:
+                subexpressions.push_back(evaluate(node->children.front(), reader));
+                excluded.push_back(documents_cursor(subexpressions.back()));
+                break;
+            default:
+                subexpressions.push_back(evaluate(*node, reader));
+                if (subexpressions.back().empty()) return {};
+
+                cursors.push_back(documents_cursor(subexpressions.back()));
+                break;
+        }
+    }
+
+    // Only negations: every document but theirs
+    if (cursors.empty())
+    {
+        Documents documents = all_documents(reader);
+        for (Cursor& cursor : excluded)
+        {
+            Documents remaining;
+            std::set_difference(documents.begin(), documents.end(),
+                cursor.documents->begin(), cursor.documents->end(), std::back_inserter(remaining));
+            documents = std::move(remaining);
+        }
+
+        return documents;
+    }
+
+    std::vector<std::size_t> order(cursors.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&cursors](std::size_t a, std::size_t b)
+    {
+        return cursors[a].cost < cursors[b].cost;
+    });
+
+    // The rarest cursor leads, the others only ever jump to its candidates, and when they
+    // overshoot one the lead jumps to where they landed
+    Documents documents;
+    std::vector<std::uint32_t> starts;
+    std::vector<std::uint32_t> positions;
+    Cursor& lead = cursors[order.front()];
+    while (!lead.at_end())
+    {
+        DocumentId candidate = lead.document_id();
+
+        bool aligned = true;
+        for (std::size_t i = 1; i < order.size(); ++i)
+        {
+            Cursor& cursor = cursors[order[i]];
+            cursor.advance_to(candidate);
+            if (cursor.at_end()) return documents;
+
+            if (cursor.document_id() != candidate)
+            {
+                lead.advance_to(cursor.document_id());
+                aligned = false;
+                break;
+            }
+        }
+
+        if (!aligned) continue;
+
+        bool matches = true;
+        for (const auto& phrase : phrases)
+        {
+            if (!phrase_matches(cursors, phrase, starts, positions))
+            {
+                matches = false;
+                break;
+            }
+        }
+
+        for (std::size_t i = 0; i < excluded.size() && matches; ++i)
+        {
+            excluded[i].advance_to(candidate);
+            matches = excluded[i].at_end() || excluded[i].document_id() != candidate;
+        }
+
+        if (matches)
+        {
+            documents.push_back(candidate);
+        }
+
+        lead.advance_to(candidate + 1);
+    }
+
+    return documents;
+}
+
+SearchEngine::BooleanQuery::Documents
+SearchEngine::BooleanQuery::evaluate(const Node& node, const IndexReader& reader)
+const
+{
+    switch (node.type)
+    {
+        case Type::Term:
+        {
+            Documents documents;
+            const IndexFormat::TermRecord* record = reader.find_term(node.terms.front());
+            if (record == nullptr) return documents;
+
+            documents.reserve(record->document_frequency);
+            for (PostingCursor posting = reader.postings(*record); !posting.at_end(); posting.next())
+            {
+                documents.push_back(posting.document_id());
+            }
+
+            return documents;
+        }
+        case Type::Phrase:
+            return intersect({ &node }, reader);
+        case Type::And:
+        {
+            std::vector<const Node*> children;
+            for (const Node& child : node.children)
+            {
+                children.push_back(&child);
+            }
+
+            return intersect(children, reader);
+        }
+        case Type::Or:
+        {
+            Documents documents;
+            for (const Node& child : node.children)
+            {
+                Documents child_documents = evaluate(child, reader);
+                Documents merged;
+                std::set_union(documents.begin(), documents.end(),
+                    child_documents.begin(), child_documents.end(), std::back_inserter(merged));
+                documents = std::move(merged);
+            }
+
+            return documents;
+        }
+        case Type::Not:
+            return intersect({ &node }, reader);
+    }
+
+    return {};
+}
+
+SearchEngine::BooleanQuery::Documents
+SearchEngine::BooleanQuery::match(const IndexReader& reader, const IndexReader::Tombstones* deleted)
+const
+{
+    if (!m_root) return {};
+
+    Documents documents = evaluate(*m_root, reader);
+    if (deleted != nullptr)
+    {
+        documents.erase(std::remove_if(documents.begin(), documents.end(),
+            [deleted](DocumentId id) { return (*deleted)[id]; }), documents.end());
+    }
+
+    return documents;
+}
+
+std::vector<SearchEngine::IndexReader::ScoredDocument>
+SearchEngine::BooleanQuery::search(const IndexReader& reader,
+    std::size_t k,
+    const IndexReader::Tombstones* deleted,
+    const IdfMap* idf)
+const
+{
+    std::vector<IndexReader::ScoredDocument> scores;
+    for (DocumentId id : match(reader, deleted))
+    {
+        scores.push_back({ id, 0.0f });
+    }
+
+    // Each term's postings only jump between the matching documents
+    for (const auto& term : scored_terms())
+    {
+        const IndexFormat::TermRecord* record = reader.find_term(term);
+        if (record == nullptr) continue;
+
+        float term_idf = record->idf;
+        if (idf != nullptr)
+        {
+            auto found = idf->find(term);
+            if (found == idf->end()) continue;
+            term_idf = found->second;
+        }
+
+        PostingCursor posting = reader.postings(*record);
+        for (auto& [id, score] : scores)
+        {
+            posting.advance_to(id);
+            if (posting.at_end()) break;
+
+            if (posting.document_id() == id)
+            {
+                score += static_cast<float>(posting.freq()) / reader.document_length(id) * term_idf;
+            }
+        }
+    }
+
+    IndexReader::sort_by_score(scores, k);
+    return scores;
+}
@@ -0,0 +1,175 @@
+#include "../includes/char-scan.hpp"
+
+namespace
+{
+    inline bool
+    is_digit(char c)
+    noexcept
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    inline bool
+    is_alpha(char c)
+    noexcept
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+#if CHAR_SCAN_AVX2
+    using Vector = __m256i;
+    constexpr std::size_t VECTOR_SIZE = 32;
+
+    inline Vector load(const char* p) noexcept { return _mm256_loadu_si256(reinterpret_cast<const Vector*>(p)); }
+    inline void store(char* p, Vector v) noexcept { _mm256_storeu_si256(reinterpret_cast<Vector*>(p), v); }
+    inline Vector splat(char c) noexcept { return _mm256_set1_epi8(c); }
+    inline Vector greater(Vector a, Vector b) noexcept { return _mm256_cmpgt_epi8(a, b); }
+    inline Vector equal(Vector a, Vector b) noexcept { return _mm256_cmpeq_epi8(a, b); }
+    inline Vector both(Vector a, Vector b) noexcept { return _mm256_and_si256(a, b); }
+    inline Vector either(Vector a, Vector b) noexcept { return _mm256_or_si256(a, b); }
+    inline Vector add(Vector a, Vector b) noexcept { return _mm256_add_epi8(a, b); }
+    inline unsigned mask(Vector v) noexcept { return static_cast<unsigned>(_mm256_movemask_epi8(v)); }
+    constexpr unsigned FULL_MASK = 0xFFFFFFFFu;
+#elif CHAR_SCAN_SSE2
+    using Vector = __m128i;
+    constexpr std::size_t VECTOR_SIZE = 16;
+
+    inline Vector load(const char* p) noexcept { return _mm_loadu_si128(reinterpret_cast<const Vector*>(p)); }
+    inline void store(char* p, Vector v) noexcept { _mm_storeu_si128(reinterpret_cast<Vector*>(p), v); }
+    inline Vector splat(char c) noexcept { return _mm_set1_epi8(c); }
+    inline Vector greater(Vector a, Vector b) noexcept { return _mm_cmpgt_epi8(a, b); }
+    inline Vector equal(Vector a, Vector b) noexcept { return _mm_cmpeq_epi8(a, b); }
+    inline Vector both(Vector a, Vector b) noexcept { return _mm_and_si128(a, b); }
+    inline Vector either(Vector a, Vector b) noexcept { return _mm_or_si128(a, b); }
+    inline Vector add(Vector a, Vector b) noexcept { return _mm_add_epi8(a, b); }
+    inline unsigned mask(Vector v) noexcept { return static_cast<unsigned>(_mm_movemask_epi8(v)); }
+    constexpr unsigned FULL_MASK = 0xFFFFu;
+#endif
+
+#if CHAR_SCAN_AVX2 || CHAR_SCAN_SSE2
+    // Bytes >= 0x80 compare as negative, so they never fall in an ASCII range
+    inline Vector
+    in_range(Vector v, char low, char high)
+    noexcept
+    {
+        return both(greater(v, splat(low - 1)), greater(splat(high + 1), v));
+    }
+
+    inline Vector
+    digits(Vector v)
+    noexcept
+    {
+        return in_range(v, '0', '9');
+    }
+
+    inline Vector
+    letters(Vector v)
+    noexcept
+    {
+        return in_range(either(v, splat(0x20)), 'a', 'z');
+    }
+#endif
+}
+
+const char*
+SearchEngine::CharScan::skip_separators(const char* begin, const char* end)
+noexcept
+{
+#if CHAR_SCAN_AVX2 || CHAR_SCAN_SSE2
+    for (; begin + VECTOR_SIZE <= end; begin += VECTOR_SIZE)
+    {
+        Vector v = load(begin);
+        unsigned found = mask(either(digits(v), letters(v)));
+        if (found != 0) return begin + __builtin_ctz(found);
+    }
+#endif
+
+    while (begin != end && !is_digit(*begin) && !is_alpha(*begin))
+    {
+        ++begin;
+    }
+
+    return begin;
+}
+
+const char*
+SearchEngine::CharScan::scan_digits(const char* begin, const char* end)
+noexcept
+{
+#if CHAR_SCAN_AVX2 || CHAR_SCAN_SSE2
+    for (; begin + VECTOR_SIZE <= end; begin += VECTOR_SIZE)
+    {
+        unsigned found = ~mask(digits(load(begin))) & FULL_MASK;
+        if (found != 0) return begin + __builtin_ctz(found);
+    }
+#endif
+
+    while (begin != end && is_digit(*begin))
+    {
+        ++begin;
+    }
+
+    return begin;
+}
+
+const char*
+SearchEngine::CharScan::scan_word(const char* begin, const char* end)
+noexcept
+{
+#if CHAR_SCAN_AVX2 || CHAR_SCAN_SSE2
+    for (; begin + VECTOR_SIZE <= end; begin += VECTOR_SIZE)
+    {
+        Vector v = load(begin);
+        unsigned found = ~mask(either(either(digits(v), letters(v)), equal(v, splat('_')))) & FULL_MASK;
+        if (found != 0) return begin + __builtin_ctz(found);
+    }
+#endif
+
+    while (begin != end && (is_digit(*begin) || is_alpha(*begin) || *begin == '_'))
+    {
+        ++begin;
+    }
+
+    return begin;
+}
+
+const char*
+SearchEngine::CharScan::find_markup(const char* begin, const char* end)
+noexcept
+{
+#if CHAR_SCAN_AVX2 || CHAR_SCAN_SSE2
+    for (; begin + VECTOR_SIZE <= end; begin += VECTOR_SIZE)
+    {
+        Vector v = load(begin);
+        unsigned found = mask(either(equal(v, splat('<')), equal(v, splat('&'))));
+        if (found != 0) return begin + __builtin_ctz(found);
+    }
+#endif
+
+    while (begin != end && *begin != '<' && *begin != '&')
+    {
+        ++begin;
+    }
+
+    return begin;
+}
+
+void
+SearchEngine::CharScan::to_lower(char* dst, const char* src, std::size_t length)
+noexcept
+{
+    const char* end = src + length;
+
+#if CHAR_SCAN_AVX2 || CHAR_SCAN_SSE2
+    for (; src + VECTOR_SIZE <= end; src += VECTOR_SIZE, dst += VECTOR_SIZE)
+    {
+        Vector v = load(src);
+        store(dst, add(v, both(in_range(v, 'A', 'Z'), splat(0x20))));
+    }
+#endif
+
+    for (; src != end; ++src, ++dst)
+    {
+        *dst = *src >= 'A' && *src <= 'Z' ? *src + 0x20 : *src;
+    }
+}
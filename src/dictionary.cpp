@@ -1,11 +1,74 @@
 #include "../includes/dictionary.hpp"
+#include <cstdio>
+#include <fstream>
 
 SearchEngine::Dictionary::Dictionary()
-    : m_file_map_ptr(new FileMap()),
-      m_term_occurrence_map_ptr(new TermOccurrenceMap())
+    : Dictionary(std::make_shared<TermPool>())
 {
 }
 
+SearchEngine::Dictionary::Dictionary(TermPoolPtr terms)
+    : m_terms(std::move(terms)),
+      m_file_map_ptr(new FileMap()),
+      m_sequence_map_ptr(new SequenceMap()),
+      m_term_occurrence_map_ptr(new TermOccurrenceMap()),
+      m_file_info_ptr(new FileInfoMap()),
+      m_inverted_index_ptr(new InvertedIndex()),
+      m_memory_usage(0)
+{
+}
+
+SearchEngine::TermPool&
+SearchEngine::Dictionary::terms()
+const noexcept
+{
+    return *m_terms;
+}
+
+const SearchEngine::Dictionary::TermPoolPtr&
+SearchEngine::Dictionary::term_pool()
+const noexcept
+{
+    return m_terms;
+}
+
+std::size_t
+SearchEngine::Dictionary::document_count()
+const noexcept
+{
+    return m_file_map_ptr->size();
+}
+
+std::size_t
+SearchEngine::Dictionary::memory_usage()
+const noexcept
+{
+    return m_memory_usage;
+}
+
+std::size_t
+SearchEngine::Dictionary::file_memory_usage(const std::string& filename,
+    const TermFreqMap& term_freq_map,
+    std::size_t sequence_length)
+noexcept
+{
+    return DICTIONARY_FILE_BYTES + filename.size() + term_freq_map.size() * DICTIONARY_TERM_FREQ_BYTES
+        + sequence_length * sizeof(TermId);
+}
+
+void
+SearchEngine::Dictionary::recount_memory_usage()
+noexcept
+{
+    m_memory_usage = 0;
+    for (const auto& [filename, term_freq_map] : *m_file_map_ptr)
+    {
+        auto sequence = m_sequence_map_ptr->find(filename);
+        m_memory_usage += file_memory_usage(filename, term_freq_map,
+            sequence != m_sequence_map_ptr->end() ? sequence->second.size() : 0);
+    }
+}
+
 void
 SearchEngine::Dictionary::write_to_xml(const std::string& output_filename)
 const
@@ -16,15 +79,24 @@ const
         xmlTextWriterStartElement(writer, BAD_CAST "Dictionary");
             // FileMap
             xmlTextWriterStartElement(writer, BAD_CAST "Files");
-                for (const auto& [filename, element] : *m_file_map_ptr)
+                for (DocumentId id = 0; id < m_documents.size(); ++id)
                 {
+                    const std::string& filename = m_documents[id];
                     xmlTextWriterStartElement(writer, BAD_CAST "File");
                         xmlTextWriterWriteAttribute(writer, BAD_CAST "name", BAD_CAST filename.c_str());
-                        for (const auto& [term, freq] : element)
+                        xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "length", "%lu", m_document_lengths[id]);
+                        auto info = m_file_info_ptr->find(filename);
+                        if (info != m_file_info_ptr->end())
+                        {
+                            xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "size", "%lu", info->second.size);
+                            xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "mtime", "%ld", info->second.mtime);
+                            xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "hash", "%016lx", info->second.hash);
+                        }
+                        for (const auto& [term, freq] : m_file_map_ptr->at(filename))
                         {
                             xmlTextWriterStartElement(writer, BAD_CAST "Term");
-                                xmlTextWriterWriteAttribute(writer, BAD_CAST "key", BAD_CAST term.c_str());
-                                xmlTextWriterWriteFormatString(writer, "%lu", freq);
+                                xmlTextWriterWriteAttribute(writer, BAD_CAST "key", BAD_CAST std::string(m_terms->term(term)).c_str());
+                                xmlTextWriterWriteFormatString(writer, "%u", freq);
                             xmlTextWriterEndElement(writer);
                         }
                     xmlTextWriterEndElement(writer);
@@ -36,7 +108,8 @@ const
                 for (const auto& [term, occurrence] : *m_term_occurrence_map_ptr)
                 {
                     xmlTextWriterStartElement(writer, BAD_CAST "Term");
-                        xmlTextWriterWriteAttribute(writer, BAD_CAST "key", BAD_CAST term.c_str());
+                        xmlTextWriterWriteAttribute(writer, BAD_CAST "key", BAD_CAST std::string(m_terms->term(term)).c_str());
+                        xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "idf", "%.9g", m_inverted_index_ptr->at(term).idf);
                         xmlTextWriterWriteFormatString(writer, "%lu", occurrence);
                     xmlTextWriterEndElement(writer);
                 }
@@ -51,6 +124,12 @@ void
 SearchEngine::Dictionary::read_from_xml(const std::string& filename)
 {
     FileMapPtr map(new FileMap());
+    m_sequence_map_ptr.reset(new SequenceMap());
+    m_term_occurrence_map_ptr.reset(new TermOccurrenceMap());
+    m_file_info_ptr.reset(new FileInfoMap());
+    m_inverted_index_ptr.reset(new InvertedIndex());
+    m_documents.clear();
+    m_document_lengths.clear();
 
     xmlDocPtr doc = xmlParseFile(filename.c_str());
     xmlNodePtr root = xmlDocGetRootElement(doc);
@@ -82,9 +161,8 @@ SearchEngine::Dictionary::read_from_xml(const std::string& filename)
 
     // Files Tag
     {
-
-        xmlNodePtr current_file = root->children;
-        do
+        // An empty index has no `File`, an empty document has no `Term`
+        for (xmlNodePtr current_file = root->children; current_file != nullptr; current_file = current_file->next)
         {
             if (strcmp((char*) current_file->name, "File") != 0)
             {
@@ -101,9 +179,40 @@ SearchEngine::Dictionary::read_from_xml(const std::string& filename)
                 return;
             }
 
+            // Documents are written in id order, older files without `length` get it recomputed
+            // and files without `size`, `mtime` & `hash` are re-indexed by the next update
+            bool has_length = false;
+            bool has_info = false;
+            std::size_t file_length = 0;
+            FileInfo info {};
+            for (xmlAttrPtr attr = current_file->properties->next; attr != nullptr; attr = attr->next)
+            {
+                if (attr->children == nullptr || attr->children->content == nullptr) continue;
+
+                const char* value = (char*) attr->children->content;
+                if (strcmp((char*) attr->name, "length") == 0)
+                {
+                    file_length = strtoul(value, nullptr, 10);
+                    has_length = true;
+                }
+                else if (strcmp((char*) attr->name, "size") == 0)
+                {
+                    info.size = strtoull(value, nullptr, 10);
+                    has_info = true;
+                }
+                else if (strcmp((char*) attr->name, "mtime") == 0)
+                {
+                    info.mtime = strtoll(value, nullptr, 10);
+                }
+                else if (strcmp((char*) attr->name, "hash") == 0)
+                {
+                    info.hash = strtoull(value, nullptr, 16);
+                }
+            }
+
             TermFreqMap term_freq_map;
-            xmlNodePtr current_term = current_file->children;
-            do
+            std::size_t length = 0;
+            for (xmlNodePtr current_term = current_file->children; current_term != nullptr; current_term = current_term->next)
             {
                 if (strcmp((char *)current_term->name, "Term") != 0)
                 {
@@ -126,26 +235,36 @@ SearchEngine::Dictionary::read_from_xml(const std::string& filename)
                     return;
                 }
 
+                std::size_t freq = atoi((char*)current_term->children->content);
                 term_freq_map.insert(
                 {
-                    std::string((char*) current_term->properties->children->content),
-                    atoi((char*)current_term->children->content)
+                    m_terms->intern((char*) current_term->properties->children->content),
+                    freq
                 });
+                length += freq;
+            }
+
+            if (has_length)
+            {
+                length = file_length;
             }
-            while ((current_term = current_term->next) != nullptr);
 
-            map->insert({ std::string((char*) current_file->properties->children->content), term_freq_map });
+            std::string name((char*) current_file->properties->children->content);
+            if (has_info)
+            {
+                m_file_info_ptr->insert({ name, info });
+            }
+            index_document(name, term_freq_map, length, nullptr);
+            map->insert({ std::move(name), std::move(term_freq_map) });
         }
-        while ((current_file = current_file->next) != nullptr);
     }
 
     // TermOccurrence Tag
     root = root->next;
     {
-        xmlNodePtr current_term = root->children;
-        do
+        for (xmlNodePtr current_term = root->children; current_term != nullptr; current_term = current_term->next)
         {
-            if (current_term == NULL || strcmp((char *)current_term->name, "Term") != 0)
+            if (strcmp((char *)current_term->name, "Term") != 0)
             {
                 std::cerr << "ERROR: Expected a `Term` tag inside the `TermOccurrence` tag\n";
                 return;
@@ -166,49 +285,106 @@ SearchEngine::Dictionary::read_from_xml(const std::string& filename)
                 return;
             }
 
-            m_term_occurrence_map_ptr->insert(
+            TermId term = m_terms->intern((char*) current_term->properties->children->content);
+            std::size_t occurrence = atoi((char*)current_term->children->content);
+            m_term_occurrence_map_ptr->insert({ term, occurrence });
+
+            auto entry = m_inverted_index_ptr->find(term);
+            if (entry != m_inverted_index_ptr->end())
             {
-                std::string((char*) current_term->properties->children->content),
-                atoi((char*)current_term->children->content)
-            });
+                xmlAttrPtr idf_attr = current_term->properties->next;
+                entry->second.idf =
+                    idf_attr != nullptr
+                    && idf_attr->children != nullptr
+                    && strcmp((char *)idf_attr->name, "idf") == 0
+                        ? strtof((char*) idf_attr->children->content, nullptr)
+                        : idf(occurrence);
+            }
         }
-        while ((current_term = current_term->next) != nullptr);
     }
 
     xmlFreeDoc(doc);
 
+    // XML dictionaries only keep term frequencies, their documents have no positions
     m_file_map_ptr = std::move(map);
+    recount_memory_usage();
 }
 
 float
-SearchEngine::Dictionary::tf(const std::string& term, const std::string& filename)
+SearchEngine::Dictionary::idf(std::size_t term_occurrence)
 const
 {
-    TermFreqMap& term_freq_map = m_file_map_ptr->at(filename);
-    auto freq_in_file_opt = term_freq_map.find(term);
-    std::size_t freq_in_file = freq_in_file_opt != term_freq_map.end() ? freq_in_file_opt->second : 0;
+    return idf(m_documents.size(), term_occurrence);
+}
 
-    std::size_t freq_acc = 0;
-    for (auto current = term_freq_map.begin(); current != term_freq_map.end(); ++current)
+float
+SearchEngine::Dictionary::idf(std::size_t document_count, std::size_t term_occurrence)
+{
+    return std::log10(static_cast<float>(document_count) / (term_occurrence != 0 ? term_occurrence : 1));
+}
+
+SearchEngine::Dictionary::DocumentId
+SearchEngine::Dictionary::index_document(const std::string& filename,
+    const TermFreqMap& term_freq_map,
+    std::size_t length,
+    const TermSequence* sequence)
+{
+    DocumentId id = m_documents.size();
+    m_documents.push_back(filename);
+    m_document_lengths.push_back(length);
+
+    if (sequence == nullptr)
+    {
+        for (const auto& [term, freq] : term_freq_map)
+        {
+            TermEntry& entry = (*m_inverted_index_ptr)[term];
+            entry.postings.add(id, freq);
+            entry.positions.add(nullptr, 0);
+            entry.max_tf = std::max(entry.max_tf, static_cast<float>(freq) / length);
+        }
+
+        return id;
+    }
+
+    // Positions grouped by term with one sort, each group is a term's frequency & positions
+    std::vector<std::pair<TermId, std::uint32_t>> occurrences(sequence->size());
+    for (std::uint32_t position = 0; position < sequence->size(); ++position)
+    {
+        occurrences[position] = { (*sequence)[position], position };
+    }
+    std::sort(occurrences.begin(), occurrences.end());
+
+    Positions positions(occurrences.size());
+    for (std::size_t i = 0; i < occurrences.size(); ++i)
+    {
+        positions[i] = occurrences[i].second;
+    }
+
+    for (std::size_t begin = 0, end; begin < positions.size(); begin = end)
     {
-        freq_acc += current->second;
+        TermId term = occurrences[begin].first;
+        for (end = begin + 1; end < positions.size() && occurrences[end].first == term; ++end);
+
+        Frequency freq = end - begin;
+        TermEntry& entry = (*m_inverted_index_ptr)[term];
+        entry.postings.add(id, freq);
+        entry.positions.add(positions.data() + begin, freq);
+        entry.max_tf = std::max(entry.max_tf, static_cast<float>(freq) / length);
     }
 
-    return static_cast<float>(freq_in_file) / freq_acc;
+    return id;
 }
 
-float
-SearchEngine::Dictionary::idf(const std::string& term)
-const
+SearchEngine::Dictionary::TermPositionsMap
+SearchEngine::Dictionary::term_positions(const TermSequence& sequence)
 {
-    std::size_t N = m_file_map_ptr->size();
-    auto term_occurrence_opt = m_term_occurrence_map_ptr->find(term);
-    std::size_t term_occurrence =
-        term_occurrence_opt != m_term_occurrence_map_ptr->end()
-            ? term_occurrence_opt->second
-            : 0;
-
-    return std::log10(static_cast<float>(N) / (term_occurrence != 0 ? term_occurrence : 1));
+    TermPositionsMap positions;
+    for (std::uint32_t position = 0; position < sequence.size(); ++position)
+    {
+        positions[sequence[position]].push_back(position);
+    }
+
+    return positions;
 }
 
 void
@@ -220,19 +396,71 @@ const noexcept
         std::cout << "Filename = " << filename << "\n";
         for (const auto &[term, freq] : element)
         {
-            std::cout << "\t[" << term << "] = " << freq << "\n";
+            std::cout << "\t[" << m_terms->term(term) << "] = " << freq << "\n";
         }
     }
 }
 
 void
-SearchEngine::Dictionary::insert_file(File&& file)
+SearchEngine::Dictionary::insert_file(File&& file, const FileInfo& info, TermSequence&& sequence)
 {
-    m_file_map_ptr->insert(file);
+    m_file_info_ptr->insert_or_assign(file.first, info);
+
+    std::size_t usage = file_memory_usage(file.first, file.second, sequence.size());
+    std::string filename = file.first;
+    if (m_file_map_ptr->insert(std::move(file)).second)
+    {
+        m_memory_usage += usage;
+        if (!sequence.empty())
+        {
+            m_sequence_map_ptr->insert({ std::move(filename), std::move(sequence) });
+        }
+    }
 }
 
 void
-SearchEngine::Dictionary::increase_term_occurrence(const std::string& term)
+SearchEngine::Dictionary::remove_file(const std::string& filename)
+{
+    auto file = m_file_map_ptr->find(filename);
+    if (file == m_file_map_ptr->end()) return;
+
+    // Every term of the file loses one document, terms left in no document are dropped
+    for (const auto& [term, _] : file->second)
+    {
+        auto occurrence = m_term_occurrence_map_ptr->find(term);
+        if (occurrence != m_term_occurrence_map_ptr->end() && --occurrence->second == 0)
+        {
+            m_term_occurrence_map_ptr->erase(occurrence);
+        }
+    }
+
+    auto sequence = m_sequence_map_ptr->find(filename);
+    m_memory_usage -= file_memory_usage(file->first, file->second,
+        sequence != m_sequence_map_ptr->end() ? sequence->second.size() : 0);
+    if (sequence != m_sequence_map_ptr->end())
+    {
+        m_sequence_map_ptr->erase(sequence);
+    }
+    m_file_map_ptr->erase(file);
+    m_file_info_ptr->erase(filename);
+}
+
+const SearchEngine::FileInfo*
+SearchEngine::Dictionary::file_info(const std::string& filename)
+const
+{
+    auto info = m_file_info_ptr->find(filename);
+    return info != m_file_info_ptr->end() ? &info->second : nullptr;
+}
+
+void
+SearchEngine::Dictionary::set_file_info(const std::string& filename, const FileInfo& info)
+{
+    m_file_info_ptr->insert_or_assign(filename, info);
+}
+
+void
+SearchEngine::Dictionary::increase_term_occurrence(TermId term)
 {
     auto term_occurrence = m_term_occurrence_map_ptr->find(term);
 
@@ -247,26 +475,315 @@ SearchEngine::Dictionary::increase_term_occurrence(const std::string& term)
 }
 
 void
-SearchEngine::Dictionary::write_to(const std::string& output_filename)
+SearchEngine::Dictionary::merge(Dictionary&& other)
+{
+    // Term ids are only comparable between dictionaries sharing a pool
+    if (m_terms != other.m_terms)
+    {
+        std::cerr << "ERROR: Can't merge dictionaries built on different term pools\n";
+        return;
+    }
+
+    if (m_file_map_ptr->size() < other.m_file_map_ptr->size())
+    {
+        std::swap(m_file_map_ptr, other.m_file_map_ptr);
+        std::swap(m_sequence_map_ptr, other.m_sequence_map_ptr);
+        std::swap(m_term_occurrence_map_ptr, other.m_term_occurrence_map_ptr);
+        std::swap(m_file_info_ptr, other.m_file_info_ptr);
+    }
+
+    m_file_map_ptr->merge(*other.m_file_map_ptr);
+    m_sequence_map_ptr->merge(*other.m_sequence_map_ptr);
+    m_file_info_ptr->merge(*other.m_file_info_ptr);
+    m_memory_usage += other.m_memory_usage;
+
+    for (const auto& [term, occurrence] : *other.m_term_occurrence_map_ptr)
+    {
+        (*m_term_occurrence_map_ptr)[term] += occurrence;
+    }
+
+    other.m_file_map_ptr->clear();
+    other.m_sequence_map_ptr->clear();
+    other.m_term_occurrence_map_ptr->clear();
+    other.m_file_info_ptr->clear();
+    other.m_memory_usage = 0;
+}
+
+void
+SearchEngine::Dictionary::build_inverted_index()
+{
+    // Documents get their ids in filename order, so postings come out sorted by id
+    std::vector<std::string> filenames;
+    filenames.reserve(m_file_map_ptr->size());
+    for (const auto& [filename, _] : *m_file_map_ptr)
+    {
+        filenames.push_back(filename);
+    }
+    std::sort(filenames.begin(), filenames.end());
+
+    m_inverted_index_ptr.reset(new InvertedIndex());
+    m_documents.clear();
+    m_document_lengths.clear();
+    m_documents.reserve(filenames.size());
+    m_document_lengths.reserve(filenames.size());
+
+    for (const auto& filename : filenames)
+    {
+        const TermFreqMap& term_freq_map = m_file_map_ptr->at(filename);
+
+        std::size_t length = 0;
+        for (const auto& [_, freq] : term_freq_map)
+        {
+            length += freq;
+        }
+
+        auto sequence = m_sequence_map_ptr->find(filename);
+        index_document(filename, term_freq_map, length,
+            sequence != m_sequence_map_ptr->end() ? &sequence->second : nullptr);
+    }
+
+    for (auto& [term, entry] : *m_inverted_index_ptr)
+    {
+        entry.idf = idf(m_term_occurrence_map_ptr->at(term));
+    }
+}
+
+std::vector<char>
+SearchEngine::Dictionary::serialize()
 const
 {
-    write_to_xml(output_filename);
+    using namespace IndexFormat;
+
+    auto align = [](std::uint64_t offset) { return (offset + 7) & ~std::uint64_t(7); };
+
+    std::vector<std::pair<std::string_view, TermId>> terms;
+    terms.reserve(m_inverted_index_ptr->size());
+    std::size_t postings_size = 0;
+    std::size_t positions_size = 0;
+    for (const auto& [term, entry] : *m_inverted_index_ptr)
+    {
+        terms.push_back({ m_terms->term(term), term });
+        postings_size += entry.postings.encoded_size();
+        positions_size += entry.positions.encoded_size();
+    }
+    std::sort(terms.begin(), terms.end());
+
+    std::size_t strings_size = 0;
+    for (const auto& filename : m_documents) strings_size += filename.size();
+    for (const auto& [term, _] : terms) strings_size += term.size();
+
+    Header header {};
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.document_count = m_documents.size();
+    header.term_count = terms.size();
+    header.postings_size = postings_size;
+    header.documents_offset = align(sizeof(Header));
+    header.terms_offset = align(header.documents_offset + header.document_count * sizeof(DocumentRecord));
+    header.postings_offset = align(header.terms_offset + header.term_count * sizeof(TermRecord));
+    header.positions_offset = align(header.postings_offset + header.postings_size);
+    header.positions_size = positions_size;
+    header.strings_offset = align(header.positions_offset + header.positions_size);
+    header.strings_size = strings_size;
+
+    std::vector<char> buffer(header.strings_offset + header.strings_size, 0);
+    std::memcpy(buffer.data(), &header, sizeof(header));
+
+    auto* documents = reinterpret_cast<DocumentRecord*>(buffer.data() + header.documents_offset);
+    auto* term_records = reinterpret_cast<TermRecord*>(buffer.data() + header.terms_offset);
+    char* postings = buffer.data() + header.postings_offset;
+    char* positions = buffer.data() + header.positions_offset;
+    char* strings = buffer.data() + header.strings_offset;
+
+    std::uint64_t string_offset = 0;
+    for (DocumentId id = 0; id < m_documents.size(); ++id)
+    {
+        const std::string& filename = m_documents[id];
+        auto info = m_file_info_ptr->find(filename);
+        FileInfo file_info = info != m_file_info_ptr->end() ? info->second : FileInfo {};
+        documents[id] =
+        {
+            string_offset,
+            m_document_lengths[id],
+            file_info.size,
+            file_info.mtime,
+            file_info.hash,
+            static_cast<std::uint32_t>(filename.size()),
+            0
+        };
+        std::memcpy(strings + string_offset, filename.data(), filename.size());
+        string_offset += filename.size();
+    }
+
+    std::uint64_t posting_offset = 0;
+    std::uint64_t position_offset = 0;
+    for (std::size_t i = 0; i < terms.size(); ++i)
+    {
+        const auto& [term, term_id] = terms[i];
+        const TermEntry& entry = m_inverted_index_ptr->at(term_id);
+
+        term_records[i] =
+        {
+            string_offset,
+            posting_offset,
+            position_offset,
+            static_cast<std::uint32_t>(term.size()),
+            entry.postings.document_frequency(),
+            entry.idf,
+            entry.max_tf * entry.idf
+        };
+        std::memcpy(strings + string_offset, term.data(), term.size());
+        string_offset += term.size();
+
+        entry.postings.write(postings + posting_offset);
+        posting_offset += entry.postings.encoded_size();
+
+        entry.positions.write(positions + position_offset);
+        position_offset += entry.positions.encoded_size();
+    }
+
+    return buffer;
 }
 
 void
-SearchEngine::Dictionary::read_from(const std::string& filename)
+SearchEngine::Dictionary::write_to_binary(const std::string& output_filename)
+const
 {
-    read_from_xml(filename);
+    std::vector<char> buffer = serialize();
+
+    // Searches may have the old index mapped, it's replaced in one rename instead of rewritten in place
+    std::string temporary = output_filename + INDEX_TEMPORARY_SUFFIX;
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(buffer.data(), buffer.size());
+        file.close();
+
+        if (!file)
+        {
+            std::cerr << "ERROR: Could not write index file '" << output_filename << "'\n";
+            std::remove(temporary.c_str());
+            return;
+        }
+    }
+
+    if (std::rename(temporary.c_str(), output_filename.c_str()) != 0)
+    {
+        std::cerr << "ERROR: Could not replace index file '" << output_filename << "'\n";
+        std::remove(temporary.c_str());
+    }
 }
 
-float
-SearchEngine::Dictionary::tf_idf(const std::string& filename, const std::list<std::string>& tokens)
+void
+SearchEngine::Dictionary::read_from_binary(const std::string& filename)
+{
+    IndexReader reader;
+    if (!reader.open(filename)) return;
+
+    read_from(reader);
+}
+
+void
+SearchEngine::Dictionary::read_from(const IndexReader& reader)
+{
+    FileMapPtr map(new FileMap());
+    SequenceMapPtr sequence_map(new SequenceMap());
+    m_term_occurrence_map_ptr.reset(new TermOccurrenceMap());
+    m_file_info_ptr.reset(new FileInfoMap());
+    m_inverted_index_ptr.reset(new InvertedIndex());
+    m_documents.clear();
+    m_document_lengths.clear();
+
+    // Each document's term sequence is laid back out from its terms' positions, a document
+    // missing some of them was indexed without positions and stays without a sequence
+    std::vector<TermFreqMap> term_freq_maps(reader.document_count());
+    std::vector<TermSequence> sequences(reader.document_count());
+    std::vector<std::size_t> placed(reader.document_count(), 0);
+    std::vector<std::uint32_t> term_positions;
+    for (std::size_t i = 0; i < reader.term_count(); ++i)
+    {
+        const IndexFormat::TermRecord& record = reader.term_record(i);
+        TermId term = m_terms->intern(reader.term(record));
+
+        PositionsReader positions = reader.positions(record);
+        for (PostingCursor posting = reader.postings(record); !posting.at_end(); posting.next())
+        {
+            IndexReader::DocumentId id = posting.document_id();
+            term_freq_maps[id].insert({ term, posting.freq() });
+
+            positions.read(posting.ordinal(), term_positions);
+            TermSequence& sequence = sequences[id];
+            if (sequence.empty() && !term_positions.empty())
+            {
+                sequence.resize(reader.document_length(id));
+            }
+            for (std::uint32_t position : term_positions)
+            {
+                if (position >= sequence.size()) break;
+
+                sequence[position] = term;
+                ++placed[id];
+            }
+        }
+        m_term_occurrence_map_ptr->insert({ term, record.document_frequency });
+    }
+
+    for (IndexReader::DocumentId id = 0; id < reader.document_count(); ++id)
+    {
+        const IndexFormat::DocumentRecord& record = reader.document_record(id);
+        std::string name(reader.document_name(id));
+        m_file_info_ptr->insert({ name, FileInfo { record.size, record.mtime, record.hash } });
+
+        bool has_sequence = !sequences[id].empty() && placed[id] == sequences[id].size();
+        index_document(name, term_freq_maps[id], reader.document_length(id), has_sequence ? &sequences[id] : nullptr);
+        if (has_sequence)
+        {
+            sequence_map->insert({ name, std::move(sequences[id]) });
+        }
+        map->insert({ std::move(name), std::move(term_freq_maps[id]) });
+    }
+
+    for (std::size_t i = 0; i < reader.term_count(); ++i)
+    {
+        const IndexFormat::TermRecord& record = reader.term_record(i);
+        m_inverted_index_ptr->at(m_terms->intern(reader.term(record))).idf = record.idf;
+    }
+
+    m_file_map_ptr = std::move(map);
+    m_sequence_map_ptr = std::move(sequence_map);
+    recount_memory_usage();
+}
+
+void
+SearchEngine::Dictionary::write_to(const std::string& output_filename)
 const
 {
-    float tf_idf = 0.0f;
-    for (const auto& token : tokens)
+    if (is_xml_file(output_filename))
+    {
+        write_to_xml(output_filename);
+    }
+    else
+    {
+        write_to_binary(output_filename);
+    }
+}
+
+bool
+SearchEngine::Dictionary::is_xml_file(const std::string& filename)
+{
+    const std::string extension = ".xml";
+    return filename.size() >= extension.size()
+        && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+void
+SearchEngine::Dictionary::read_from(const std::string& filename)
+{
+    if (IndexReader::is_index_file(filename))
+    {
+        read_from_binary(filename);
+    }
+    else
     {
-        tf_idf += tf(token, filename) * idf(token);
+        read_from_xml(filename);
     }
-    return tf_idf;
 }
@@ -0,0 +1,79 @@
+#include "../includes/directory-walker.hpp"
+
+SearchEngine::DirectoryWalker::DirectoryWalker(ThreadPool& pool, Queue& queue, const std::string& extension)
+    : m_pool(pool),
+      m_queue(queue),
+      m_extension(extension),
+      m_pending(0)
+{
+}
+
+void
+SearchEngine::DirectoryWalker::start(const std::string& dirname)
+{
+    m_pending.store(1, std::memory_order_relaxed);
+    m_pool.submit([this, path = std::filesystem::path(dirname)]()
+    {
+        walk_directory(path);
+    });
+}
+
+void
+SearchEngine::DirectoryWalker::finish_directory()
+{
+    if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        m_queue.close();
+    }
+}
+
+void
+SearchEngine::DirectoryWalker::walk_directory(const std::filesystem::path& dirname)
+{
+    // A directory's files are queued once it's been read, so waiting on a full queue isn't timed as walking
+    std::vector<std::string> files;
+    {
+        IndexingStats::Timer timer(IndexingStats::Stage::Walk);
+
+        std::error_code error;
+        std::filesystem::directory_iterator entries(dirname, error);
+        if (error)
+        {
+            std::cerr << "ERROR: Could not read directory '" << dirname.string() << "': " << error.message() << "\n";
+        }
+        else
+        {
+            for (; entries != std::filesystem::end(entries); entries.increment(error))
+            {
+                if (error) break;
+
+                const auto& entry = *entries;
+                std::error_code entry_error;
+                if (entry.is_directory(entry_error))
+                {
+                    m_pending.fetch_add(1, std::memory_order_relaxed);
+                    m_pool.submit([this, path = entry.path()]()
+                    {
+                        walk_directory(path);
+                    });
+                }
+                else if (entry.path().extension() == m_extension)
+                {
+                    files.push_back(entry.path());
+                }
+            }
+
+            if (error)
+            {
+                std::cerr << "ERROR: Could not walk directory '" << dirname.string() << "': " << error.message() << "\n";
+            }
+        }
+    }
+
+    for (std::string& file : files)
+    {
+        m_queue.push(std::move(file));
+    }
+
+    finish_directory();
+}
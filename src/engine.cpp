@@ -1,128 +1,933 @@
 #include "../includes/engine.hpp"
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <cmath>
+
+namespace
+{
+    std::string
+    json_escape(const std::string& text)
+    {
+        std::ostringstream escaped;
+        for (unsigned char c : text)
+        {
+            switch (c)
+            {
+            case '"':  escaped << "\\\""; break;
+            case '\\': escaped << "\\\\"; break;
+            case '\n': escaped << "\\n"; break;
+            case '\r': escaped << "\\r"; break;
+            case '\t': escaped << "\\t"; break;
+            default:
+                if (c < 0x20)
+                {
+                    escaped << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c)
+                        << std::dec << std::setfill(' ');
+                }
+                else
+                {
+                    escaped << c;
+                }
+            }
+        }
+
+        return escaped.str();
+    }
+
+    // Nearest-rank percentile of sorted samples
+    double
+    percentile(const std::vector<double>& sorted, double fraction)
+    {
+        std::size_t rank = static_cast<std::size_t>(std::ceil(fraction * sorted.size()));
+        return sorted[std::max<std::size_t>(rank, 1) - 1];
+    }
+}
+
+SearchEngine::Engine::Engine()
+    : m_options({ ThreadPool::default_size(), 1, DEFAULT_TOP_K, Parser::LibXml, FILE_READER_DEFAULT_DEPTH,
+        QUERY_CACHE_DEFAULT_MB * 1024 * 1024, DEFAULT_WARMUP_PASSES, StatsFormat::Table, false, 0, { 0, 0, 0 }, Match::Any }),
+      m_segmented(false)
+{
+}
+
+void
+SearchEngine::Engine::extract_text(const std::string& filename,
+    const FileInfo& info,
+    const std::function<void(const XmlParser::TextHandler&)>& parse,
+    Dictionary& dictionary)
+{
+    Tokenizer tokenizer;
+    Dictionary::TermFreqMap term_freq_map;
+    Dictionary::TermSequence sequence;
+
+    // Text nodes are tokenized as the parser produces them, each node ends any token in progress
+    {
+        IndexingStats::Timer timer(IndexingStats::Stage::Parse);
+        parse([&](std::string_view text)
+        {
+            IndexingStats::Timer timer(IndexingStats::Stage::Tokenize);
+            tokenizer.feed(text, dictionary.terms(), term_freq_map, &sequence);
+            tokenizer.flush(dictionary.terms(), term_freq_map, &sequence);
+        });
+    }
+
+    std::size_t tokens = 0;
+    for (const auto& term_freq : term_freq_map)
+    {
+        dictionary.increase_term_occurrence(term_freq.first);
+        tokens += term_freq.second;
+    }
+
+    IndexingStats::add(IndexingStats::Counter::Files, 1);
+    IndexingStats::add(IndexingStats::Counter::Bytes, info.size);
+    IndexingStats::add(IndexingStats::Counter::Tokens, tokens);
+
+    dictionary.insert_file({ filename, std::move(term_freq_map) }, info, std::move(sequence));
+
+    if (m_runs != nullptr)
+    {
+        m_runs->flush_if_full(dictionary);
+    }
+}
+
+void
+SearchEngine::Engine::extract_from_file(const std::string& filename, Dictionary& dictionary)
+{
+    FileInfo info {};
+    {
+        IndexingStats::Timer timer(IndexingStats::Stage::Read);
+        if (!FileInfo::stat(filename, info) || !FileInfo::hash_file(filename, info.hash))
+        {
+            std::cerr << "ERROR: Could not read file '" << filename << "'\n";
+        }
+    }
+
+    extract_text(filename, info, [this, &filename](const XmlParser::TextHandler& on_text)
+    {
+        if (m_options.parser == Parser::Native)
+        {
+            HtmlExtractor extractor(filename);
+            extractor.parse(on_text);
+        }
+        else
+        {
+            XmlParser parser(filename);
+            parser.parse(on_text);
+        }
+    }, dictionary);
+}
+
+void
+SearchEngine::Engine::get_files_from_dir(const std::string& dirname, std::list<std::string>& files)
+{
+    for (const auto &entry : std::filesystem::directory_iterator(dirname))
+    {
+        if (entry.is_directory())
+        {
+            get_files_from_dir(entry.path(), files);
+        }
+        else if (entry.path().extension() == FILE_EXTENSION)
+        {
+            files.push_back(entry.path());
+        }
+    }
+}
+
+void
+SearchEngine::Engine::walk_files(const std::string& dirname,
+    const std::function<void(const FileReader::FileSource&)>& consume)
+{
+#if MULTITHREADING
+    // The tree is walked on its own threads, files are handed out as soon as they're found
+    ThreadPool walker_pool(m_options.threads);
+    DirectoryWalker::Queue filenames(WALK_QUEUE_CAPACITY);
+    DirectoryWalker walker(walker_pool, filenames, FILE_EXTENSION);
+    walker.start(dirname);
+
+    consume([&filenames](std::string& filename)
+    {
+        return filenames.pop(filename);
+    });
+
+    walker_pool.wait();
+#else
+    std::list<std::string> filenames;
+    {
+        IndexingStats::Timer timer(IndexingStats::Stage::Walk);
+        get_files_from_dir(dirname, filenames);
+    }
+
+    auto next = filenames.begin();
+    consume([&next, &filenames](std::string& filename)
+    {
+        if (next == filenames.end()) return false;
+
+        filename = *next++;
+        return true;
+    });
+#endif // MULTITHREADING
+}
+
+SearchEngine::Dictionary
+SearchEngine::Engine::extract_files(const FileReader::FileSource& next_file)
+{
+#if MULTITHREADING
+    IndexingPipeline pipeline(m_dictionary.term_pool(), pipeline_stages(), m_options.io_depth, pipeline_queue_bytes(),
+        [this](const std::string& filename, std::string_view content, const XmlParser::TextHandler& on_text)
+        {
+            if (m_options.parser == Parser::Native)
+            {
+                HtmlExtractor extractor(content);
+                extractor.parse(on_text);
+            }
+            else
+            {
+                XmlParser parser(filename, content);
+                parser.parse(on_text);
+            }
+        },
+        m_runs.get());
+
+    Dictionary dictionary = pipeline.run([this, &next_file](std::string& filename)
+    {
+        if (!next_file(filename)) return false;
+
+        log_file(filename);
+        return true;
+    });
+
+    if (m_options.stats != StatsFormat::None)
+    {
+        pipeline.print(std::cout);
+    }
+    return dictionary;
+#else
+    Dictionary dictionary(m_dictionary.term_pool());
+
+    std::string filename;
+    while (next_file(filename))
+    {
+        log_file(filename);
+        extract_from_file(filename, dictionary);
+    }
+
+    return dictionary;
+#endif // MULTITHREADING
+}
+
+SearchEngine::IndexingPipeline::Stages
+SearchEngine::Engine::pipeline_stages()
+const
+{
+    if (m_options.stages.extract == 0)
+    {
+        return IndexingPipeline::default_stages(m_options.threads);
+    }
+
+    return m_options.stages;
+}
+
+std::size_t
+SearchEngine::Engine::pipeline_queue_bytes()
+const
+{
+    if (m_options.memory_budget > 0)
+    {
+        return m_options.memory_budget / PIPELINE_QUEUE_BUDGET_SHARE;
+    }
+
+    return PIPELINE_QUEUE_BYTES;
+}
+
+void
+SearchEngine::Engine::log_file(const std::string& filename)
+const
+{
+    if (!m_options.quiet)
+    {
+        std::cout << "Indexing: '" << filename << "'\n";
+    }
+}
+
+void
+SearchEngine::Engine::print_stats()
+const
+{
+    if (m_options.stats == StatsFormat::Table)
+    {
+        IndexingStats::print_table(std::cout);
+    }
+    else if (m_options.stats == StatsFormat::Json)
+    {
+        IndexingStats::print_json(std::cout);
+    }
+}
+
+bool
+SearchEngine::Engine::merge_runs(const std::string& out_filename)
+{
+    // The documents still in memory make the last run
+    bool merged = m_dictionary.document_count() == 0 || m_runs->flush(m_dictionary);
+    if (merged)
+    {
+        std::cout << "Merging " << m_runs->size() << " runs into '" << out_filename << "'...\n";
+        merged = m_runs->merge_to(out_filename);
+    }
+
+    m_runs.reset();
+    return merged;
+}
+
+bool
+SearchEngine::Engine::is_segmented_output(const std::string& filename)
+{
+    return SegmentedIndex::is_segmented_index(filename) || (!filename.empty() && filename.back() == '/');
+}
+
+bool
+SearchEngine::Engine::write_index(const std::string& out_filename)
+{
+    IndexingStats::Timer timer(IndexingStats::Stage::Write);
+    if (!is_segmented_output(out_filename))
+    {
+        m_dictionary.write_to(out_filename);
+        return true;
+    }
+
+    // A segmented index written from scratch holds every document in a single segment
+    SegmentedIndex segments;
+    if (!segments.create(out_filename) || !segments.lock(true) || !segments.refresh())
+    {
+        return false;
+    }
+
+    SegmentedIndex::Segments written;
+    if (m_dictionary.document_count() > 0)
+    {
+        SegmentedIndex::Segment segment;
+        if (!segments.write_segment(m_dictionary, segment)) return false;
+        written.push_back(std::move(segment));
+    }
+
+    return segments.commit(written);
+}
+
+int
+SearchEngine::Engine::index(const std::string& dirname, const std::string& out_filename)
+{
+    if (!std::filesystem::is_directory(dirname))
+    {
+        std::cerr << "ERROR: '" << dirname << "' is not a directory\n";
+        return 1;
+    }
+
+    if (m_options.memory_budget > 0)
+    {
+        if (is_segmented_output(out_filename) || Dictionary::is_xml_file(out_filename))
+        {
+            std::cerr << "ERROR: '--memory-budget' only writes binary index files\n";
+            return 1;
+        }
+
+        // Every accumulating thread fills its own dictionary, each one gets an even share of what the
+        // pipeline's queues leave of the budget
+#if MULTITHREADING
+        std::size_t dictionaries = pipeline_stages().accumulate;
+        std::size_t dictionary_budget = m_options.memory_budget - pipeline_queue_bytes();
+#else
+        std::size_t dictionaries = 1;
+        std::size_t dictionary_budget = m_options.memory_budget;
+#endif // MULTITHREADING
+        m_runs.reset(new IndexRuns(out_filename + RUNS_DIRECTORY_SUFFIX, dictionary_budget / dictionaries));
+        if (!m_runs->create())
+        {
+            m_runs.reset();
+            return 1;
+        }
+    }
+
+    IndexingStats::reset();
+    walk_files(dirname, [this](const FileReader::FileSource& next_file)
+    {
+        m_dictionary = extract_files(next_file);
+    });
+
+    std::cout << "Stem cache: "
+        << Tokenizer::stem_cache().hits() << " hits, "
+        << Tokenizer::stem_cache().misses() << " misses\n";
+
+    // Nothing was spilled when the whole corpus fit in the budget
+    if (m_runs != nullptr && m_runs->size() > 0)
+    {
+        if (!merge_runs(out_filename))
+        {
+            return 1;
+        }
+
+        print_stats();
+        return 0;
+    }
+    m_runs.reset();
+
+    {
+        IndexingStats::Timer timer(IndexingStats::Stage::Merge);
+        m_dictionary.build_inverted_index();
+    }
+
+    std::cout << "Writing to file...\n";
+    if (!write_index(out_filename))
+    {
+        return 1;
+    }
+
+    print_stats();
+    return 0;
+}
+
+SearchEngine::Engine::Changes
+SearchEngine::Engine::find_changes(const std::string& dirname,
+    const std::unordered_set<std::string>& known_files,
+    const std::function<const FileInfo*(const std::string&)>& known_info,
+    const std::function<void(const std::string&, const FileInfo&)>& on_touched)
+{
+    Changes changes {};
+    std::unordered_set<std::string> found;
+
+    // Size & mtime decide most files, the content hash only settles files that were merely touched
+    walk_files(dirname, [&](const FileReader::FileSource& next_file)
+    {
+        std::string filename;
+        while (next_file(filename))
+        {
+            FileInfo info {};
+            if (!FileInfo::stat(filename, info))
+            {
+                std::cerr << "ERROR: Could not stat file '" << filename << "'\n";
+                continue;
+            }
+
+            found.insert(filename);
+            if (known_files.count(filename) == 0)
+            {
+                ++changes.added;
+                changes.changed.push_back(filename);
+                continue;
+            }
+
+            const FileInfo* known = known_info(filename);
+            if (known == nullptr)
+            {
+                ++changes.modified;
+                changes.changed.push_back(filename);
+                continue;
+            }
+
+            if (known->same_stat(info))
+            {
+                ++changes.unchanged;
+                continue;
+            }
+
+            if (known->size == info.size
+                && FileInfo::hash_file(filename, info.hash)
+                && known->hash == info.hash)
+            {
+                ++changes.unchanged;
+                on_touched(filename, info);
+                continue;
+            }
+
+            ++changes.modified;
+            changes.changed.push_back(filename);
+        }
+    });
+
+    for (const auto& filename : known_files)
+    {
+        if (found.count(filename) == 0)
+        {
+            changes.removed.push_back(filename);
+        }
+    }
+    std::sort(changes.removed.begin(), changes.removed.end());
+
+    return changes;
+}
+
+int
+SearchEngine::Engine::update(const std::string& dirname, const std::string& index_filename)
+{
+    if (!std::filesystem::is_directory(dirname))
+    {
+        std::cerr << "ERROR: '" << dirname << "' is not a directory\n";
+        return 1;
+    }
+
+    if (!std::filesystem::exists(index_filename))
+    {
+        std::cout << "No index at '" << index_filename << "', indexing everything\n";
+        return index(dirname, index_filename);
+    }
+
+    if (SegmentedIndex::is_segmented_index(index_filename))
+    {
+        return update_segments(dirname, index_filename);
+    }
+
+    IndexingStats::reset();
+    std::cout << "Loading index file...\n";
+    m_dictionary.read_from(index_filename);
+
+    std::unordered_set<std::string> known_files;
+    for (const auto& [filename, _] : *m_dictionary.m_file_map_ptr)
+    {
+        known_files.insert(filename);
+    }
+
+    Changes changes = find_changes(dirname, known_files,
+        [this](const std::string& filename) { return m_dictionary.file_info(filename); },
+        [this](const std::string& filename, const FileInfo& info) { m_dictionary.set_file_info(filename, info); });
+
+    for (const auto& filename : changes.removed)
+    {
+        std::cout << "Removing: '" << filename << "'\n";
+        m_dictionary.remove_file(filename);
+    }
+
+    for (const auto& filename : changes.changed)
+    {
+        m_dictionary.remove_file(filename);
+    }
+
+    auto next = changes.changed.begin();
+    Dictionary changed = extract_files([&next, &changes](std::string& filename)
+    {
+        if (next == changes.changed.end()) return false;
+
+        filename = *next++;
+        return true;
+    });
+
+    {
+        IndexingStats::Timer timer(IndexingStats::Stage::Merge);
+        m_dictionary.merge(std::move(changed));
+        m_dictionary.build_inverted_index();
+    }
+
+    std::cout << changes.added << " added, "
+        << changes.modified << " modified, "
+        << changes.removed.size() << " removed, "
+        << changes.unchanged << " unchanged\n";
+
+    std::cout << "Writing to file...\n";
+    {
+        IndexingStats::Timer timer(IndexingStats::Stage::Write);
+        m_dictionary.write_to(index_filename);
+    }
+
+    print_stats();
+    return 0;
+}
+
+int
+SearchEngine::Engine::update_segments(const std::string& dirname, const std::string& index_directory)
+{
+    // Other writers wait on the directory lock, readers keep searching the previous manifest
+    IndexingStats::reset();
+    SegmentedIndex segments;
+    if (!segments.open(index_directory) || !segments.lock(true) || !segments.refresh())
+    {
+        return 1;
+    }
+
+    struct Location
+    {
+        std::size_t segment;
+        IndexReader::DocumentId id;
+        FileInfo info;
+    };
+
+    SegmentedIndex::Snapshot snapshot = segments.snapshot();
+    std::unordered_map<std::string, Location> documents;
+    std::unordered_set<std::string> known_files;
+    for (std::size_t i = 0; i < snapshot->size(); ++i)
+    {
+        const SegmentedIndex::Segment& segment = (*snapshot)[i];
+        for (IndexReader::DocumentId id = 0; id < segment.reader->document_count(); ++id)
+        {
+            if ((*segment.deleted)[id]) continue;
+
+            const IndexFormat::DocumentRecord& record = segment.reader->document_record(id);
+            std::string filename(segment.reader->document_name(id));
+            documents[filename] = { i, id, { record.size, record.mtime, record.hash } };
+            known_files.insert(std::move(filename));
+        }
+    }
+
+    // Segments are immutable, a touched file keeps its old mtime until its segment is merged
+    Changes changes = find_changes(dirname, known_files,
+        [&documents](const std::string& filename) { return &documents.at(filename).info; },
+        [](const std::string&, const FileInfo&) {});
+
+    std::vector<std::vector<IndexReader::DocumentId>> deletions(snapshot->size());
+    auto tombstone = [&documents, &deletions](const std::string& filename)
+    {
+        auto document = documents.find(filename);
+        if (document != documents.end())
+        {
+            deletions[document->second.segment].push_back(document->second.id);
+        }
+    };
+
+    for (const auto& filename : changes.removed)
+    {
+        std::cout << "Removing: '" << filename << "'\n";
+        tombstone(filename);
+    }
+
+    for (const auto& filename : changes.changed)
+    {
+        tombstone(filename);
+    }
+
+    SegmentedIndex::Segments next_segments = *snapshot;
+    for (std::size_t i = 0; i < next_segments.size(); ++i)
+    {
+        if (!deletions[i].empty())
+        {
+            segments.delete_documents(next_segments[i], deletions[i]);
+        }
+    }
+
+    // New & modified documents go into one new small segment
+    auto next = changes.changed.begin();
+    Dictionary added = extract_files([&next, &changes](std::string& filename)
+    {
+        if (next == changes.changed.end()) return false;
+
+        filename = *next++;
+        return true;
+    });
+
+    if (added.document_count() > 0)
+    {
+        {
+            IndexingStats::Timer timer(IndexingStats::Stage::Merge);
+            added.build_inverted_index();
+        }
+
+        IndexingStats::Timer timer(IndexingStats::Stage::Write);
+        SegmentedIndex::Segment segment;
+        if (!segments.write_segment(added, segment)) return 1;
+        next_segments.push_back(std::move(segment));
+    }
+
+    std::cout << changes.added << " added, "
+        << changes.modified << " modified, "
+        << changes.removed.size() << " removed, "
+        << changes.unchanged << " unchanged\n";
+
+    bool committed;
+    {
+        IndexingStats::Timer timer(IndexingStats::Stage::Write);
+        committed = segments.commit(next_segments);
+    }
+
+    if (!committed)
+    {
+        return 1;
+    }
+
+    std::size_t merges = 0;
+    {
+        IndexingStats::Timer timer(IndexingStats::Stage::Merge);
+        while (segments.merge())
+        {
+            ++merges;
+        }
+    }
+
+    std::cout << segments.snapshot()->size() << " segments after " << merges << " merges\n";
+
+    print_stats();
+    return 0;
+}
+
+void
+SearchEngine::Engine::calculate_tf_idf_result(const std::list<std::string>& tokens,
+    std::list<std::pair<std::string, float>>& results,
+    QueryTimings* timings)
+{
+    auto start = std::chrono::steady_clock::now();
+    const IndexReader::QueryTerms terms = m_index.find_terms(tokens);
+    auto scoring_start = std::chrono::steady_clock::now();
+
+    if (m_options.top != 0)
+    {
+        for (const auto& [id, tf_idf] : m_index.top_k(terms, m_options.top, EP, 0, m_index.document_count()))
+        {
+            results.push_back({ std::string(m_index.document_name(id)), tf_idf });
+        }
+    }
+    else
+    {
+        for (const auto& [id, tf_idf] : m_index.tf_idf(terms, 0, m_index.document_count()))
+        {
+            if (tf_idf > EP)
+            {
+                results.push_back({ std::string(m_index.document_name(id)), tf_idf });
+            }
+        }
+    }
+
+    if (timings != nullptr)
+    {
+        auto end = std::chrono::steady_clock::now();
+        timings->candidates += scoring_start - start;
+        timings->scoring += end - scoring_start;
+    }
+}
+
+void
+SearchEngine::Engine::calculate_tf_idf_result_parallel(const std::list<std::string>& tokens,
+    std::list<std::pair<std::string, float>>& results,
+    QueryTimings* timings)
+{
+    auto start = std::chrono::steady_clock::now();
+    const IndexReader::QueryTerms terms = m_index.find_terms(tokens);
+    auto scoring_start = std::chrono::steady_clock::now();
+    if (timings != nullptr)
+    {
+        timings->candidates += scoring_start - start;
+    }
+
+    if (terms.empty()) return;
+
+    // More chunks than workers so stealing evens out chunks with denser postings
+    const std::size_t document_count = m_index.document_count();
+    const std::size_t chunk_count = std::min(document_count, m_query_pool->size() * QUERY_CHUNKS_PER_THREAD);
+    const std::size_t chunk_size = (document_count + chunk_count - 1) / chunk_count;
+
+    std::vector<std::vector<IndexReader::ScoredDocument>> chunk_results(chunk_count);
+    for (std::size_t chunk = 0; chunk < chunk_count; ++chunk)
+    {
+        m_query_pool->submit([this, &terms, &chunk_results, chunk, chunk_size, document_count]()
+        {
+            IndexReader::DocumentId first = chunk * chunk_size;
+            IndexReader::DocumentId last = std::min(document_count, (chunk + 1) * chunk_size);
+
+            if (m_options.top != 0)
+            {
+                chunk_results[chunk] = m_index.top_k(terms, m_options.top, EP, first, last);
+                return;
+            }
+
+            for (const auto& scored : m_index.tf_idf(terms, first, last))
+            {
+                if (scored.second > EP)
+                {
+                    chunk_results[chunk].push_back(scored);
+                }
+            }
+        });
+    }
+
+    m_query_pool->wait();
+
+    std::vector<IndexReader::ScoredDocument> merged;
+    for (auto& chunk_result : chunk_results)
+    {
+        merged.insert(merged.end(), chunk_result.begin(), chunk_result.end());
+    }
+
+    if (m_options.top != 0)
+    {
+        IndexReader::sort_by_score(merged, m_options.top);
+    }
+
+    for (const auto& [id, tf_idf] : merged)
+    {
+        results.push_back({ std::string(m_index.document_name(id)), tf_idf });
+    }
+
+    if (timings != nullptr)
+    {
+        timings->scoring += std::chrono::steady_clock::now() - scoring_start;
+    }
+}
 
 void
-SearchEngine::Engine::extract_from_file(const std::string& filename)
+SearchEngine::Engine::run_cached(const std::function<std::string()>& make_key,
+    const std::function<void()>& search,
+    std::list<std::pair<std::string, float>>& results,
+    QueryTimings* timings)
 {
-    XmlParser parser(filename);
-    std::string file_content = parser.parse();
+    std::uint64_t generation = 0;
+    if (m_segmented)
+    {
+        m_segments.refresh();
+        generation = m_segments.generation();
+    }
+
+    std::string key;
+    if (m_query_cache)
+    {
+        m_query_cache->set_generation(generation);
 
-    Tokenizer tokenizer(file_content);
+        key = make_key();
+        if (m_query_cache->find(key, results)) return;
+    }
 
-    auto term_freq_map = tokenizer.scan_terms_in_file();
+    search();
 
-    for (const auto& term_freq : term_freq_map)
+    auto sort_start = std::chrono::steady_clock::now();
+    results.sort(
+        [](std::pair<std::string, float> a, std::pair<std::string, float> b)
+        {
+            return a.second > b.second;
+        });
+
+    if (timings != nullptr)
     {
-#if MULTITHREADING
-        std::lock_guard<std::mutex> guard(m_mutex);
-#endif // MULTITHREADING
-        m_dictionary.increase_term_occurrence(term_freq.first);
+        timings->sort += std::chrono::steady_clock::now() - sort_start;
     }
 
-    m_dictionary.insert_file({ filename, std::move(term_freq_map) });
+    if (m_query_cache)
+    {
+        m_query_cache->insert(key, results, generation);
+    }
 }
 
-std::list<std::string>
-SearchEngine::Engine::get_files_from_dir(const std::string& dirname)
+void
+SearchEngine::Engine::run_query(const std::list<std::string>& tokens,
+    std::list<std::pair<std::string, float>>& results,
+    QueryTimings* timings)
 {
-    std::list<std::string> files;
-
-    for (const auto &entry : std::filesystem::directory_iterator(dirname))
+    run_cached([&tokens]() { return QueryCache::make_key(tokens); }, [&]()
     {
-        if (entry.is_directory())
+        if (m_segmented)
         {
-            std::list<std::string> files_in_dir = get_files_from_dir(entry.path());
-            files.insert(files.end(), files_in_dir.begin(), files_in_dir.end());
+            results = m_segments.search(tokens, m_options.top, EP, m_query_pool.get(), timings);
         }
-        else if (entry.path().extension() == FILE_EXTENSION)
+        else if (m_query_pool)
         {
-            files.push_back(entry.path());
+            calculate_tf_idf_result_parallel(tokens, results, timings);
         }
-    }
-
-    return files;
+        else
+        {
+            calculate_tf_idf_result(tokens, results, timings);
+        }
+    }, results, timings);
 }
 
-int
-SearchEngine::Engine::index(const std::string& dirname, const std::string& out_filename)
+void
+SearchEngine::Engine::run_query(const BooleanQuery& query,
+    std::list<std::pair<std::string, float>>& results,
+    QueryTimings* timings)
 {
-    std::list<std::string> filesnames = get_files_from_dir(dirname);
-
-#if MULTITHREADING
-    std::list<std::thread> threads;
-
-    for (auto& filename : filesnames)
+    run_cached([&query]() { return query.key(); }, [&]()
     {
-        std::cout << "Indexing: '" << filename << "'\n";
-        threads.push_back(
-            std::thread(
-                &SearchEngine::Engine::extract_from_file,
-                this,
-                std::cref(filename)));
+        if (m_segmented)
+        {
+            results = m_segments.search(query, m_options.top, m_query_pool.get(), timings);
+            return;
+        }
 
-        if (threads.size() >= MAX_THREADS)
+        // Matching & scoring only touch the documents of the rarest terms, so it stays on one thread
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& [id, score] : query.search(m_index, m_options.top))
         {
-            for (std::thread& thread : threads)
-            {
-                thread.join();
-            }
+            results.push_back({ std::string(m_index.document_name(id)), score });
+        }
 
-            threads.clear();
+        if (timings != nullptr)
+        {
+            timings->scoring += std::chrono::steady_clock::now() - start;
         }
-    }
+    }, results, timings);
+}
 
-    for (std::thread& thread : threads)
+void
+SearchEngine::Engine::execute_query(const std::string& query,
+    std::list<std::pair<std::string, float>>& results,
+    QueryTimings* timings)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (m_options.match == Match::All || BooleanQuery::has_syntax(query))
     {
-        thread.join();
+        BooleanQuery boolean_query(query);
+        if (timings != nullptr)
+        {
+            timings->tokenize += std::chrono::steady_clock::now() - start;
+        }
+
+        run_query(boolean_query, results, timings);
+        return;
     }
-#else
-    for (auto& filename : filesnames)
+
+    Tokenizer query_tokenizer(query);
+    std::list<std::string> tokens = query_tokenizer.scan_text();
+    if (timings != nullptr)
     {
-        std::cout << "Indexing: '" << filename << "'\n";
-        extract_from_file(filename);
+        timings->tokenize += std::chrono::steady_clock::now() - start;
     }
-#endif // MULTITHREADING
-
-    std::cout << "Writing to file...\n";
-    m_dictionary.write_to(out_filename);
 
-    return 0;
+    run_query(tokens, results, timings);
 }
 
-void
-SearchEngine::Engine::calculate_tf_idf_result(const std::string& filename,
-    const std::list<std::string>& tokens,
-    std::list<std::pair<std::string, float>>& results)
+bool
+SearchEngine::Engine::load_index(const std::string& index)
 {
-    float tf_idf = m_dictionary.tf_idf(filename, tokens);
+    if (SegmentedIndex::is_segmented_index(index))
+    {
+        m_segmented = true;
+        return m_segments.open(index);
+    }
 
-    if (tf_idf > EP)
+    if (IndexReader::is_index_file(index))
     {
-#if MULTITHREADING
-        std::lock_guard<std::mutex> guard(m_mutex);
-#endif // MULTITHREADING
-        results.push_back({ filename, tf_idf });
+        return m_index.open(index);
     }
+
+    // XML dictionaries are imported and searched through the same in-memory layout
+    m_dictionary.read_from(index);
+    return m_index.open(m_dictionary.serialize());
 }
 
 int 
 SearchEngine::Engine::search(const std::string& index)
 {
-    std::cout << "Loading dictionary file...\n";
-    m_dictionary.read_from(index);
+    std::cout << "Loading index file...\n";
+    if (!load_index(index))
+    {
+        return 1;
+    }
+
+    if (m_options.query_threads > 1)
+    {
+        m_query_pool.reset(new ThreadPool(m_options.query_threads));
+    }
+
+    if (m_options.query_cache > 0)
+    {
+        m_query_cache.reset(new QueryCache(m_options.query_cache));
+    }
+
+    // New segments are picked up before each query while old ones get merged in the background
+    if (m_segmented)
+    {
+        m_segments.start_merging();
+    }
 
     std::cout << "> ";
     std::string query;
     while (std::getline(std::cin, query))
     {
-        Tokenizer query_tokenizer(query);
-        std::list<std::string> tokens = query_tokenizer.scan_text();
         std::list<std::pair<std::string, float>> results;
 
         auto start = std::chrono::high_resolution_clock::now();
-        for (const auto& [filename, _] : *m_dictionary.m_file_map_ptr)
-        {
-            calculate_tf_idf_result(filename, tokens, results);
-        }
+        execute_query(query, results);
         auto end = std::chrono::high_resolution_clock::now();
         std::cout
             << results.size()
@@ -130,12 +935,6 @@ SearchEngine::Engine::search(const std::string& index)
             << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
             << "ms\n";
 
-        results.sort(
-            [](std::pair<std::string, float> a, std::pair<std::string, float> b)
-            {
-                return a.second > b.second;
-            });
-
         for (const auto& result : results)
         {
             std::cout << "[" << result.first << "] = " << result.second << "\n";
@@ -144,17 +943,404 @@ SearchEngine::Engine::search(const std::string& index)
         std::cout << "> ";
     }
 
+    if (m_query_cache)
+    {
+        std::cout << "\nQuery cache: "
+            << m_query_cache->hits() << " hits, "
+            << m_query_cache->misses() << " misses\n";
+    }
+
+    return 0;
+}
+
+std::string
+SearchEngine::Engine::answer_query(const std::string& query)
+{
+    std::list<std::pair<std::string, float>> results;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    execute_query(query, results);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    std::ostringstream response;
+    response << "{\"count\":" << results.size()
+        << ",\"time_us\":" << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()
+        << ",\"results\":[";
+
+    bool first = true;
+    for (const auto& result : results)
+    {
+        response << (first ? "" : ",") << "{\"document\":\"" << json_escape(result.first)
+            << "\",\"score\":" << result.second << "}";
+        first = false;
+    }
+    response << "]}";
+
+    return response.str();
+}
+
+int
+SearchEngine::Engine::serve(const std::string& index, const std::string& socket_path)
+{
+    std::cout << "Loading index file...\n";
+    if (!load_index(index))
+    {
+        return 1;
+    }
+
+    if (m_options.query_cache > 0)
+    {
+        m_query_cache.reset(new QueryCache(m_options.query_cache));
+    }
+
+    // Clients are served in parallel, so each query is scored on the worker that took it
+    QueryServer server([this](const std::string& query) { return answer_query(query); }, m_options.threads);
+    if (!server.listen(socket_path))
+    {
+        return 1;
+    }
+
+    if (m_segmented)
+    {
+        m_segments.start_merging();
+    }
+
+    std::cout << "Serving '" << index << "' on '" << socket_path << "' with " << m_options.threads << " threads\n";
+    server.run();
+
+    if (m_query_cache)
+    {
+        std::cout << "Query cache: "
+            << m_query_cache->hits() << " hits, "
+            << m_query_cache->misses() << " misses\n";
+    }
+
+    return 0;
+}
+
+int
+SearchEngine::Engine::bench_query(const std::string& index, const std::string& queries_filename)
+{
+    std::ifstream queries_file(queries_filename);
+    if (!queries_file)
+    {
+        std::cerr << "ERROR: Could not open queries file '" << queries_filename << "'\n";
+        return 1;
+    }
+
+    std::vector<std::string> queries;
+    for (std::string query; std::getline(queries_file, query);)
+    {
+        if (!query.empty()) queries.push_back(std::move(query));
+    }
+
+    if (queries.empty())
+    {
+        std::cerr << "ERROR: '" << queries_filename << "' has no queries\n";
+        return 1;
+    }
+
+    std::cout << "Loading index file...\n";
+    if (!load_index(index))
+    {
+        return 1;
+    }
+
+    // Queries run side by side like serve's clients, only a single one splits each query
+    if (m_options.threads == 1 && m_options.query_threads > 1)
+    {
+        m_query_pool.reset(new ThreadPool(m_options.query_threads));
+    }
+
+    if (m_options.query_cache > 0)
+    {
+        m_query_cache.reset(new QueryCache(m_options.query_cache));
+    }
+
+    for (std::size_t pass = 0; pass < m_options.warmup; ++pass)
+    {
+        for (const auto& query : queries)
+        {
+            std::list<std::pair<std::string, float>> results;
+            execute_query(query, results);
+        }
+    }
+
+    // Warmup only touches the index, the timed run starts with an empty cache
+    std::size_t cache_hits = 0;
+    std::size_t cache_misses = 0;
+    if (m_query_cache)
+    {
+        m_query_cache->clear();
+        cache_hits = m_query_cache->hits();
+        cache_misses = m_query_cache->misses();
+    }
+
+    ThreadPool pool(m_options.threads);
+    std::vector<std::vector<QueryTimings>> worker_timings(pool.size());
+    std::vector<std::vector<double>> worker_totals(pool.size());
+    std::atomic<std::size_t> next_query(0);
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < pool.size(); ++i)
+    {
+        pool.submit([this, &queries, &next_query, &worker_timings, &worker_totals]()
+        {
+            std::size_t worker = ThreadPool::current_worker();
+            for (std::size_t i; (i = next_query.fetch_add(1, std::memory_order_relaxed)) < queries.size();)
+            {
+                QueryTimings timings {};
+                std::list<std::pair<std::string, float>> results;
+
+                auto query_start = std::chrono::steady_clock::now();
+                execute_query(queries[i], results, &timings);
+                auto query_end = std::chrono::steady_clock::now();
+
+                worker_timings[worker].push_back(timings);
+                worker_totals[worker].push_back(std::chrono::duration<double, std::micro>(query_end - query_start).count());
+            }
+        });
+    }
+    pool.wait();
+    auto end = std::chrono::steady_clock::now();
+
+    std::vector<std::vector<double>> stages(5);
+    for (std::size_t worker = 0; worker < pool.size(); ++worker)
+    {
+        for (const QueryTimings& timings : worker_timings[worker])
+        {
+            for (std::size_t stage = 0; stage < 4; ++stage)
+            {
+                const std::chrono::nanoseconds& time = stage == 0 ? timings.tokenize
+                    : stage == 1 ? timings.candidates
+                    : stage == 2 ? timings.scoring
+                    : timings.sort;
+                stages[stage].push_back(std::chrono::duration<double, std::micro>(time).count());
+            }
+        }
+
+        stages[4].insert(stages[4].end(), worker_totals[worker].begin(), worker_totals[worker].end());
+    }
+
+    double elapsed = std::chrono::duration<double>(end - start).count();
+    std::cout << std::fixed << std::setprecision(1)
+        << "Ran " << queries.size() << " queries on " << pool.size() << " threads in "
+        << elapsed * 1000 << "ms after " << m_options.warmup << " warmup passes\n"
+        << "Throughput: " << queries.size() / elapsed << " queries/s\n"
+        << std::left << std::setw(12) << "Stage (us)" << std::right
+        << std::setw(12) << "p50" << std::setw(12) << "p90" << std::setw(12) << "p99" << std::setw(12) << "max" << "\n";
+
+    const char* stage_names[] = { "tokenize", "candidates", "scoring", "sort", "total" };
+    for (std::size_t stage = 0; stage < stages.size(); ++stage)
+    {
+        std::vector<double>& samples = stages[stage];
+        std::sort(samples.begin(), samples.end());
+
+        std::cout << std::left << std::setw(12) << stage_names[stage] << std::right
+            << std::setw(12) << percentile(samples, 0.50)
+            << std::setw(12) << percentile(samples, 0.90)
+            << std::setw(12) << percentile(samples, 0.99)
+            << std::setw(12) << samples.back() << "\n";
+    }
+    std::cout << std::defaultfloat;
+
+    if (m_query_cache)
+    {
+        std::cout << "Query cache: "
+            << m_query_cache->hits() - cache_hits << " hits, "
+            << m_query_cache->misses() - cache_misses << " misses\n";
+    }
+
     return 0;
 }
 
+int
+SearchEngine::Engine::convert(const std::string& in_filename, const std::string& out_filename)
+{
+    if (SegmentedIndex::is_segmented_index(in_filename))
+    {
+        SegmentedIndex segments;
+        if (!segments.open(in_filename)) return 1;
+
+        SegmentedIndex::read_documents(*segments.snapshot(), m_dictionary);
+        m_dictionary.build_inverted_index();
+    }
+    else
+    {
+        m_dictionary.read_from(in_filename);
+    }
+
+    return write_index(out_filename) ? 0 : 1;
+}
+
 void
 SearchEngine::Engine::usage()
 const noexcept
 {
     std::cout << "Usage: se COMMAND <Args...>\n";
     std::cout << "Commands:\n";
-    std::cout << "\tindex  <input_file> <output_file> Index the input file and save to the output file.\n";
-    std::cout << "\tsearch <index_file>               Perform a search using an indexed file.\n";
+    std::cout << "\tindex   <input_file> <output_file> Index the input file and save to the output file.\n";
+    std::cout << "\tsearch  <index_file>               Perform a search using an indexed file.\n";
+    std::cout << "\tupdate  <input_file> <index_file>  Re-index only the new & modified files and drop the deleted ones.\n";
+    std::cout << "\tconvert <index_file> <output_file> Convert an index between the binary and XML formats.\n";
+    std::cout << "\tserve   <index_file> <socket>      Answer queries from clients of a Unix domain socket, one per line.\n";
+    std::cout << "\tbench-query <index_file> <queries_file> Time a query log, one query per line, and report latency percentiles.\n";
+    std::cout << "Options:\n";
+    std::cout << "\t--threads <count>                  Number of indexing threads, or of queries run at once by serve & bench-query (default: hardware concurrency).\n";
+    std::cout << "\t--parser <libxml|native>           HTML text extraction used when indexing (default: libxml).\n";
+    std::cout << "\t--io-depth <count>                 Reads in flight in the read stage, the io_uring queue depth or up to 16 pread threads (default: 64).\n";
+    std::cout << "\t--stage-threads <e>,<t>,<a>        Threads extracting text, tokenizing & stemming, and accumulating dictionaries (default: split from --threads).\n";
+    std::cout << "\t--query-threads <count>            Score each query over this many threads (default: 1).\n";
+    std::cout << "\t--top <count>                      Only return the best <count> results, 0 returns all (default: 10).\n";
+    std::cout << "\t--match <any|all>                  Rank documents with any of the query's terms, or only match those with all of them (default: any).\n";
+    std::cout << "\t--query-cache <megabytes>          Memory for cached query results, 0 disables the cache (default: 16).\n";
+    std::cout << "\t--warmup <passes>                  Untimed passes over the query log before bench-query (default: 1).\n";
+    std::cout << "\t--stats <table|json|none>          Time & work per indexing stage printed by index & update (default: table).\n";
+    std::cout << "\t--quiet                            Don't print every file as it's indexed.\n";
+    std::cout << "\t--memory-budget <MB>               Spill sorted runs to disk & merge them at the end so index stays in the budget (default: 0, no limit).\n";
+    std::cout << "Index files ending with '.xml' are written as XML, any other name uses the binary format.\n";
+    std::cout << "Index paths that are directories (or end with '/') hold a segmented index, updated with new segments.\n";
+    std::cout << "Queries can use AND, OR, NOT, parentheses and \"quoted phrases\", adjacent terms then all have to match.\n";
+}
+
+bool
+SearchEngine::Engine::parse_options(int argc, char** argv, std::vector<std::string>& args)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strncmp(argv[i], "--", 2) != 0)
+        {
+            args.push_back(argv[i]);
+            continue;
+        }
+
+        if (strcmp(argv[i], "--quiet") == 0)
+        {
+            m_options.quiet = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::cerr << "ERROR: Option '" << argv[i] << "' expects a value\n";
+            return false;
+        }
+
+        const char* value = argv[++i];
+        if (strcmp(argv[i - 1], "--threads") == 0)
+        {
+            m_options.threads = strtoul(value, nullptr, 10);
+            if (m_options.threads == 0)
+            {
+                std::cerr << "ERROR: '--threads' expects a positive number\n";
+                return false;
+            }
+        }
+        else if (strcmp(argv[i - 1], "--parser") == 0)
+        {
+            if (strcmp(value, "libxml") == 0)
+            {
+                m_options.parser = Parser::LibXml;
+            }
+            else if (strcmp(value, "native") == 0)
+            {
+                m_options.parser = Parser::Native;
+            }
+            else
+            {
+                std::cerr << "ERROR: '--parser' expects 'libxml' or 'native'\n";
+                return false;
+            }
+        }
+        else if (strcmp(argv[i - 1], "--io-depth") == 0)
+        {
+            m_options.io_depth = strtoul(value, nullptr, 10);
+        }
+        else if (strcmp(argv[i - 1], "--top") == 0)
+        {
+            m_options.top = strtoul(value, nullptr, 10);
+        }
+        else if (strcmp(argv[i - 1], "--match") == 0)
+        {
+            if (strcmp(value, "any") == 0)
+            {
+                m_options.match = Match::Any;
+            }
+            else if (strcmp(value, "all") == 0)
+            {
+                m_options.match = Match::All;
+            }
+            else
+            {
+                std::cerr << "ERROR: '--match' expects 'any' or 'all'\n";
+                return false;
+            }
+        }
+        else if (strcmp(argv[i - 1], "--query-cache") == 0)
+        {
+            m_options.query_cache = strtoul(value, nullptr, 10) * 1024 * 1024;
+        }
+        else if (strcmp(argv[i - 1], "--stage-threads") == 0)
+        {
+            std::size_t* counts[] = { &m_options.stages.extract, &m_options.stages.tokenize, &m_options.stages.accumulate };
+            const char* next = value;
+            for (std::size_t j = 0; j < 3; ++j)
+            {
+                char* end;
+                *counts[j] = strtoul(next, &end, 10);
+                if (*counts[j] == 0 || *end != (j < 2 ? ',' : '\0'))
+                {
+                    std::cerr << "ERROR: '--stage-threads' expects three positive numbers, as in '2,4,1'\n";
+                    return false;
+                }
+                next = end + 1;
+            }
+        }
+        else if (strcmp(argv[i - 1], "--memory-budget") == 0)
+        {
+            m_options.memory_budget = strtoul(value, nullptr, 10) * 1024 * 1024;
+        }
+        else if (strcmp(argv[i - 1], "--stats") == 0)
+        {
+            if (strcmp(value, "table") == 0)
+            {
+                m_options.stats = StatsFormat::Table;
+            }
+            else if (strcmp(value, "json") == 0)
+            {
+                m_options.stats = StatsFormat::Json;
+            }
+            else if (strcmp(value, "none") == 0)
+            {
+                m_options.stats = StatsFormat::None;
+            }
+            else
+            {
+                std::cerr << "ERROR: '--stats' expects 'table', 'json' or 'none'\n";
+                return false;
+            }
+        }
+        else if (strcmp(argv[i - 1], "--warmup") == 0)
+        {
+            m_options.warmup = strtoul(value, nullptr, 10);
+        }
+        else if (strcmp(argv[i - 1], "--query-threads") == 0)
+        {
+            m_options.query_threads = strtoul(value, nullptr, 10);
+            if (m_options.query_threads == 0)
+            {
+                std::cerr << "ERROR: '--query-threads' expects a positive number\n";
+                return false;
+            }
+        }
+        else
+        {
+            std::cerr << "ERROR: Unknown option '" << argv[i - 1] << "'\n";
+            return false;
+        }
+    }
+
+    return true;
 }
 
 int
@@ -162,13 +1348,36 @@ SearchEngine::Engine::start(int argc, char** argv)
 {
     LIBXML_TEST_VERSION;
 
-    if (argc == 4 && strcmp(argv[1], "index") == 0)
+    std::vector<std::string> args;
+    if (!parse_options(argc, argv, args))
+    {
+        usage();
+        return 1;
+    }
+
+    if (args.size() == 3 && args[0] == "index")
+    {
+        return index(args[1], args[2]);
+    }
+    else if (args.size() == 2 && args[0] == "search")
+    {
+        return search(args[1]);
+    }
+    else if (args.size() == 3 && args[0] == "update")
+    {
+        return update(args[1], args[2]);
+    }
+    else if (args.size() == 3 && args[0] == "convert")
+    {
+        return convert(args[1], args[2]);
+    }
+    else if (args.size() == 3 && args[0] == "serve")
     {
-        return index(argv[2], argv[3]);
+        return serve(args[1], args[2]);
     }
-    else if (argc == 3 && strcmp(argv[1], "search") == 0)
+    else if (args.size() == 3 && args[0] == "bench-query")
     {
-        return search(argv[2]);
+        return bench_query(args[1], args[2]);
     }
 
     usage();
@@ -0,0 +1,95 @@
+#include "../includes/file-info.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool
+SearchEngine::FileInfo::stat(const std::string& filename, FileInfo& info)
+{
+    struct ::stat st;
+    if (::stat(filename.c_str(), &st) != 0)
+    {
+        return false;
+    }
+
+    info.size = st.st_size;
+    info.mtime = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+    return true;
+}
+
+std::uint64_t
+SearchEngine::FileInfo::hash_content(std::string_view content)
+noexcept
+{
+    // FNV-1a over 8-byte words, then a final avalanche so the tail bytes spread too
+    const std::uint64_t prime = 0x100000001b3ull;
+    std::uint64_t hash = 0xcbf29ce484222325ull ^ content.size();
+
+    std::size_t i = 0;
+    for (; i + sizeof(std::uint64_t) <= content.size(); i += sizeof(std::uint64_t))
+    {
+        std::uint64_t word;
+        std::memcpy(&word, content.data() + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+
+    for (; i < content.size(); ++i)
+    {
+        hash = (hash ^ static_cast<unsigned char>(content[i])) * prime;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+bool
+SearchEngine::FileInfo::hash_file(const std::string& filename, std::uint64_t& hash)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct ::stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    if (st.st_size == 0)
+    {
+        ::close(fd);
+        hash = hash_content(std::string_view());
+        return true;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    hash = hash_content(std::string_view(static_cast<const char*>(data), st.st_size));
+    munmap(data, st.st_size);
+
+    return true;
+}
+
+bool
+SearchEngine::FileInfo::same_stat(const FileInfo& other)
+const noexcept
+{
+    return size == other.size && mtime == other.mtime;
+}
@@ -0,0 +1,439 @@
+#include "../includes/file-reader.hpp"
+#include <thread>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if IO_URING_AVAILABLE
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif // IO_URING_AVAILABLE
+
+SearchEngine::FileReader::FileReader(std::size_t depth)
+    : m_depth(std::max<std::size_t>(depth, 1)),
+      m_outstanding(0),
+      m_backend("none")
+{
+}
+
+const char*
+SearchEngine::FileReader::backend()
+const noexcept
+{
+    return m_backend;
+}
+
+void
+SearchEngine::FileReader::acquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_released.wait(lock, [this]() { return m_outstanding < m_depth; });
+    ++m_outstanding;
+}
+
+bool
+SearchEngine::FileReader::try_acquire()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (m_outstanding >= m_depth) return false;
+
+    ++m_outstanding;
+    return true;
+}
+
+void
+SearchEngine::FileReader::release()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        --m_outstanding;
+    }
+    m_released.notify_one();
+}
+
+bool
+SearchEngine::FileReader::next_file(const FileSource& source, std::string& filename)
+{
+    std::lock_guard<std::mutex> guard(m_source_mutex);
+    return source(filename);
+}
+
+bool
+SearchEngine::FileReader::read_with_pread(int fd, Buffer& buffer)
+{
+    std::size_t done = 0;
+    while (done < buffer.size())
+    {
+        ssize_t ret = pread(fd, buffer.data() + done, buffer.size() - done, done);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) return false;
+        if (ret == 0) break;
+
+        done += ret;
+    }
+
+    buffer.resize(done);
+    return true;
+}
+
+void
+SearchEngine::FileReader::read_all_pread(const FileSource& source, const ReadHandler& on_read)
+{
+    m_backend = "pread";
+
+    auto read_files = [this, &source, &on_read]()
+    {
+        std::string filename;
+        while (true)
+        {
+            acquire();
+            if (!next_file(source, filename))
+            {
+                release();
+                return;
+            }
+
+            Buffer buffer;
+            bool ok;
+            {
+                IndexingStats::Timer timer(IndexingStats::Stage::Read);
+
+                int fd = open(filename.c_str(), O_RDONLY);
+                struct stat st;
+                if (fd < 0 || fstat(fd, &st) != 0)
+                {
+                    std::cerr << "ERROR: Could not open '" << filename << "'\n";
+                    if (fd >= 0) close(fd);
+                    release();
+                    continue;
+                }
+
+                buffer.resize(st.st_size);
+                ok = read_with_pread(fd, buffer);
+                close(fd);
+            }
+
+            if (!ok)
+            {
+                std::cerr << "ERROR: Could not read '" << filename << "'\n";
+                release();
+                continue;
+            }
+
+            on_read(std::move(filename), std::move(buffer));
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < std::min<std::size_t>(m_depth, FILE_READER_MAX_THREADS); ++i)
+    {
+        threads.emplace_back(read_files);
+    }
+
+    read_files();
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+#if IO_URING_AVAILABLE
+namespace
+{
+    // Minimal io_uring ring set up through the raw system calls, so liburing isn't needed
+    class Ring
+    {
+    private:
+        int m_fd;
+        void* m_sq_ptr;
+        void* m_cq_ptr;
+        std::size_t m_sq_size;
+        std::size_t m_cq_size;
+        io_uring_sqe* m_sqes;
+        std::size_t m_sqes_size;
+
+        unsigned* m_sq_head;
+        unsigned* m_sq_tail;
+        unsigned* m_sq_mask;
+        unsigned* m_sq_array;
+        unsigned* m_cq_head;
+        unsigned* m_cq_tail;
+        unsigned* m_cq_mask;
+        io_uring_cqe* m_cqes;
+
+        unsigned m_to_submit;
+
+    public:
+        Ring()
+            : m_fd(-1), m_sq_ptr(MAP_FAILED), m_cq_ptr(MAP_FAILED), m_sq_size(0), m_cq_size(0),
+              m_sqes(static_cast<io_uring_sqe*>(MAP_FAILED)), m_sqes_size(0), m_to_submit(0)
+        {
+        }
+
+        Ring(const Ring&) = delete;
+        Ring& operator=(const Ring&) = delete;
+
+        bool
+        setup(unsigned entries)
+        {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+
+            m_fd = syscall(__NR_io_uring_setup, entries, &params);
+            if (m_fd < 0) return false;
+
+            m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (single_mmap)
+            {
+                m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+            }
+
+            m_sq_ptr = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+            if (m_sq_ptr == MAP_FAILED) return false;
+
+            m_cq_ptr = single_mmap
+                ? m_sq_ptr
+                : mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+            if (m_cq_ptr == MAP_FAILED) return false;
+
+            m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            m_sqes = static_cast<io_uring_sqe*>(
+                mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES));
+            if (m_sqes == MAP_FAILED) return false;
+
+            char* sq = static_cast<char*>(m_sq_ptr);
+            m_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+            m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            m_sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+            char* cq = static_cast<char*>(m_cq_ptr);
+            m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            m_cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+            return true;
+        }
+
+        void
+        queue_read(int fd, char* data, unsigned length, std::uint64_t offset, std::uint64_t user_data)
+        {
+            unsigned tail = *m_sq_tail;
+            unsigned index = tail & *m_sq_mask;
+
+            io_uring_sqe& sqe = m_sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(data);
+            sqe.len = length;
+            sqe.off = offset;
+            sqe.user_data = user_data;
+
+            m_sq_array[index] = index;
+            __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+            ++m_to_submit;
+        }
+
+        // Submits everything queued so far and waits for at least one completion
+        bool
+        submit_and_wait()
+        {
+            int ret;
+            do
+            {
+                ret = syscall(__NR_io_uring_enter, m_fd, m_to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            }
+            while (ret < 0 && errno == EINTR);
+
+            if (ret < 0) return false;
+
+            m_to_submit -= std::min<unsigned>(m_to_submit, ret);
+            return true;
+        }
+
+        template <typename Handler>
+        void
+        reap(Handler&& handler)
+        {
+            unsigned head = *m_cq_head;
+            unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+            for (; head != tail; ++head)
+            {
+                const io_uring_cqe& cqe = m_cqes[head & *m_cq_mask];
+                handler(cqe.user_data, cqe.res);
+            }
+
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        }
+
+        ~Ring()
+        {
+            if (m_sqes != MAP_FAILED) munmap(m_sqes, m_sqes_size);
+            if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr) munmap(m_cq_ptr, m_cq_size);
+            if (m_sq_ptr != MAP_FAILED) munmap(m_sq_ptr, m_sq_size);
+            if (m_fd >= 0) close(m_fd);
+        }
+    };
+}
+
+bool
+SearchEngine::FileReader::read_all_uring(const FileSource& source, const ReadHandler& on_read)
+{
+    Ring ring;
+    if (!ring.setup(m_depth)) return false;
+
+    m_backend = "io_uring";
+
+    struct Slot
+    {
+        int fd;
+        std::string filename;
+        Buffer buffer;
+        std::size_t done;
+    };
+
+    std::vector<Slot> slots(m_depth, { -1, std::string(), Buffer(), 0 });
+    std::vector<std::size_t> free_slots(m_depth);
+    std::iota(free_slots.rbegin(), free_slots.rend(), 0);
+
+    std::size_t in_flight = 0;
+    bool exhausted = false;
+
+    auto finish = [&](std::size_t index, bool ok)
+    {
+        Slot& slot = slots[index];
+        close(slot.fd);
+        slot.fd = -1;
+        free_slots.push_back(index);
+        --in_flight;
+
+        if (ok)
+        {
+            slot.buffer.resize(slot.done);
+            on_read(std::move(slot.filename), std::move(slot.buffer));
+        }
+        else
+        {
+            std::cerr << "ERROR: Could not read '" << slot.filename << "'\n";
+            release();
+        }
+
+        slot.filename.clear();
+        slot.buffer = Buffer();
+    };
+
+    while (!exhausted || in_flight > 0)
+    {
+        // Keep the ring full, as long as consumers give buffers back
+        while (!exhausted && !free_slots.empty() && (in_flight == 0 ? (acquire(), true) : try_acquire()))
+        {
+            std::size_t index = free_slots.back();
+            Slot& slot = slots[index];
+
+            if (!next_file(source, slot.filename))
+            {
+                exhausted = true;
+                release();
+                break;
+            }
+
+            IndexingStats::Timer timer(IndexingStats::Stage::Read);
+            slot.fd = open(slot.filename.c_str(), O_RDONLY);
+            struct stat st;
+            if (slot.fd < 0 || fstat(slot.fd, &st) != 0)
+            {
+                std::cerr << "ERROR: Could not open '" << slot.filename << "'\n";
+                if (slot.fd >= 0) close(slot.fd);
+                release();
+                continue;
+            }
+
+            free_slots.pop_back();
+            slot.buffer.resize(st.st_size);
+            slot.done = 0;
+            ++in_flight;
+
+            if (slot.buffer.empty())
+            {
+                finish(index, true);
+                continue;
+            }
+
+            ring.queue_read(slot.fd, slot.buffer.data(), slot.buffer.size(), 0, index);
+        }
+
+        if (in_flight == 0) continue;
+
+        bool submitted;
+        {
+            IndexingStats::Timer timer(IndexingStats::Stage::Read);
+            submitted = ring.submit_and_wait();
+        }
+
+        if (!submitted)
+        {
+            std::cerr << "ERROR: io_uring_enter failed, reading the rest with pread\n";
+            for (std::size_t index = 0; index < slots.size(); ++index)
+            {
+                if (slots[index].fd < 0) continue;
+
+                bool ok = read_with_pread(slots[index].fd, slots[index].buffer);
+                slots[index].done = slots[index].buffer.size();
+                finish(index, ok);
+            }
+
+            return exhausted;
+        }
+
+        ring.reap([&](std::uint64_t index, int res)
+        {
+            Slot& slot = slots[index];
+
+            // Kernels without IORING_OP_READ or files that don't support it
+            if (res == -EINVAL || res == -EOPNOTSUPP)
+            {
+                bool ok = read_with_pread(slot.fd, slot.buffer);
+                slot.done = slot.buffer.size();
+                finish(index, ok);
+                return;
+            }
+
+            if (res < 0)
+            {
+                finish(index, false);
+                return;
+            }
+
+            slot.done += res;
+            if (res == 0 || slot.done == slot.buffer.size())
+            {
+                finish(index, true);
+                return;
+            }
+
+            // Short read, queue the rest
+            ring.queue_read(slot.fd, slot.buffer.data() + slot.done, slot.buffer.size() - slot.done, slot.done, index);
+        });
+    }
+
+    return true;
+}
+#endif // IO_URING_AVAILABLE
+
+void
+SearchEngine::FileReader::read_all(const FileSource& source, const ReadHandler& on_read)
+{
+#if IO_URING_AVAILABLE
+    if (read_all_uring(source, on_read)) return;
+#endif // IO_URING_AVAILABLE
+
+    read_all_pread(source, on_read);
+}
@@ -0,0 +1,283 @@
+#include "../includes/html-extractor.hpp"
+#include "../includes/char-scan.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char*
+    find_ignore_case(const char* begin, const char* end, std::string_view needle)
+    {
+        for (; begin + needle.size() <= end; ++begin)
+        {
+            begin = static_cast<const char*>(memchr(begin, needle.front(), end - begin));
+            if (begin == nullptr || begin + needle.size() > end) return end;
+
+            if (strncasecmp(begin, needle.data(), needle.size()) == 0) return begin;
+        }
+
+        return end;
+    }
+
+    void
+    append_utf8(std::string& out, unsigned long code_point)
+    {
+        if (code_point < 0x80)
+        {
+            out += static_cast<char>(code_point);
+        }
+        else if (code_point < 0x800)
+        {
+            out += static_cast<char>(0xC0 | (code_point >> 6));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+        else if (code_point < 0x10000)
+        {
+            out += static_cast<char>(0xE0 | (code_point >> 12));
+            out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+        else if (code_point < 0x110000)
+        {
+            out += static_cast<char>(0xF0 | (code_point >> 18));
+            out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+    }
+}
+
+SearchEngine::HtmlExtractor::HtmlExtractor(const std::string& filename)
+    : m_begin(nullptr),
+      m_end(nullptr),
+      m_mapping(nullptr),
+      m_mapping_size(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "ERROR: Could not open '" << filename << "'\n";
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            m_mapping = data;
+            m_mapping_size = st.st_size;
+            m_begin = static_cast<const char*>(data);
+            m_end = m_begin + st.st_size;
+        }
+        else
+        {
+            std::cerr << "ERROR: Could not map '" << filename << "'\n";
+        }
+    }
+
+    close(fd);
+}
+
+SearchEngine::HtmlExtractor::HtmlExtractor(std::string_view content)
+    : m_begin(content.data()),
+      m_end(content.data() + content.size()),
+      m_mapping(nullptr),
+      m_mapping_size(0)
+{
+}
+
+const char*
+SearchEngine::HtmlExtractor::skip_tag(const char* current, std::string& name, bool& closing)
+const
+{
+    // `current` points right after '<'
+    name.clear();
+    closing = current != m_end && *current == '/';
+    if (closing) ++current;
+
+    while (current != m_end && (isalnum((unsigned char) *current) || *current == '-' || *current == ':'))
+    {
+        name += static_cast<char>(tolower((unsigned char) *current));
+        ++current;
+    }
+
+    char quote = 0;
+    for (; current != m_end; ++current)
+    {
+        if (quote != 0)
+        {
+            if (*current == quote) quote = 0;
+        }
+        else if (*current == '"' || *current == '\'')
+        {
+            quote = *current;
+        }
+        else if (*current == '>')
+        {
+            // Self closing tags have no content to skip
+            if (*(current - 1) == '/') closing = true;
+            return current + 1;
+        }
+    }
+
+    return m_end;
+}
+
+const char*
+SearchEngine::HtmlExtractor::skip_element(const char* current, const std::string& name)
+const
+{
+    const std::string end_tag = "</" + name;
+
+    while ((current = find_ignore_case(current, m_end, end_tag)) != m_end)
+    {
+        const char* after = current + end_tag.size();
+        if (after == m_end || !isalnum((unsigned char) *after))
+        {
+            const char* close = static_cast<const char*>(memchr(after, '>', m_end - after));
+            return close != nullptr ? close + 1 : m_end;
+        }
+
+        current = after;
+    }
+
+    return m_end;
+}
+
+const char*
+SearchEngine::HtmlExtractor::decode_entity(const char* current)
+{
+    // `current` points at '&', unknown or unterminated entities are kept literally
+    const char* semicolon = static_cast<const char*>(memchr(current, ';', std::min<std::ptrdiff_t>(m_end - current, 12)));
+    if (semicolon == nullptr)
+    {
+        m_buffer += '&';
+        return current + 1;
+    }
+
+    std::string_view entity(current + 1, semicolon - current - 1);
+
+    if (entity.size() > 1 && entity.front() == '#')
+    {
+        bool hex = entity[1] == 'x' || entity[1] == 'X';
+        std::string digits(entity.substr(hex ? 2 : 1));
+        char* digits_end = nullptr;
+        unsigned long code_point = strtoul(digits.c_str(), &digits_end, hex ? 16 : 10);
+
+        if (!digits.empty() && *digits_end == '\0')
+        {
+            append_utf8(m_buffer, code_point);
+            return semicolon + 1;
+        }
+    }
+    else if (entity == "amp") { m_buffer += '&'; return semicolon + 1; }
+    else if (entity == "lt") { m_buffer += '<'; return semicolon + 1; }
+    else if (entity == "gt") { m_buffer += '>'; return semicolon + 1; }
+    else if (entity == "quot") { m_buffer += '"'; return semicolon + 1; }
+    else if (entity == "apos") { m_buffer += '\''; return semicolon + 1; }
+    else if (entity == "nbsp") { append_utf8(m_buffer, 0xA0); return semicolon + 1; }
+
+    m_buffer += '&';
+    return current + 1;
+}
+
+void
+SearchEngine::HtmlExtractor::parse(const XmlParser::TextHandler& on_text)
+{
+    // A text node is handed out as a view into the file, unless it contains
+    // entities, then it's decoded into `m_buffer` first
+    const char* current = m_begin;
+    const char* text_start = m_begin;
+    bool decoded = false;
+    std::string name;
+
+    auto end_text = [&](const char* text_end)
+    {
+        if (decoded)
+        {
+            m_buffer.append(text_start, text_end);
+            if (!m_buffer.empty()) on_text(m_buffer);
+            m_buffer.clear();
+            decoded = false;
+        }
+        else if (text_end != text_start)
+        {
+            on_text(std::string_view(text_start, text_end - text_start));
+        }
+    };
+
+    while (current != m_end)
+    {
+        const char* markup = CharScan::find_markup(current, m_end);
+        if (markup == m_end)
+        {
+            current = m_end;
+            break;
+        }
+
+        if (*markup == '&')
+        {
+            if (!decoded)
+            {
+                m_buffer.clear();
+                decoded = true;
+            }
+            m_buffer.append(text_start, markup);
+            current = text_start = decode_entity(markup);
+            continue;
+        }
+
+        end_text(markup);
+
+        std::string_view rest(markup, m_end - markup);
+        if (rest.substr(0, 4) == "<!--")
+        {
+            const char* close = find_ignore_case(markup + 4, m_end, "-->");
+            current = close != m_end ? close + 3 : m_end;
+        }
+        else if (rest.substr(0, 9) == "<![CDATA[")
+        {
+            const char* close = find_ignore_case(markup + 9, m_end, "]]>");
+            current = close != m_end ? close + 3 : m_end;
+        }
+        else if (rest.size() > 1 && (rest[1] == '!' || rest[1] == '?'))
+        {
+            const char* close = static_cast<const char*>(memchr(markup, '>', m_end - markup));
+            current = close != nullptr ? close + 1 : m_end;
+        }
+        else if (rest.size() > 1 && (isalpha((unsigned char) rest[1]) || rest[1] == '/'))
+        {
+            bool closing;
+            current = skip_tag(markup + 1, name, closing);
+
+            if (!closing && XmlParser::is_ignored_tag(name))
+            {
+                current = skip_element(current, name);
+            }
+        }
+        else
+        {
+            // A lone '<' is plain text
+            text_start = markup;
+            current = markup + 1;
+            continue;
+        }
+
+        text_start = current;
+    }
+
+    end_text(current);
+}
+
+SearchEngine::HtmlExtractor::~HtmlExtractor()
+{
+    if (m_mapping != nullptr)
+    {
+        munmap(m_mapping, m_mapping_size);
+    }
+}
@@ -0,0 +1,477 @@
+#include "../includes/index-reader.hpp"
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SearchEngine::IndexReader::IndexReader()
+    : m_data(nullptr),
+      m_size(0),
+      m_mapped(false),
+      m_header(nullptr),
+      m_documents(nullptr),
+      m_terms(nullptr),
+      m_postings(nullptr),
+      m_positions(nullptr),
+      m_strings(nullptr)
+{
+}
+
+bool
+SearchEngine::IndexReader::is_index_file(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    std::uint32_t magic = 0;
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+
+    return file && magic == INDEX_MAGIC;
+}
+
+bool
+SearchEngine::IndexReader::load()
+{
+    using namespace IndexFormat;
+
+    if (m_size < sizeof(Header))
+    {
+        std::cerr << "ERROR: Index file is too small to hold a header\n";
+        return false;
+    }
+
+    m_header = reinterpret_cast<const Header*>(m_data);
+    if (m_header->magic != INDEX_MAGIC)
+    {
+        std::cerr << "ERROR: Index file has a wrong magic number\n";
+        return false;
+    }
+
+    if (m_header->version != INDEX_VERSION)
+    {
+        std::cerr << "ERROR: Unsupported index version " << m_header->version << "\n";
+        return false;
+    }
+
+    if (m_header->documents_offset + m_header->document_count * sizeof(DocumentRecord) > m_size
+        || m_header->terms_offset + m_header->term_count * sizeof(TermRecord) > m_size
+        || m_header->postings_offset + m_header->postings_size > m_size
+        || m_header->positions_offset + m_header->positions_size > m_size
+        || m_header->strings_offset + m_header->strings_size > m_size)
+    {
+        std::cerr << "ERROR: Index file is truncated\n";
+        return false;
+    }
+
+    m_documents = reinterpret_cast<const DocumentRecord*>(m_data + m_header->documents_offset);
+    m_terms = reinterpret_cast<const TermRecord*>(m_data + m_header->terms_offset);
+    m_postings = m_data + m_header->postings_offset;
+    m_positions = m_data + m_header->positions_offset;
+    m_strings = m_data + m_header->strings_offset;
+
+    return true;
+}
+
+bool
+SearchEngine::IndexReader::open(const std::string& filename)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "ERROR: Could not open index file '" << filename << "'\n";
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        std::cerr << "ERROR: Could not stat index file '" << filename << "'\n";
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        std::cerr << "ERROR: Could not map index file '" << filename << "'\n";
+        return false;
+    }
+
+    // Queries only touch a few terms' postings, don't read ahead the whole file
+    madvise(data, st.st_size, MADV_RANDOM);
+
+    m_data = static_cast<const char*>(data);
+    m_size = st.st_size;
+    m_mapped = true;
+
+    if (!load())
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+bool
+SearchEngine::IndexReader::open(std::vector<char>&& buffer)
+{
+    close();
+
+    m_buffer = std::move(buffer);
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+
+    if (!load())
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void
+SearchEngine::IndexReader::close()
+noexcept
+{
+    if (m_mapped)
+    {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+
+    m_buffer.clear();
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+    m_header = nullptr;
+    m_documents = nullptr;
+    m_terms = nullptr;
+    m_postings = nullptr;
+    m_positions = nullptr;
+    m_strings = nullptr;
+}
+
+std::size_t
+SearchEngine::IndexReader::document_count()
+const noexcept
+{
+    return m_header != nullptr ? m_header->document_count : 0;
+}
+
+std::size_t
+SearchEngine::IndexReader::term_count()
+const noexcept
+{
+    return m_header != nullptr ? m_header->term_count : 0;
+}
+
+std::string_view
+SearchEngine::IndexReader::document_name(DocumentId id)
+const
+{
+    const IndexFormat::DocumentRecord& record = m_documents[id];
+    return std::string_view(m_strings + record.name_offset, record.name_length);
+}
+
+std::size_t
+SearchEngine::IndexReader::document_length(DocumentId id)
+const
+{
+    return m_documents[id].length;
+}
+
+const SearchEngine::IndexFormat::DocumentRecord&
+SearchEngine::IndexReader::document_record(DocumentId id)
+const
+{
+    return m_documents[id];
+}
+
+const SearchEngine::IndexFormat::TermRecord&
+SearchEngine::IndexReader::term_record(std::size_t index)
+const
+{
+    return m_terms[index];
+}
+
+std::string_view
+SearchEngine::IndexReader::term(const IndexFormat::TermRecord& record)
+const
+{
+    return std::string_view(m_strings + record.key_offset, record.key_length);
+}
+
+const SearchEngine::IndexFormat::TermRecord*
+SearchEngine::IndexReader::find_term(std::string_view key)
+const
+{
+    const IndexFormat::TermRecord* begin = m_terms;
+    const IndexFormat::TermRecord* end = m_terms + term_count();
+
+    auto found = std::lower_bound(begin, end, key,
+        [this](const IndexFormat::TermRecord& record, std::string_view key)
+        {
+            return term(record) < key;
+        });
+
+    return found != end && term(*found) == key ? found : nullptr;
+}
+
+SearchEngine::PostingCursor
+SearchEngine::IndexReader::postings(const IndexFormat::TermRecord& record)
+const
+{
+    return PostingCursor(m_postings + record.postings_offset, record.document_frequency);
+}
+
+SearchEngine::PositionsReader
+SearchEngine::IndexReader::positions(const IndexFormat::TermRecord& record)
+const
+{
+    return PositionsReader(m_positions + record.positions_offset, record.document_frequency);
+}
+
+SearchEngine::IndexReader::QueryTerms
+SearchEngine::IndexReader::find_terms(const std::list<std::string>& tokens)
+const
+{
+    QueryTerms terms;
+    for (const auto& token : tokens)
+    {
+        const IndexFormat::TermRecord* record = find_term(token);
+        if (record != nullptr) terms.push_back({ record, record->idf, record->max_score });
+    }
+
+    return terms;
+}
+
+std::vector<SearchEngine::IndexReader::ScoredDocument>
+SearchEngine::IndexReader::tf_idf(const QueryTerms& terms, DocumentId first, DocumentId last, const Tombstones* deleted)
+const
+{
+    // Term-at-a-time over [first, last): merge each term's postings into the accumulator, both sorted by id
+    std::vector<ScoredDocument> scores;
+    std::vector<ScoredDocument> merged;
+    for (const QueryTerm& term : terms)
+    {
+        PostingCursor posting = postings(*term.record);
+        posting.advance_to(first);
+
+        merged.clear();
+        merged.reserve(scores.size() + term.record->document_frequency);
+
+        auto current = scores.begin();
+        for (; !posting.at_end() && posting.document_id() < last; posting.next())
+        {
+            const DocumentId id = posting.document_id();
+            if (deleted != nullptr && (*deleted)[id]) continue;
+
+            while (current != scores.end() && current->first < id)
+            {
+                merged.push_back(*current++);
+            }
+
+            float score = current != scores.end() && current->first == id ? (current++)->second : 0.0f;
+            float tf = static_cast<float>(posting.freq()) / m_documents[id].length;
+            merged.push_back({ id, score + tf * term.idf });
+        }
+        merged.insert(merged.end(), current, scores.end());
+
+        scores.swap(merged);
+    }
+
+    return scores;
+}
+
+std::vector<SearchEngine::IndexReader::ScoredDocument>
+SearchEngine::IndexReader::tf_idf(const std::list<std::string>& tokens)
+const
+{
+    return tf_idf(find_terms(tokens), 0, document_count());
+}
+
+std::vector<SearchEngine::IndexReader::ScoredDocument>
+SearchEngine::IndexReader::top_k(const QueryTerms& terms, std::size_t k, float min_score, DocumentId first, DocumentId last,
+    const Tombstones* deleted)
+const
+{
+    // Document-at-a-time MaxScore: terms are ordered by upper bound, and the
+    // lowest ones whose bounds together can't beat the current threshold are
+    // "non-essential", only probed for documents found through the others.
+    struct Cursor
+    {
+        PostingCursor postings;
+        float idf;
+        float upper_bound;
+    };
+
+    // A cursor is done once it leaves [first, last)
+    auto at = [last](const Cursor& cursor, DocumentId id)
+    {
+        return !cursor.postings.at_end() && cursor.postings.document_id() == id && id < last;
+    };
+
+    std::vector<Cursor> cursors;
+    cursors.reserve(terms.size());
+    for (const QueryTerm& term : terms)
+    {
+        cursors.push_back({ postings(*term.record), term.idf, term.max_score });
+        cursors.back().postings.advance_to(first);
+    }
+
+    // Query order is kept in `cursors` so scores are summed exactly like tf_idf,
+    // `order` holds the cursor indices sorted by ascending upper bound
+    std::vector<std::size_t> order(cursors.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+        [&cursors](std::size_t a, std::size_t b)
+        {
+            return cursors[a].upper_bound < cursors[b].upper_bound;
+        });
+
+    std::vector<float> prefix_bounds(order.size());
+    float bound_acc = 0.0f;
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        bound_acc += cursors[order[i]].upper_bound;
+        prefix_bounds[i] = bound_acc;
+    }
+
+    // Bounds are summed in a different order than the final score, leave room for rounding
+    auto can_exceed = [](float bound, float threshold)
+    {
+        return bound * (1.0f + MAXSCORE_SLACK) > threshold;
+    };
+
+    // Heap top is the worst kept document, ties go to the lower id
+    auto better = [](const ScoredDocument& a, const ScoredDocument& b)
+    {
+        return a.second > b.second || (a.second == b.second && a.first < b.first);
+    };
+
+    std::vector<ScoredDocument> heap;
+    heap.reserve(k + 1);
+    float threshold = min_score;
+
+    std::size_t first_essential = 0;
+    while (first_essential < order.size() && !can_exceed(prefix_bounds[first_essential], threshold))
+    {
+        ++first_essential;
+    }
+
+    auto contribution = [this](const Cursor& cursor)
+    {
+        return static_cast<float>(cursor.postings.freq()) / m_documents[cursor.postings.document_id()].length * cursor.idf;
+    };
+
+    while (first_essential < order.size())
+    {
+        DocumentId id = last;
+        for (std::size_t i = first_essential; i < order.size(); ++i)
+        {
+            const Cursor& cursor = cursors[order[i]];
+            if (!cursor.postings.at_end() && cursor.postings.document_id() < id)
+            {
+                id = cursor.postings.document_id();
+            }
+        }
+
+        if (id == last) break;
+
+        float bound = first_essential > 0 ? prefix_bounds[first_essential - 1] : 0.0f;
+        for (std::size_t i = first_essential; i < order.size(); ++i)
+        {
+            const Cursor& cursor = cursors[order[i]];
+            if (at(cursor, id))
+            {
+                bound += contribution(cursor);
+            }
+        }
+
+        // Probe non-essential terms from the highest bound down, stopping as soon as the document can't make it
+        for (std::size_t i = first_essential; i-- > 0 && can_exceed(bound, threshold);)
+        {
+            Cursor& cursor = cursors[order[i]];
+            cursor.postings.advance_to(id);
+
+            bound -= cursor.upper_bound;
+            if (at(cursor, id))
+            {
+                bound += contribution(cursor);
+            }
+        }
+
+        if (can_exceed(bound, threshold) && (deleted == nullptr || !(*deleted)[id]))
+        {
+            float score = 0.0f;
+            for (const Cursor& cursor : cursors)
+            {
+                if (at(cursor, id))
+                {
+                    score += contribution(cursor);
+                }
+            }
+
+            if (score > min_score && (heap.size() < k || score > heap.front().second))
+            {
+                heap.push_back({ id, score });
+                std::push_heap(heap.begin(), heap.end(), better);
+
+                if (heap.size() > k)
+                {
+                    std::pop_heap(heap.begin(), heap.end(), better);
+                    heap.pop_back();
+                }
+
+                if (heap.size() == k && heap.front().second > threshold)
+                {
+                    threshold = heap.front().second;
+                    while (first_essential < order.size() && !can_exceed(prefix_bounds[first_essential], threshold))
+                    {
+                        ++first_essential;
+                    }
+                }
+            }
+        }
+
+        for (std::size_t i = first_essential; i < order.size(); ++i)
+        {
+            Cursor& cursor = cursors[order[i]];
+            if (at(cursor, id))
+            {
+                cursor.postings.next();
+            }
+        }
+    }
+
+    std::sort_heap(heap.begin(), heap.end(), better);
+    return heap;
+}
+
+void
+SearchEngine::IndexReader::sort_by_score(std::vector<ScoredDocument>& scores, std::size_t k)
+{
+    auto better = [](const ScoredDocument& a, const ScoredDocument& b)
+    {
+        return a.second > b.second || (a.second == b.second && a.first < b.first);
+    };
+
+    if (k != 0 && k < scores.size())
+    {
+        std::partial_sort(scores.begin(), scores.begin() + k, scores.end(), better);
+        scores.resize(k);
+    }
+    else
+    {
+        std::sort(scores.begin(), scores.end(), better);
+    }
+}
+
+SearchEngine::IndexReader::~IndexReader()
+{
+    close();
+}
@@ -0,0 +1,633 @@
+#include "../includes/index-runs.hpp"
+#include "../includes/indexing-stats.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <queue>
+#include <sstream>
+
+namespace
+{
+    void
+    write_varint(std::ostream& out, std::uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.put(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.put(static_cast<char>(value));
+    }
+
+    bool
+    read_varint(std::istream& in, std::uint64_t& value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            int byte = in.get();
+            if (byte == std::char_traits<char>::eof()) return false;
+
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) return true;
+        }
+
+        return false;
+    }
+
+    template <typename T>
+    void
+    write_raw(std::ostream& out, const T& value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    bool
+    read_raw(std::istream& in, T& value)
+    {
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+    }
+
+    void
+    write_string(std::ostream& out, std::string_view text)
+    {
+        write_varint(out, text.size());
+        out.write(text.data(), text.size());
+    }
+
+    bool
+    read_string(std::istream& in, std::string& text)
+    {
+        std::uint64_t size;
+        if (!read_varint(in, size)) return false;
+
+        text.resize(size);
+        return static_cast<bool>(in.read(text.data(), size));
+    }
+
+    // Zero bytes up to the next 8-byte boundary, as the in-memory serializer leaves them
+    void
+    pad(std::ostream& out, std::uint64_t& offset)
+    {
+        static const char zeros[8] = {};
+        std::uint64_t aligned = (offset + 7) & ~std::uint64_t(7);
+        out.write(zeros, aligned - offset);
+        offset = aligned;
+    }
+}
+
+bool
+SearchEngine::IndexRuns::Writer::open(const std::string& filename)
+{
+    m_file.open(filename, std::ios::binary | std::ios::trunc);
+    m_document_count = 0;
+
+    // The document count is filled in on close
+    write_raw(m_file, RUN_MAGIC);
+    write_raw(m_file, m_document_count);
+
+    return static_cast<bool>(m_file);
+}
+
+void
+SearchEngine::IndexRuns::Writer::add_document(const Document& document)
+{
+    write_string(m_file, document.name);
+    write_varint(m_file, document.length);
+    write_varint(m_file, document.info.size);
+    write_raw(m_file, document.info.mtime);
+    write_raw(m_file, document.info.hash);
+    ++m_document_count;
+}
+
+void
+SearchEngine::IndexRuns::Writer::add_term(std::string_view key, const Postings& postings)
+{
+    write_string(m_file, key);
+    write_varint(m_file, postings.size());
+
+    std::uint32_t last_id = 0;
+    for (const auto& [id, freq, positions] : postings)
+    {
+        write_varint(m_file, id - last_id);
+        write_varint(m_file, freq);
+        last_id = id;
+
+        write_varint(m_file, positions.size());
+        std::uint32_t last_position = 0;
+        for (std::uint32_t position : positions)
+        {
+            write_varint(m_file, position - last_position);
+            last_position = position;
+        }
+    }
+}
+
+bool
+SearchEngine::IndexRuns::Writer::close()
+{
+    m_file.seekp(sizeof(std::uint32_t));
+    write_raw(m_file, m_document_count);
+    m_file.close();
+
+    return !m_file.fail();
+}
+
+bool
+SearchEngine::IndexRuns::Reader::open(const std::string& filename)
+{
+    m_file.open(filename, std::ios::binary);
+    m_documents_read = 0;
+
+    std::uint32_t magic;
+    if (!read_raw(m_file, magic) || magic != RUN_MAGIC || !read_raw(m_file, m_document_count))
+    {
+        std::cerr << "ERROR: '" << filename << "' is not an index run\n";
+        return false;
+    }
+
+    return true;
+}
+
+std::uint64_t
+SearchEngine::IndexRuns::Reader::document_count()
+const noexcept
+{
+    return m_document_count;
+}
+
+bool
+SearchEngine::IndexRuns::Reader::next_document(Document& document)
+{
+    if (m_documents_read == m_document_count) return false;
+
+    ++m_documents_read;
+    return read_string(m_file, document.name)
+        && read_varint(m_file, document.length)
+        && read_varint(m_file, document.info.size)
+        && read_raw(m_file, document.info.mtime)
+        && read_raw(m_file, document.info.hash);
+}
+
+bool
+SearchEngine::IndexRuns::Reader::next_term(std::string& key, Postings& postings)
+{
+    // A run ends right after its last term
+    if (m_file.peek() == std::char_traits<char>::eof()) return false;
+
+    std::uint64_t count;
+    if (!read_string(m_file, key) || !read_varint(m_file, count)) return false;
+
+    postings.resize(count);
+
+    std::uint64_t id = 0;
+    for (Posting& posting : postings)
+    {
+        std::uint64_t gap, freq, position_count;
+        if (!read_varint(m_file, gap) || !read_varint(m_file, freq) || !read_varint(m_file, position_count)) return false;
+
+        id += gap;
+        posting.document_id = static_cast<std::uint32_t>(id);
+        posting.freq = static_cast<std::uint32_t>(freq);
+
+        posting.positions.resize(position_count);
+        std::uint64_t position = 0;
+        for (auto& value : posting.positions)
+        {
+            if (!read_varint(m_file, gap)) return false;
+
+            position += gap;
+            value = static_cast<std::uint32_t>(position);
+        }
+    }
+
+    return true;
+}
+
+SearchEngine::IndexRuns::IndexRuns(const std::string& directory, std::size_t dictionary_budget)
+    : m_directory(directory),
+      m_dictionary_budget(dictionary_budget),
+      m_next_run(0),
+      m_failed(false),
+      m_created(false)
+{
+}
+
+SearchEngine::IndexRuns::~IndexRuns()
+{
+    if (m_created)
+    {
+        std::error_code error;
+        std::filesystem::remove_all(m_directory, error);
+    }
+}
+
+bool
+SearchEngine::IndexRuns::create()
+{
+    // A new directory every time, so removing it never takes anything that was already there
+    std::string path = m_directory + ".XXXXXX";
+    if (mkdtemp(path.data()) == nullptr)
+    {
+        std::cerr << "ERROR: Could not create the runs directory '" << path << "': " << strerror(errno) << "\n";
+        return false;
+    }
+
+    m_directory = std::move(path);
+    m_created = true;
+
+    return true;
+}
+
+std::size_t
+SearchEngine::IndexRuns::size()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_runs.size();
+}
+
+std::string
+SearchEngine::IndexRuns::next_run_name()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::ostringstream name;
+    name << m_directory << "/run-" << std::setw(6) << std::setfill('0') << m_next_run++;
+    return name.str();
+}
+
+bool
+SearchEngine::IndexRuns::flush(Dictionary& dictionary)
+{
+    IndexingStats::Timer timer(IndexingStats::Stage::Write);
+
+    // Same numbering as build_inverted_index, by filename
+    std::vector<const Dictionary::FileMap::value_type*> files;
+    files.reserve(dictionary.m_file_map_ptr->size());
+    for (const auto& file : *dictionary.m_file_map_ptr)
+    {
+        files.push_back(&file);
+    }
+    std::sort(files.begin(), files.end(), [](const auto* a, const auto* b)
+    {
+        return a->first < b->first;
+    });
+
+    std::string run = next_run_name();
+    Writer writer;
+    if (!writer.open(run))
+    {
+        std::cerr << "ERROR: Could not write index run '" << run << "'\n";
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_failed = true;
+        return false;
+    }
+
+    std::unordered_map<Dictionary::TermId, Postings> inverted;
+    for (std::uint32_t id = 0; id < files.size(); ++id)
+    {
+        const auto& [filename, term_freq_map] = *files[id];
+
+        auto sequence = dictionary.m_sequence_map_ptr->find(filename);
+        Dictionary::TermPositionsMap positions = sequence != dictionary.m_sequence_map_ptr->end()
+            ? Dictionary::term_positions(sequence->second)
+            : Dictionary::TermPositionsMap {};
+
+        std::uint64_t length = 0;
+        for (const auto& [term, freq] : term_freq_map)
+        {
+            auto term_positions = positions.find(term);
+            inverted[term].push_back(
+            {
+                id,
+                freq,
+                term_positions != positions.end() ? std::move(term_positions->second) : Dictionary::Positions {}
+            });
+            length += freq;
+        }
+
+        auto info = dictionary.m_file_info_ptr->find(filename);
+        writer.add_document({ filename, length, info != dictionary.m_file_info_ptr->end() ? info->second : FileInfo {} });
+    }
+
+    std::vector<std::pair<std::string_view, Dictionary::TermId>> terms;
+    terms.reserve(inverted.size());
+    for (const auto& [term, _] : inverted)
+    {
+        terms.push_back({ dictionary.terms().term(term), term });
+    }
+    std::sort(terms.begin(), terms.end());
+
+    for (const auto& [key, term] : terms)
+    {
+        writer.add_term(key, inverted.at(term));
+    }
+
+    bool written = writer.close();
+    dictionary = Dictionary(dictionary.term_pool());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!written)
+    {
+        std::cerr << "ERROR: Could not write index run '" << run << "'\n";
+        m_failed = true;
+        return false;
+    }
+
+    m_runs.push_back(std::move(run));
+    return true;
+}
+
+bool
+SearchEngine::IndexRuns::flush_if_full(Dictionary& dictionary)
+{
+    if (dictionary.memory_usage() < m_dictionary_budget) return true;
+
+    return flush(dictionary);
+}
+
+bool
+SearchEngine::IndexRuns::merge(const std::vector<std::string>& runs,
+    const std::function<void(const Document&)>& on_document,
+    const std::function<void(const std::string&, const Postings&)>& on_term)
+{
+    using Head = std::pair<std::string, std::size_t>; // Next name or key, run
+    using Heap = std::priority_queue<Head, std::vector<Head>, std::greater<Head>>;
+
+    std::vector<Reader> readers(runs.size());
+    for (std::size_t i = 0; i < runs.size(); ++i)
+    {
+        if (!readers[i].open(runs[i])) return false;
+    }
+
+    // Every run lists its documents by name, so each run's ids map to increasing merged ids
+    std::vector<std::vector<std::uint32_t>> ids(runs.size());
+    std::vector<Document> documents(runs.size());
+    Heap heap;
+    for (std::size_t i = 0; i < readers.size(); ++i)
+    {
+        ids[i].reserve(readers[i].document_count());
+        if (readers[i].next_document(documents[i])) heap.push({ documents[i].name, i });
+    }
+
+    std::uint32_t next_id = 0;
+    while (!heap.empty())
+    {
+        std::size_t run = heap.top().second;
+        heap.pop();
+
+        on_document(documents[run]);
+        ids[run].push_back(next_id++);
+
+        if (readers[run].next_document(documents[run])) heap.push({ documents[run].name, run });
+    }
+
+    for (std::size_t i = 0; i < readers.size(); ++i)
+    {
+        if (ids[i].size() != readers[i].document_count())
+        {
+            std::cerr << "ERROR: Index run '" << runs[i] << "' is truncated\n";
+            return false;
+        }
+    }
+
+    std::vector<Postings> postings(runs.size());
+    std::string key;
+    for (std::size_t i = 0; i < readers.size(); ++i)
+    {
+        if (readers[i].next_term(key, postings[i])) heap.push({ key, i });
+    }
+
+    Postings merged;
+    while (!heap.empty())
+    {
+        key = heap.top().first;
+        merged.clear();
+
+        while (!heap.empty() && heap.top().first == key)
+        {
+            std::size_t run = heap.top().second;
+            heap.pop();
+
+            for (Posting& posting : postings[run])
+            {
+                merged.push_back({ ids[run][posting.document_id], posting.freq, std::move(posting.positions) });
+            }
+
+            std::string next_key;
+            if (readers[run].next_term(next_key, postings[run])) heap.push({ std::move(next_key), run });
+        }
+
+        std::sort(merged.begin(), merged.end(), [](const Posting& a, const Posting& b)
+        {
+            return a.document_id < b.document_id;
+        });
+        on_term(key, merged);
+    }
+
+    return true;
+}
+
+bool
+SearchEngine::IndexRuns::append_file(std::ofstream& out, const std::string& filename, std::uint64_t size)
+{
+    // Streaming an empty file would set the output's failbit
+    if (size == 0) return true;
+
+    std::ifstream input(filename, std::ios::binary);
+    out << input.rdbuf();
+    return static_cast<bool>(out);
+}
+
+bool
+SearchEngine::IndexRuns::merge_to_run(const std::vector<std::string>& runs, const std::string& run)
+{
+    Writer writer;
+    if (!writer.open(run))
+    {
+        std::cerr << "ERROR: Could not write index run '" << run << "'\n";
+        return false;
+    }
+
+    bool merged = merge(runs,
+        [&writer](const Document& document) { writer.add_document(document); },
+        [&writer](const std::string& key, const Postings& postings) { writer.add_term(key, postings); });
+
+    if (!writer.close())
+    {
+        std::cerr << "ERROR: Could not write index run '" << run << "'\n";
+        return false;
+    }
+
+    return merged;
+}
+
+bool
+SearchEngine::IndexRuns::merge_to(const std::string& output_filename)
+{
+    using namespace IndexFormat;
+
+    if (m_failed) return false;
+
+    IndexingStats::Timer merge_timer(IndexingStats::Stage::Merge);
+
+    while (m_runs.size() > RUNS_MERGE_FAN_IN)
+    {
+        std::vector<std::string> inputs(m_runs.begin(), m_runs.begin() + RUNS_MERGE_FAN_IN);
+        std::string run = next_run_name();
+        if (!merge_to_run(inputs, run)) return false;
+
+        for (const auto& input : inputs)
+        {
+            std::filesystem::remove(input);
+        }
+        m_runs.erase(m_runs.begin(), m_runs.begin() + RUNS_MERGE_FAN_IN);
+        m_runs.push_back(std::move(run));
+    }
+
+    // Documents & term records are small enough to keep, postings & positions go through scratch
+    // files since the term count, and so where postings start, is only known at the end
+    std::vector<DocumentRecord> documents;
+    std::vector<TermRecord> terms;
+    std::string document_names;
+    std::string term_keys;
+
+    const std::string postings_filename = m_directory + "/postings";
+    std::ofstream postings_file(postings_filename, std::ios::binary | std::ios::trunc);
+    std::uint64_t postings_size = 0;
+
+    const std::string positions_filename = m_directory + "/positions";
+    std::ofstream positions_file(positions_filename, std::ios::binary | std::ios::trunc);
+    std::uint64_t positions_size = 0;
+
+    std::vector<char> encoded;
+
+    bool merged = merge(m_runs,
+        [&documents, &document_names](const Document& document)
+        {
+            documents.push_back(
+            {
+                document_names.size(),
+                document.length,
+                document.info.size,
+                document.info.mtime,
+                document.info.hash,
+                static_cast<std::uint32_t>(document.name.size()),
+                0
+            });
+            document_names += document.name;
+        },
+        [&](const std::string& key, const Postings& postings)
+        {
+            PostingsEncoder encoder;
+            PositionsEncoder positions_encoder;
+            float max_tf = 0;
+            for (const auto& [id, freq, positions] : postings)
+            {
+                encoder.add(id, freq);
+                positions_encoder.add(positions.data(), positions.size());
+                max_tf = std::max(max_tf, static_cast<float>(freq) / static_cast<std::size_t>(documents[id].length));
+            }
+
+            float idf = Dictionary::idf(documents.size(), encoder.document_frequency());
+            terms.push_back(
+            {
+                term_keys.size(), // Made absolute once the document names are placed
+                postings_size,
+                positions_size,
+                static_cast<std::uint32_t>(key.size()),
+                encoder.document_frequency(),
+                idf,
+                max_tf * idf
+            });
+            term_keys += key;
+
+            encoded.assign(encoder.encoded_size(), 0);
+            encoder.write(encoded.data());
+            postings_file.write(encoded.data(), encoded.size());
+            postings_size += encoded.size();
+
+            encoded.assign(positions_encoder.encoded_size(), 0);
+            positions_encoder.write(encoded.data());
+            positions_file.write(encoded.data(), encoded.size());
+            positions_size += encoded.size();
+        });
+
+    postings_file.close();
+    positions_file.close();
+    if (!merged) return false;
+    if (postings_file.fail() || positions_file.fail())
+    {
+        std::cerr << "ERROR: Could not write '" << (postings_file.fail() ? postings_filename : positions_filename) << "'\n";
+        return false;
+    }
+
+    IndexingStats::Timer write_timer(IndexingStats::Stage::Write);
+
+    for (auto& term : terms)
+    {
+        term.key_offset += document_names.size();
+    }
+
+    auto align = [](std::uint64_t offset) { return (offset + 7) & ~std::uint64_t(7); };
+
+    Header header {};
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.document_count = documents.size();
+    header.term_count = terms.size();
+    header.postings_size = postings_size;
+    header.documents_offset = align(sizeof(Header));
+    header.terms_offset = align(header.documents_offset + header.document_count * sizeof(DocumentRecord));
+    header.postings_offset = align(header.terms_offset + header.term_count * sizeof(TermRecord));
+    header.positions_offset = align(header.postings_offset + header.postings_size);
+    header.positions_size = positions_size;
+    header.strings_offset = align(header.positions_offset + header.positions_size);
+    header.strings_size = document_names.size() + term_keys.size();
+
+    // Searches may have the old index mapped, it's replaced in one rename instead of rewritten in place
+    std::string temporary = output_filename + INDEX_TEMPORARY_SUFFIX;
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    std::uint64_t offset = sizeof(Header);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    pad(file, offset);
+    file.write(reinterpret_cast<const char*>(documents.data()), documents.size() * sizeof(DocumentRecord));
+    offset += documents.size() * sizeof(DocumentRecord);
+
+    pad(file, offset);
+    file.write(reinterpret_cast<const char*>(terms.data()), terms.size() * sizeof(TermRecord));
+    offset += terms.size() * sizeof(TermRecord);
+
+    pad(file, offset);
+    append_file(file, postings_filename, postings_size);
+    offset += postings_size;
+
+    pad(file, offset);
+    append_file(file, positions_filename, positions_size);
+    offset += positions_size;
+
+    pad(file, offset);
+    file.write(document_names.data(), document_names.size());
+    file.write(term_keys.data(), term_keys.size());
+    file.close();
+
+    if (!file)
+    {
+        std::cerr << "ERROR: Could not write index file '" << output_filename << "'\n";
+        std::remove(temporary.c_str());
+        return false;
+    }
+
+    if (std::rename(temporary.c_str(), output_filename.c_str()) != 0)
+    {
+        std::cerr << "ERROR: Could not replace index file '" << output_filename << "'\n";
+        std::remove(temporary.c_str());
+        return false;
+    }
+
+    return true;
+}
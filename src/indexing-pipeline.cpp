@@ -0,0 +1,388 @@
+#include "../includes/indexing-pipeline.hpp"
+#include "../includes/tokenizer.hpp"
+#include "../includes/indexing-stats.hpp"
+#include <iomanip>
+#include <thread>
+
+namespace
+{
+    const char* const QUEUE_NAMES[] = { "read -> extract", "extract -> tokenize", "tokenize -> accumulate" };
+    const char* const STAGE_NAMES[] = { "extract", "tokenize", "accumulate" };
+
+    enum Stage : std::size_t
+    {
+        EXTRACT,
+        TOKENIZE,
+        ACCUMULATE,
+    };
+
+    void
+    join_all(std::vector<std::thread>& threads)
+    {
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        threads.clear();
+    }
+}
+
+SearchEngine::IndexingPipeline::QueueBytes::QueueBytes(std::size_t limit)
+    : m_limit(limit),
+      m_bytes(0)
+{
+}
+
+void
+SearchEngine::IndexingPipeline::QueueBytes::reserve(std::size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_released.wait(lock, [this, bytes]() { return m_bytes == 0 || m_bytes + bytes <= m_limit; });
+    m_bytes += bytes;
+}
+
+void
+SearchEngine::IndexingPipeline::QueueBytes::release(std::size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bytes -= bytes;
+    }
+    m_released.notify_all();
+}
+
+SearchEngine::IndexingPipeline::IndexingPipeline(Dictionary::TermPoolPtr terms,
+    const Stages& stages,
+    std::size_t io_depth,
+    std::size_t queue_bytes,
+    ExtractText extract_text,
+    IndexRuns* runs)
+    : m_terms(std::move(terms)),
+      m_stages(stages),
+      m_io_depth(std::max<std::size_t>(io_depth, 1)),
+      m_extract_text(std::move(extract_text)),
+      m_runs(runs),
+      m_read_backend("none"),
+      m_read(PIPELINE_QUEUE_CAPACITY),
+      m_extracted(PIPELINE_QUEUE_CAPACITY),
+      m_tokenized(PIPELINE_QUEUE_CAPACITY),
+      m_read_bytes(std::max<std::size_t>(queue_bytes / 2, 1)),
+      m_extracted_bytes(std::max<std::size_t>(queue_bytes / 2, 1)),
+      m_monitor_stop(false),
+      m_samples(0),
+      m_depths {},
+      m_stage_times {}
+{
+    m_stages.extract = std::max<std::size_t>(m_stages.extract, 1);
+    m_stages.tokenize = std::max<std::size_t>(m_stages.tokenize, 1);
+    m_stages.accumulate = std::max<std::size_t>(m_stages.accumulate, 1);
+}
+
+SearchEngine::IndexingPipeline::Stages
+SearchEngine::IndexingPipeline::default_stages(std::size_t threads)
+{
+    Stages stages;
+    stages.extract = std::max<std::size_t>(threads / 4, 1);
+    stages.accumulate = std::max<std::size_t>(threads / 4, 1);
+    stages.tokenize = threads > stages.extract + stages.accumulate ? threads - stages.extract - stages.accumulate : 1;
+
+    return stages;
+}
+
+void
+SearchEngine::IndexingPipeline::extract_stage()
+{
+    auto started = std::chrono::steady_clock::now();
+    std::chrono::nanoseconds busy(0);
+
+    ReadFile file;
+    while (m_read.pop(file))
+    {
+        auto popped = std::chrono::steady_clock::now();
+        ExtractedFile extracted { std::move(file.filename), FileInfo {}, std::string(), {} };
+        std::string_view content(file.content.data(), file.content.size());
+
+        // The size comes from what was read, a file changed since then won't match its stat on the next update
+        {
+            IndexingStats::Timer timer(IndexingStats::Stage::Read);
+            FileInfo::stat(extracted.filename, extracted.info);
+            extracted.info.size = content.size();
+            extracted.info.hash = FileInfo::hash_content(content);
+        }
+
+        {
+            IndexingStats::Timer timer(IndexingStats::Stage::Parse);
+            m_extract_text(extracted.filename, content, [&extracted](std::string_view text)
+            {
+                extracted.text.append(text);
+                extracted.node_ends.push_back(extracted.text.size());
+            });
+        }
+
+        // The content is dropped before waiting for room for the text, so the two queues never wait on each other
+        FileReader::Buffer().swap(file.content);
+        m_read_bytes.release(extracted.info.size);
+
+        busy += std::chrono::steady_clock::now() - popped;
+        m_extracted_bytes.reserve(extracted.text.size());
+        m_extracted.push(std::move(extracted));
+    }
+
+    add_stage_time(EXTRACT, started, busy);
+}
+
+void
+SearchEngine::IndexingPipeline::tokenize_stage()
+{
+    auto started = std::chrono::steady_clock::now();
+    std::chrono::nanoseconds busy(0);
+
+    ExtractedFile file;
+    while (m_extracted.pop(file))
+    {
+        auto popped = std::chrono::steady_clock::now();
+        TokenizedFile tokenized { std::move(file.filename), file.info, {}, {} };
+
+        // Each text node ends any token in progress, as when tokenizing straight from the parser
+        {
+            IndexingStats::Timer timer(IndexingStats::Stage::Tokenize);
+            Tokenizer tokenizer;
+            std::string_view text(file.text);
+            std::size_t begin = 0;
+            for (std::size_t end : file.node_ends)
+            {
+                tokenizer.feed(text.substr(begin, end - begin), *m_terms, tokenized.term_freq_map, &tokenized.sequence);
+                tokenizer.flush(*m_terms, tokenized.term_freq_map, &tokenized.sequence);
+                begin = end;
+            }
+        }
+
+        m_extracted_bytes.release(file.text.size());
+        std::string().swap(file.text);
+
+        busy += std::chrono::steady_clock::now() - popped;
+        m_tokenized.push(std::move(tokenized));
+    }
+
+    add_stage_time(TOKENIZE, started, busy);
+}
+
+void
+SearchEngine::IndexingPipeline::accumulate_stage(Dictionary& dictionary)
+{
+    auto started = std::chrono::steady_clock::now();
+    std::chrono::nanoseconds busy(0);
+
+    TokenizedFile file;
+    while (m_tokenized.pop(file))
+    {
+        auto popped = std::chrono::steady_clock::now();
+        IndexingStats::Timer timer(IndexingStats::Stage::Merge);
+
+        std::size_t tokens = 0;
+        for (const auto& [term, freq] : file.term_freq_map)
+        {
+            dictionary.increase_term_occurrence(term);
+            tokens += freq;
+        }
+
+        IndexingStats::add(IndexingStats::Counter::Files, 1);
+        IndexingStats::add(IndexingStats::Counter::Bytes, file.info.size);
+        IndexingStats::add(IndexingStats::Counter::Tokens, tokens);
+
+        dictionary.insert_file({ std::move(file.filename), std::move(file.term_freq_map) }, file.info, std::move(file.sequence));
+
+        if (m_runs != nullptr)
+        {
+            m_runs->flush_if_full(dictionary);
+        }
+
+        busy += std::chrono::steady_clock::now() - popped;
+    }
+
+    add_stage_time(ACCUMULATE, started, busy);
+}
+
+void
+SearchEngine::IndexingPipeline::add_stage_time(std::size_t stage,
+    std::chrono::steady_clock::time_point started,
+    std::chrono::nanoseconds busy)
+{
+    std::chrono::nanoseconds total = std::chrono::steady_clock::now() - started;
+    m_stage_times[stage].busy.fetch_add(busy.count(), std::memory_order_relaxed);
+    m_stage_times[stage].total.fetch_add(total.count(), std::memory_order_relaxed);
+}
+
+std::array<std::size_t, SearchEngine::IndexingPipeline::QUEUES>
+SearchEngine::IndexingPipeline::depths()
+const noexcept
+{
+    return { m_read.size(), m_extracted.size(), m_tokenized.size() };
+}
+
+void
+SearchEngine::IndexingPipeline::monitor()
+{
+    std::unique_lock<std::mutex> lock(m_monitor_mutex);
+    while (!m_monitor_wakeup.wait_for(lock, PIPELINE_SAMPLE_INTERVAL, [this]() { return m_monitor_stop; }))
+    {
+        std::array<std::size_t, QUEUES> current = depths();
+        for (std::size_t i = 0; i < QUEUES; ++i)
+        {
+            m_depths[i].total += current[i];
+            m_depths[i].max = std::max(m_depths[i].max, current[i]);
+        }
+        ++m_samples;
+    }
+}
+
+SearchEngine::Dictionary
+SearchEngine::IndexingPipeline::run(const FileReader::FileSource& next_file)
+{
+    m_dictionaries.clear();
+    for (std::size_t i = 0; i < m_stages.accumulate; ++i)
+    {
+        m_dictionaries.emplace_back(m_terms);
+    }
+
+    std::thread monitor_thread(&IndexingPipeline::monitor, this);
+
+    std::vector<std::thread> extractors;
+    std::vector<std::thread> tokenizers;
+    std::vector<std::thread> accumulators;
+    for (std::size_t i = 0; i < m_stages.extract; ++i)
+    {
+        extractors.emplace_back(&IndexingPipeline::extract_stage, this);
+    }
+    for (std::size_t i = 0; i < m_stages.tokenize; ++i)
+    {
+        tokenizers.emplace_back(&IndexingPipeline::tokenize_stage, this);
+    }
+    for (Dictionary& dictionary : m_dictionaries)
+    {
+        accumulators.emplace_back([this, &dictionary]() { accumulate_stage(dictionary); });
+    }
+
+    // The calling thread drives the reads, a buffer is held back by the queue once it's in there
+    FileReader reader(m_io_depth);
+    reader.read_all(next_file, [this, &reader](std::string&& filename, FileReader::Buffer&& content)
+    {
+        m_read_bytes.reserve(content.size());
+        m_read.push({ std::move(filename), std::move(content) });
+        reader.release();
+    });
+    m_read_backend = reader.backend();
+
+    // A queue is closed once every thread pushing into it is done
+    m_read.close();
+    join_all(extractors);
+    m_extracted.close();
+    join_all(tokenizers);
+    m_tokenized.close();
+    join_all(accumulators);
+
+    {
+        std::lock_guard<std::mutex> lock(m_monitor_mutex);
+        m_monitor_stop = true;
+    }
+    m_monitor_wakeup.notify_one();
+    monitor_thread.join();
+
+    // Merging is order independent, so the result is deterministic. The pairs of a level are
+    // merged on their own threads, joined before the next level
+    IndexingStats::Timer timer(IndexingStats::Stage::Merge);
+    std::vector<std::thread> mergers;
+    for (std::size_t stride = 1; stride < m_dictionaries.size(); stride *= 2)
+    {
+        for (std::size_t i = 0; i + stride < m_dictionaries.size(); i += 2 * stride)
+        {
+            mergers.emplace_back([this, i, stride]()
+            {
+                m_dictionaries[i].merge(std::move(m_dictionaries[i + stride]));
+            });
+        }
+        join_all(mergers);
+    }
+
+    Dictionary dictionary = std::move(m_dictionaries.front());
+    m_dictionaries.clear();
+    return dictionary;
+}
+
+std::vector<SearchEngine::IndexingPipeline::QueueStats>
+SearchEngine::IndexingPipeline::queue_stats()
+const
+{
+    std::lock_guard<std::mutex> lock(m_monitor_mutex);
+
+    const std::array<std::size_t, QUEUES> capacities = { m_read.capacity(), m_extracted.capacity(), m_tokenized.capacity() };
+    const std::array<std::uint64_t, QUEUES> full_waits = { m_read.full_waits(), m_extracted.full_waits(), m_tokenized.full_waits() };
+    const std::array<std::uint64_t, QUEUES> empty_waits = { m_read.empty_waits(), m_extracted.empty_waits(), m_tokenized.empty_waits() };
+
+    std::vector<QueueStats> stats;
+    for (std::size_t i = 0; i < QUEUES; ++i)
+    {
+        stats.push_back(
+        {
+            QUEUE_NAMES[i],
+            capacities[i],
+            m_samples > 0 ? static_cast<double>(m_depths[i].total) / m_samples : 0.0,
+            m_depths[i].max,
+            full_waits[i],
+            empty_waits[i]
+        });
+    }
+
+    return stats;
+}
+
+std::vector<SearchEngine::IndexingPipeline::StageStats>
+SearchEngine::IndexingPipeline::stage_stats()
+const
+{
+    const std::array<std::size_t, STAGES> threads = { m_stages.extract, m_stages.tokenize, m_stages.accumulate };
+
+    std::vector<StageStats> stats;
+    for (std::size_t i = 0; i < STAGES; ++i)
+    {
+        std::chrono::nanoseconds busy(m_stage_times[i].busy.load(std::memory_order_relaxed));
+        std::chrono::nanoseconds total(m_stage_times[i].total.load(std::memory_order_relaxed));
+        stats.push_back({ STAGE_NAMES[i], threads[i], busy, total - busy });
+    }
+
+    return stats;
+}
+
+void
+SearchEngine::IndexingPipeline::print(std::ostream& out)
+const
+{
+    out << "Pipeline: read with " << m_read_backend << " (depth " << m_io_depth << "), "
+        << m_stages.extract << " extract, "
+        << m_stages.tokenize << " tokenize, "
+        << m_stages.accumulate << " accumulate threads\n";
+
+    out << std::fixed << std::setprecision(1);
+    for (const QueueStats& queue : queue_stats())
+    {
+        out << "Queue " << std::left << std::setw(24) << queue.name << std::right
+            << " depth " << queue.mean_depth << " avg, "
+            << queue.max_depth << " max of " << queue.capacity << ", "
+            << queue.full_waits << " full waits, "
+            << queue.empty_waits << " empty waits\n";
+    }
+
+    // Idle time is spent waiting on an empty queue before the stage or a full one after it
+    for (const StageStats& stage : stage_stats())
+    {
+        auto busy = std::chrono::duration_cast<std::chrono::milliseconds>(stage.busy);
+        auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(stage.idle);
+        auto total = std::max<std::int64_t>((stage.busy + stage.idle).count(), 1);
+
+        out << "Stage " << std::left << std::setw(24) << stage.name << std::right
+            << " " << stage.threads << " threads, busy "
+            << busy.count() << "ms (" << 100.0 * stage.busy.count() / total << "%), idle "
+            << idle.count() << "ms\n";
+    }
+    out << std::defaultfloat;
+}
@@ -0,0 +1,199 @@
+#include "../includes/indexing-stats.hpp"
+#include <iomanip>
+#include <sys/resource.h>
+
+namespace
+{
+    const char* const STAGE_NAMES[] = { "walk", "read", "parse", "tokenize", "stem", "merge", "write" };
+    static_assert(sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0]) == static_cast<std::size_t>(SearchEngine::IndexingStats::Stage::Count));
+
+    template <typename T>
+    inline void
+    increase(std::atomic<T>& value, T amount)
+    noexcept
+    {
+        // Only the owning thread writes its slot, so there's no need for a locked add
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+}
+
+thread_local SearchEngine::IndexingStats::Timer* SearchEngine::IndexingStats::Timer::s_current = nullptr;
+
+std::mutex SearchEngine::IndexingStats::s_mutex;
+std::vector<SearchEngine::IndexingStats::Slot*> SearchEngine::IndexingStats::s_slots;
+SearchEngine::IndexingStats::Totals SearchEngine::IndexingStats::s_retired {};
+std::chrono::steady_clock::time_point SearchEngine::IndexingStats::s_started_at = std::chrono::steady_clock::now();
+
+SearchEngine::IndexingStats::Timer::Timer(Stage stage)
+    : m_stage(stage),
+      m_parent(s_current),
+      m_start(std::chrono::steady_clock::now()),
+      m_nested(0)
+{
+    s_current = this;
+}
+
+SearchEngine::IndexingStats::Timer::~Timer()
+{
+    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - m_start;
+    IndexingStats::add(m_stage, elapsed - m_nested);
+
+    if (m_parent != nullptr)
+    {
+        m_parent->m_nested += elapsed;
+    }
+    s_current = m_parent;
+}
+
+SearchEngine::IndexingStats::ThreadSlot::ThreadSlot()
+{
+    clear(slot);
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_slots.push_back(&slot);
+}
+
+SearchEngine::IndexingStats::ThreadSlot::~ThreadSlot()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (std::size_t i = 0; i < slot.times.size(); ++i)
+    {
+        s_retired.times[i] += std::chrono::nanoseconds(slot.times[i].load(std::memory_order_relaxed));
+    }
+    for (std::size_t i = 0; i < slot.counts.size(); ++i)
+    {
+        s_retired.counts[i] += slot.counts[i].load(std::memory_order_relaxed);
+    }
+
+    s_slots.erase(std::find(s_slots.begin(), s_slots.end(), &slot));
+}
+
+SearchEngine::IndexingStats::Slot&
+SearchEngine::IndexingStats::thread_slot()
+{
+    thread_local ThreadSlot thread_slot;
+    return thread_slot.slot;
+}
+
+void
+SearchEngine::IndexingStats::clear(Slot& slot)
+noexcept
+{
+    for (auto& time : slot.times) time.store(0, std::memory_order_relaxed);
+    for (auto& count : slot.counts) count.store(0, std::memory_order_relaxed);
+}
+
+void
+SearchEngine::IndexingStats::add(Stage stage, std::chrono::nanoseconds time)
+noexcept
+{
+    increase<std::int64_t>(thread_slot().times[static_cast<std::size_t>(stage)], time.count());
+}
+
+void
+SearchEngine::IndexingStats::add(Counter counter, std::uint64_t count)
+noexcept
+{
+    increase<std::uint64_t>(thread_slot().counts[static_cast<std::size_t>(counter)], count);
+}
+
+void
+SearchEngine::IndexingStats::reset()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (Slot* slot : s_slots)
+    {
+        clear(*slot);
+    }
+
+    s_retired = Totals {};
+    s_started_at = std::chrono::steady_clock::now();
+}
+
+SearchEngine::IndexingStats::Totals
+SearchEngine::IndexingStats::totals()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+
+    Totals totals = s_retired;
+    for (const Slot* slot : s_slots)
+    {
+        for (std::size_t i = 0; i < totals.times.size(); ++i)
+        {
+            totals.times[i] += std::chrono::nanoseconds(slot->times[i].load(std::memory_order_relaxed));
+        }
+        for (std::size_t i = 0; i < totals.counts.size(); ++i)
+        {
+            totals.counts[i] += slot->counts[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    return totals;
+}
+
+std::chrono::nanoseconds
+SearchEngine::IndexingStats::elapsed()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return std::chrono::steady_clock::now() - s_started_at;
+}
+
+std::size_t
+SearchEngine::IndexingStats::peak_memory()
+noexcept
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+
+    // Linux reports kilobytes
+    return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+}
+
+void
+SearchEngine::IndexingStats::print_table(std::ostream& out)
+{
+    Totals totals = IndexingStats::totals();
+    double wall = std::chrono::duration<double>(elapsed()).count();
+
+    std::chrono::nanoseconds busy(0);
+    for (const auto& time : totals.times) busy += time;
+    double busy_ms = std::max(std::chrono::duration<double, std::milli>(busy).count(), 1e-9);
+
+    // Stage times are summed over every thread, so they can add up to more than the wall time
+    out << std::fixed << std::setprecision(1)
+        << std::left << std::setw(12) << "Stage" << std::right << std::setw(14) << "Thread ms" << std::setw(10) << "Share" << "\n";
+    for (std::size_t i = 0; i < totals.times.size(); ++i)
+    {
+        double ms = std::chrono::duration<double, std::milli>(totals.times[i]).count();
+        out << std::left << std::setw(12) << STAGE_NAMES[i] << std::right
+            << std::setw(14) << ms
+            << std::setw(9) << 100.0 * ms / busy_ms << "%\n";
+    }
+
+    std::uint64_t files = totals.counts[static_cast<std::size_t>(Counter::Files)];
+    std::uint64_t bytes = totals.counts[static_cast<std::size_t>(Counter::Bytes)];
+    std::uint64_t tokens = totals.counts[static_cast<std::size_t>(Counter::Tokens)];
+    out << "Wall time: " << wall * 1000 << "ms, "
+        << files << " files, "
+        << bytes / 1048576.0 << "MB (" << bytes / 1048576.0 / wall << "MB/s), "
+        << tokens << " tokens (" << tokens / wall << " tokens/s), "
+        << "peak memory " << peak_memory() / 1048576.0 << "MB\n"
+        << std::defaultfloat;
+}
+
+void
+SearchEngine::IndexingStats::print_json(std::ostream& out)
+{
+    Totals totals = IndexingStats::totals();
+
+    out << "{\"wall_ns\": " << elapsed().count() << ", \"stages_ns\": {";
+    for (std::size_t i = 0; i < totals.times.size(); ++i)
+    {
+        out << (i == 0 ? "" : ", ") << "\"" << STAGE_NAMES[i] << "\": " << totals.times[i].count();
+    }
+
+    out << "}, \"files\": " << totals.counts[static_cast<std::size_t>(Counter::Files)]
+        << ", \"bytes\": " << totals.counts[static_cast<std::size_t>(Counter::Bytes)]
+        << ", \"tokens\": " << totals.counts[static_cast<std::size_t>(Counter::Tokens)]
+        << ", \"peak_memory_bytes\": " << peak_memory() << "}\n";
+}
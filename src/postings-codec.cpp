@@ -0,0 +1,424 @@
+#include "../includes/postings-codec.hpp"
+
+namespace
+{
+    constexpr std::size_t LANE_SIZE = POSTINGS_BLOCK_SIZE / POSTINGS_LANES;
+
+    inline std::uint32_t
+    bits_needed(const std::uint32_t* values, std::size_t count)
+    noexcept
+    {
+        std::uint32_t all = 0;
+        for (std::size_t i = 0; i < count; ++i) all |= values[i];
+
+        return all == 0 ? 0 : 32 - __builtin_clz(all);
+    }
+
+    inline std::size_t
+    packed_size(std::uint32_t bits)
+    noexcept
+    {
+        return POSTINGS_BLOCK_SIZE * bits / 8;
+    }
+
+    // Value i goes to lane i % POSTINGS_LANES, each lane is a little-endian bit stream
+    // whose k-th word is stored at k * POSTINGS_LANES + lane
+    void
+    pack(const std::uint32_t* values, std::uint32_t bits, std::uint8_t* out)
+    noexcept
+    {
+        if (bits == 0) return;
+
+        std::vector<std::uint32_t> words(POSTINGS_LANES * bits, 0);
+        for (std::size_t lane = 0; lane < POSTINGS_LANES; ++lane)
+        {
+            for (std::size_t i = 0; i < LANE_SIZE; ++i)
+            {
+                std::uint32_t value = values[i * POSTINGS_LANES + lane];
+                std::size_t bit = i * bits;
+                std::size_t word = bit / 32;
+                std::size_t shift = bit % 32;
+
+                words[word * POSTINGS_LANES + lane] |= value << shift;
+                if (shift + bits > 32)
+                {
+                    words[(word + 1) * POSTINGS_LANES + lane] |= value >> (32 - shift);
+                }
+            }
+        }
+
+        std::memcpy(out, words.data(), words.size() * sizeof(std::uint32_t));
+    }
+
+    void
+    unpack(const std::uint8_t* in, std::uint32_t bits, std::uint32_t* values)
+    noexcept
+    {
+        if (bits == 0)
+        {
+            std::fill(values, values + POSTINGS_BLOCK_SIZE, 0);
+            return;
+        }
+
+        const std::uint32_t mask = bits == 32 ? ~0u : (1u << bits) - 1;
+
+#if POSTINGS_CODEC_SSE2
+        // All four lanes are decoded at once and land in the original order
+        const __m128i lane_mask = _mm_set1_epi32(static_cast<int>(mask));
+        const __m128i* words = reinterpret_cast<const __m128i*>(in);
+        __m128i current = _mm_loadu_si128(words);
+        std::size_t word = 0;
+        for (std::size_t i = 0; i < LANE_SIZE; ++i)
+        {
+            std::size_t bit = i * bits;
+            std::size_t shift = bit % 32;
+            if (bit / 32 != word)
+            {
+                word = bit / 32;
+                current = _mm_loadu_si128(words + word);
+            }
+
+            __m128i value = _mm_srl_epi32(current, _mm_cvtsi32_si128(static_cast<int>(shift)));
+            if (shift + bits > 32)
+            {
+                __m128i following = _mm_loadu_si128(words + word + 1);
+                value = _mm_or_si128(value, _mm_sll_epi32(following, _mm_cvtsi32_si128(static_cast<int>(32 - shift))));
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i * POSTINGS_LANES), _mm_and_si128(value, lane_mask));
+        }
+#else
+        std::uint32_t words[POSTINGS_LANES * 32];
+        std::memcpy(words, in, POSTINGS_LANES * bits * sizeof(std::uint32_t));
+
+        for (std::size_t i = 0; i < LANE_SIZE; ++i)
+        {
+            std::size_t bit = i * bits;
+            std::size_t word = bit / 32;
+            std::size_t shift = bit % 32;
+
+            for (std::size_t lane = 0; lane < POSTINGS_LANES; ++lane)
+            {
+                std::uint32_t value = words[word * POSTINGS_LANES + lane] >> shift;
+                if (shift + bits > 32)
+                {
+                    value |= words[(word + 1) * POSTINGS_LANES + lane] << (32 - shift);
+                }
+                values[i * POSTINGS_LANES + lane] = value & mask;
+            }
+        }
+#endif
+    }
+
+    inline void
+    write_varint(std::vector<std::uint8_t>& out, std::uint32_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<std::uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<std::uint8_t>(value));
+    }
+
+    inline std::uint32_t
+    read_varint(const std::uint8_t*& in)
+    noexcept
+    {
+        std::uint32_t value = 0;
+        for (unsigned shift = 0;; shift += 7)
+        {
+            std::uint8_t byte = *in++;
+            value |= static_cast<std::uint32_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+    }
+}
+
+SearchEngine::PostingsEncoder::PostingsEncoder()
+    : m_tail_offset(0),
+      m_document_frequency(0),
+      m_last_id(0)
+{
+}
+
+void
+SearchEngine::PostingsEncoder::add(std::uint32_t id, std::uint32_t freq)
+{
+    std::uint32_t gap = m_document_frequency % POSTINGS_BLOCK_SIZE == 0
+        ? id - (m_skips.empty() ? 0 : m_skips.back().last_document_id + 1)
+        : id - m_last_id - 1;
+
+    write_varint(m_data, gap);
+    write_varint(m_data, freq - 1);
+    m_last_id = id;
+
+    if (++m_document_frequency % POSTINGS_BLOCK_SIZE == 0)
+    {
+        pack_tail();
+    }
+}
+
+void
+SearchEngine::PostingsEncoder::pack_tail()
+{
+    // A full tail is decoded back & replaced by its packed block
+    std::uint32_t gaps[POSTINGS_BLOCK_SIZE];
+    std::uint32_t freqs[POSTINGS_BLOCK_SIZE];
+    const std::uint8_t* in = m_data.data() + m_tail_offset;
+    for (std::size_t i = 0; i < POSTINGS_BLOCK_SIZE; ++i)
+    {
+        gaps[i] = read_varint(in);
+        freqs[i] = read_varint(in);
+    }
+
+    IndexFormat::SkipEntry skip {};
+    skip.last_document_id = m_last_id;
+    skip.offset = m_tail_offset;
+    skip.document_bits = bits_needed(gaps, POSTINGS_BLOCK_SIZE);
+    skip.freq_bits = bits_needed(freqs, POSTINGS_BLOCK_SIZE);
+
+    m_data.resize(m_tail_offset + packed_size(skip.document_bits) + packed_size(skip.freq_bits));
+    pack(gaps, skip.document_bits, m_data.data() + m_tail_offset);
+    pack(freqs, skip.freq_bits, m_data.data() + m_tail_offset + packed_size(skip.document_bits));
+
+    m_tail_offset = m_data.size();
+    m_skips.push_back(skip);
+}
+
+std::uint32_t
+SearchEngine::PostingsEncoder::document_frequency()
+const noexcept
+{
+    return m_document_frequency;
+}
+
+std::size_t
+SearchEngine::PostingsEncoder::encoded_size()
+const noexcept
+{
+    std::size_t size = m_skips.size() * sizeof(IndexFormat::SkipEntry) + m_data.size();
+    return (size + 3) & ~std::size_t(3);
+}
+
+void
+SearchEngine::PostingsEncoder::write(char* out)
+const
+{
+    if (!m_skips.empty())
+    {
+        std::memcpy(out, m_skips.data(), m_skips.size() * sizeof(IndexFormat::SkipEntry));
+        out += m_skips.size() * sizeof(IndexFormat::SkipEntry);
+    }
+
+    if (!m_data.empty())
+    {
+        std::memcpy(out, m_data.data(), m_data.size());
+    }
+}
+
+SearchEngine::PositionsEncoder::PositionsEncoder()
+    : m_count(0)
+{
+}
+
+void
+SearchEngine::PositionsEncoder::add(const std::uint32_t* positions, std::size_t count)
+{
+    if (m_count++ % POSTINGS_BLOCK_SIZE == 0)
+    {
+        m_block_offsets.push_back(m_data.size());
+    }
+
+    write_varint(m_data, count);
+
+    std::uint32_t last = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        write_varint(m_data, positions[i] - last);
+        last = positions[i];
+    }
+}
+
+std::size_t
+SearchEngine::PositionsEncoder::encoded_size()
+const noexcept
+{
+    std::size_t size = m_block_offsets.size() * sizeof(std::uint32_t) + m_data.size();
+    return (size + 3) & ~std::size_t(3);
+}
+
+void
+SearchEngine::PositionsEncoder::write(char* out)
+const
+{
+    if (!m_block_offsets.empty())
+    {
+        std::memcpy(out, m_block_offsets.data(), m_block_offsets.size() * sizeof(std::uint32_t));
+        out += m_block_offsets.size() * sizeof(std::uint32_t);
+    }
+
+    if (!m_data.empty())
+    {
+        std::memcpy(out, m_data.data(), m_data.size());
+    }
+}
+
+SearchEngine::PositionsReader::PositionsReader()
+    : m_block_offsets(nullptr),
+      m_data(nullptr),
+      m_next(nullptr),
+      m_next_ordinal(0)
+{
+}
+
+SearchEngine::PositionsReader::PositionsReader(const char* positions, std::uint32_t document_frequency)
+    : m_block_offsets(reinterpret_cast<const std::uint32_t*>(positions)),
+      m_data(reinterpret_cast<const std::uint8_t*>(positions)
+          + (document_frequency + POSTINGS_BLOCK_SIZE - 1) / POSTINGS_BLOCK_SIZE * sizeof(std::uint32_t)),
+      m_next(nullptr),
+      m_next_ordinal(0)
+{
+}
+
+void
+SearchEngine::PositionsReader::read(std::uint32_t ordinal, std::vector<std::uint32_t>& positions)
+{
+    const std::uint8_t* in = m_next;
+    std::uint32_t i = m_next_ordinal;
+    if (in == nullptr || ordinal < i || ordinal / POSTINGS_BLOCK_SIZE != i / POSTINGS_BLOCK_SIZE)
+    {
+        in = m_data + m_block_offsets[ordinal / POSTINGS_BLOCK_SIZE];
+        i = ordinal / POSTINGS_BLOCK_SIZE * POSTINGS_BLOCK_SIZE;
+    }
+
+    // Earlier postings of the block are skipped without keeping their positions
+    for (; i < ordinal; ++i)
+    {
+        for (std::uint32_t count = read_varint(in); count > 0; --count)
+        {
+            read_varint(in);
+        }
+    }
+
+    positions.resize(read_varint(in));
+
+    std::uint32_t position = 0;
+    for (auto& value : positions)
+    {
+        position += read_varint(in);
+        value = position;
+    }
+
+    m_next = in;
+    m_next_ordinal = ordinal + 1;
+}
+
+SearchEngine::PostingCursor::PostingCursor()
+    : m_skips(nullptr),
+      m_blocks(nullptr),
+      m_document_frequency(0),
+      m_full_blocks(0),
+      m_block_count(0),
+      m_block(0),
+      m_size(0),
+      m_position(0)
+{
+}
+
+SearchEngine::PostingCursor::PostingCursor(const char* postings, std::uint32_t document_frequency)
+    : m_skips(reinterpret_cast<const IndexFormat::SkipEntry*>(postings)),
+      m_blocks(reinterpret_cast<const std::uint8_t*>(postings) + document_frequency / POSTINGS_BLOCK_SIZE * sizeof(IndexFormat::SkipEntry)),
+      m_document_frequency(document_frequency),
+      m_full_blocks(document_frequency / POSTINGS_BLOCK_SIZE),
+      m_block_count((document_frequency + POSTINGS_BLOCK_SIZE - 1) / POSTINGS_BLOCK_SIZE),
+      m_block(0),
+      m_size(0),
+      m_position(0)
+{
+    if (m_block_count > 0)
+    {
+        decode_block(0);
+    }
+}
+
+void
+SearchEngine::PostingCursor::decode_block(std::uint32_t block)
+{
+    std::uint32_t base = block == 0 ? 0 : m_skips[block - 1].last_document_id + 1;
+    m_block = block;
+    m_position = 0;
+
+    if (block < m_full_blocks)
+    {
+        const IndexFormat::SkipEntry& skip = m_skips[block];
+        const std::uint8_t* in = m_blocks + skip.offset;
+        unpack(in, skip.document_bits, m_ids);
+        unpack(in + packed_size(skip.document_bits), skip.freq_bits, m_freqs);
+
+        std::uint32_t id = base - 1;
+        for (std::size_t i = 0; i < POSTINGS_BLOCK_SIZE; ++i)
+        {
+            id += m_ids[i] + 1;
+            m_ids[i] = id;
+            m_freqs[i] += 1;
+        }
+
+        m_size = POSTINGS_BLOCK_SIZE;
+        return;
+    }
+
+    // The tail starts right after the last full block
+    const std::uint8_t* in = m_blocks;
+    if (m_full_blocks > 0)
+    {
+        const IndexFormat::SkipEntry& last = m_skips[m_full_blocks - 1];
+        in += last.offset + packed_size(last.document_bits) + packed_size(last.freq_bits);
+    }
+
+    std::uint32_t count = m_document_frequency - m_full_blocks * POSTINGS_BLOCK_SIZE;
+
+    std::uint32_t id = base - 1;
+    for (std::uint32_t i = 0; i < count; ++i)
+    {
+        id += read_varint(in) + 1;
+        m_ids[i] = id;
+        m_freqs[i] = read_varint(in) + 1;
+    }
+
+    m_size = count;
+}
+
+void
+SearchEngine::PostingCursor::advance_to(std::uint32_t id)
+{
+    if (at_end() || m_ids[m_position] >= id) return;
+
+    if (m_ids[m_size - 1] < id)
+    {
+        if (m_block + 1 >= m_block_count)
+        {
+            m_position = m_size;
+            return;
+        }
+
+        // First later full block that can hold `id`, or the tail
+        const IndexFormat::SkipEntry* skip = std::lower_bound(m_skips + m_block + 1, m_skips + m_full_blocks, id,
+            [](const IndexFormat::SkipEntry& entry, std::uint32_t id) { return entry.last_document_id < id; });
+
+        std::uint32_t block = skip - m_skips;
+        if (block >= m_block_count)
+        {
+            m_position = m_size;
+            return;
+        }
+
+        decode_block(block);
+    }
+
+    m_position = std::lower_bound(m_ids + m_position, m_ids + m_size, id) - m_ids;
+    if (m_position == m_size && m_block + 1 < m_block_count)
+    {
+        decode_block(m_block + 1);
+    }
+}
@@ -0,0 +1,119 @@
+#include "../includes/query-cache.hpp"
+
+SearchEngine::QueryCache::QueryCache(std::size_t capacity)
+    : m_capacity(capacity),
+      m_size(0),
+      m_generation(0),
+      m_hits(0),
+      m_misses(0)
+{
+}
+
+std::string
+SearchEngine::QueryCache::make_key(const std::list<std::string>& tokens)
+{
+    // Duplicates are kept, a repeated token weighs twice in the score
+    std::vector<std::string_view> sorted(tokens.begin(), tokens.end());
+    std::sort(sorted.begin(), sorted.end());
+
+    std::string key;
+    for (std::string_view token : sorted)
+    {
+        key.append(token);
+        key.push_back(' ');
+    }
+
+    return key;
+}
+
+std::size_t
+SearchEngine::QueryCache::estimate_size(const std::string& key, const Results& results)
+noexcept
+{
+    // Both copies of the key, the list & map nodes, then one list node per result
+    std::size_t size = sizeof(Entry) + 2 * key.capacity() + 4 * sizeof(void*);
+    for (const auto& [filename, _] : results)
+    {
+        size += sizeof(Result) + 2 * sizeof(void*) + filename.capacity();
+    }
+
+    return size;
+}
+
+bool
+SearchEngine::QueryCache::find(const std::string& key, Results& results)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_entries_by_key.find(key);
+    if (found == m_entries_by_key.end())
+    {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    m_entries.splice(m_entries.begin(), m_entries, found->second);
+    results = found->second->results;
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+
+    return true;
+}
+
+void
+SearchEngine::QueryCache::insert(const std::string& key, const Results& results, std::uint64_t generation)
+{
+    std::size_t bytes = estimate_size(key, results);
+    if (bytes > m_capacity) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (generation != m_generation || m_entries_by_key.find(key) != m_entries_by_key.end()) return;
+
+    while (m_size + bytes > m_capacity)
+    {
+        Entry& oldest = m_entries.back();
+        m_size -= oldest.bytes;
+        m_entries_by_key.erase(oldest.key);
+        m_entries.pop_back();
+    }
+
+    m_entries.push_front({ key, results, bytes });
+    m_entries_by_key.insert({ key, m_entries.begin() });
+    m_size += bytes;
+}
+
+void
+SearchEngine::QueryCache::set_generation(std::uint64_t generation)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (generation == m_generation) return;
+
+    m_generation = generation;
+    m_entries_by_key.clear();
+    m_entries.clear();
+    m_size = 0;
+}
+
+void
+SearchEngine::QueryCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_entries_by_key.clear();
+    m_entries.clear();
+    m_size = 0;
+}
+
+std::size_t
+SearchEngine::QueryCache::hits()
+const noexcept
+{
+    return m_hits.load(std::memory_order_relaxed);
+}
+
+std::size_t
+SearchEngine::QueryCache::misses()
+const noexcept
+{
+    return m_misses.load(std::memory_order_relaxed);
+}
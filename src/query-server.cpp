@@ -0,0 +1,388 @@
+#include "../includes/query-server.hpp"
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace
+{
+    // epoll ids below FIRST_CONNECTION are the server's own descriptors
+    constexpr std::uint64_t LISTEN_ID = 0;
+    constexpr std::uint64_t WAKEUP_ID = 1;
+    constexpr std::uint64_t SIGNAL_ID = 2;
+    constexpr std::uint64_t FIRST_CONNECTION = 3;
+
+    bool
+    make_address(const std::string& socket_path, sockaddr_un& address)
+    {
+        if (socket_path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "ERROR: Socket path '" << socket_path << "' is too long\n";
+            return false;
+        }
+
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+        return true;
+    }
+
+    // A socket file nobody accepts on is left over from a server that didn't exit cleanly
+    bool
+    is_stale_socket(const sockaddr_un& address)
+    {
+        struct stat info;
+        if (stat(address.sun_path, &info) != 0) return false;
+        if (!S_ISSOCK(info.st_mode)) return false;
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+
+        bool stale = connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+            && errno == ECONNREFUSED;
+        close(fd);
+
+        return stale;
+    }
+}
+
+SearchEngine::QueryServer::QueryServer(Handler handler, std::size_t threads)
+    : m_handler(std::move(handler)),
+      m_threads(threads),
+      m_listen_fd(-1),
+      m_epoll_fd(-1),
+      m_wakeup_fd(-1),
+      m_signal_fd(-1),
+      m_next_connection(FIRST_CONNECTION)
+{
+}
+
+bool
+SearchEngine::QueryServer::watch(int fd, std::uint64_t id, std::uint32_t events, bool modify)
+{
+    epoll_event event {};
+    event.events = events;
+    event.data.u64 = id;
+
+    return epoll_ctl(m_epoll_fd, modify ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+bool
+SearchEngine::QueryServer::listen(const std::string& socket_path)
+{
+    sockaddr_un address;
+    if (!make_address(socket_path, address)) return false;
+
+    if (is_stale_socket(address))
+    {
+        unlink(address.sun_path);
+    }
+
+    m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listen_fd < 0
+        || bind(m_listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        std::cerr << "ERROR: Could not bind '" << socket_path << "': " << strerror(errno) << "\n";
+        return false;
+    }
+    m_socket_path = socket_path;
+
+    if (::listen(m_listen_fd, SERVER_LISTEN_BACKLOG) != 0)
+    {
+        std::cerr << "ERROR: Could not listen on '" << socket_path << "': " << strerror(errno) << "\n";
+        return false;
+    }
+
+    // Signals are blocked before any thread starts, so only the signalfd ever sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (m_epoll_fd < 0 || m_wakeup_fd < 0 || m_signal_fd < 0
+        || !watch(m_listen_fd, LISTEN_ID, EPOLLIN, false)
+        || !watch(m_wakeup_fd, WAKEUP_ID, EPOLLIN, false)
+        || !watch(m_signal_fd, SIGNAL_ID, EPOLLIN, false))
+    {
+        std::cerr << "ERROR: Could not set up the event loop: " << strerror(errno) << "\n";
+        return false;
+    }
+
+    m_pool.reset(new ThreadPool(m_threads));
+    return true;
+}
+
+void
+SearchEngine::QueryServer::accept_clients()
+{
+    while (true)
+    {
+        int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                std::cerr << "ERROR: Could not accept a client: " << strerror(errno) << "\n";
+            }
+            return;
+        }
+
+        std::uint64_t id = m_next_connection++;
+        if (!watch(fd, id, EPOLLIN | EPOLLRDHUP, false))
+        {
+            close(fd);
+            continue;
+        }
+
+        m_connections.emplace(id, Connection { fd, "", "", {}, EPOLLIN | EPOLLRDHUP, false, false });
+    }
+}
+
+void
+SearchEngine::QueryServer::read_requests(std::uint64_t id)
+{
+    Connection& connection = m_connections.at(id);
+
+    char buffer[SERVER_READ_SIZE];
+    while (true)
+    {
+        ssize_t count = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (count > 0)
+        {
+            connection.input.append(buffer, count);
+            continue;
+        }
+
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        if (count < 0)
+        {
+            // A request still running is dropped once it's answered
+            close_connection(id);
+            return;
+        }
+
+        // The client is done sending, the requests it already sent are still answered
+        connection.input_closed = true;
+        break;
+    }
+
+    std::size_t start = 0;
+    std::size_t end;
+    while ((end = connection.input.find('\n', start)) != std::string::npos)
+    {
+        std::size_t length = end - start;
+        if (length > 0 && connection.input[end - 1] == '\r') --length;
+
+        connection.requests.push_back(connection.input.substr(start, length));
+        start = end + 1;
+    }
+    connection.input.erase(0, start);
+
+    if (connection.input_closed && !connection.input.empty())
+    {
+        connection.requests.push_back(std::move(connection.input));
+        connection.input.clear();
+    }
+
+    if (connection.input.size() > SERVER_MAX_REQUEST)
+    {
+        std::cerr << "ERROR: Dropping a client whose request is over " << SERVER_MAX_REQUEST << " bytes\n";
+        close_connection(id);
+        return;
+    }
+
+    dispatch(id);
+    flush(id);
+}
+
+void
+SearchEngine::QueryServer::dispatch(std::uint64_t id)
+{
+    Connection& connection = m_connections.at(id);
+    if (connection.busy || connection.requests.empty()) return;
+
+    connection.busy = true;
+    std::string request = std::move(connection.requests.front());
+    connection.requests.pop_front();
+
+    m_pool->submit([this, id, request = std::move(request)]()
+    {
+        std::string content = m_handler(request);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_responses.push_back({ id, std::move(content) });
+        }
+
+        std::uint64_t one = 1;
+        [[maybe_unused]] ssize_t written = write(m_wakeup_fd, &one, sizeof(one));
+    });
+}
+
+void
+SearchEngine::QueryServer::deliver_responses()
+{
+    std::uint64_t count;
+    [[maybe_unused]] ssize_t read_count = read(m_wakeup_fd, &count, sizeof(count));
+
+    std::vector<Response> responses;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        responses.swap(m_responses);
+    }
+
+    for (Response& response : responses)
+    {
+        auto found = m_connections.find(response.connection);
+        if (found == m_connections.end()) continue;
+
+        Connection& connection = found->second;
+        connection.output.append(response.content);
+        connection.output.push_back('\n');
+        connection.busy = false;
+
+        dispatch(response.connection);
+        flush(response.connection);
+    }
+}
+
+void
+SearchEngine::QueryServer::flush(std::uint64_t id)
+{
+    Connection& connection = m_connections.at(id);
+
+    std::size_t sent = 0;
+    while (sent < connection.output.size())
+    {
+        ssize_t count = send(connection.fd, connection.output.data() + sent, connection.output.size() - sent, MSG_NOSIGNAL);
+        if (count > 0)
+        {
+            sent += count;
+            continue;
+        }
+
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        close_connection(id);
+        return;
+    }
+    connection.output.erase(0, sent);
+
+    if (connection.input_closed && !connection.busy && connection.requests.empty() && connection.output.empty())
+    {
+        close_connection(id);
+        return;
+    }
+
+    update_events(id);
+}
+
+void
+SearchEngine::QueryServer::update_events(std::uint64_t id)
+{
+    Connection& connection = m_connections.at(id);
+
+    // Writes are only watched while a response is waiting on a full socket buffer
+    std::uint32_t events = 0;
+    if (!connection.input_closed) events |= EPOLLIN | EPOLLRDHUP;
+    if (!connection.output.empty()) events |= EPOLLOUT;
+    if (events != connection.events && watch(connection.fd, id, events, true))
+    {
+        connection.events = events;
+    }
+}
+
+void
+SearchEngine::QueryServer::close_connection(std::uint64_t id)
+{
+    auto found = m_connections.find(id);
+    if (found == m_connections.end()) return;
+
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, found->second.fd, nullptr);
+    close(found->second.fd);
+    m_connections.erase(found);
+}
+
+void
+SearchEngine::QueryServer::run()
+{
+    epoll_event events[SERVER_MAX_EVENTS];
+    bool running = true;
+
+    while (running)
+    {
+        int count = epoll_wait(m_epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (count < 0)
+        {
+            if (errno == EINTR) continue;
+
+            std::cerr << "ERROR: Waiting for events failed: " << strerror(errno) << "\n";
+            break;
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            std::uint64_t id = events[i].data.u64;
+            if (id == LISTEN_ID)
+            {
+                accept_clients();
+            }
+            else if (id == WAKEUP_ID)
+            {
+                deliver_responses();
+            }
+            else if (id == SIGNAL_ID)
+            {
+                running = false;
+            }
+            else if (m_connections.count(id) != 0)
+            {
+                // An earlier event of this batch may have closed the connection already
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                {
+                    read_requests(id);
+                }
+
+                if (m_connections.count(id) != 0 && (events[i].events & EPOLLOUT))
+                {
+                    flush(id);
+                }
+            }
+        }
+    }
+
+    m_pool->wait();
+}
+
+SearchEngine::QueryServer::~QueryServer()
+{
+    // The pool goes first, its tasks still write to the wakeup descriptor
+    m_pool.reset();
+
+    for (const auto& [id, connection] : m_connections)
+    {
+        close(connection.fd);
+    }
+
+    for (int fd : { m_signal_fd, m_wakeup_fd, m_epoll_fd, m_listen_fd })
+    {
+        if (fd >= 0) close(fd);
+    }
+
+    if (!m_socket_path.empty())
+    {
+        unlink(m_socket_path.c_str());
+    }
+}
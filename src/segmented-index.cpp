@@ -0,0 +1,787 @@
+#include "../includes/segmented-index.hpp"
+#include <fstream>
+#include <cstdio>
+#include <map>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+std::size_t
+SearchEngine::SegmentedIndex::Segment::live_count()
+const noexcept
+{
+    return reader->document_count() - deleted_count;
+}
+
+SearchEngine::SegmentedIndex::SegmentedIndex()
+    : m_segments(std::make_shared<Segments>()),
+      m_generation(0),
+      m_next_segment(1),
+      m_lock_fd(-1),
+      m_merger_stop(false)
+{
+}
+
+bool
+SearchEngine::SegmentedIndex::is_segmented_index(const std::string& path)
+{
+    return std::filesystem::is_directory(path);
+}
+
+std::string
+SearchEngine::SegmentedIndex::path(const std::string& name)
+const
+{
+    return (std::filesystem::path(m_directory) / name).string();
+}
+
+bool
+SearchEngine::SegmentedIndex::read_manifest(Segments& segments, std::uint64_t& generation, std::uint64_t& next_segment)
+const
+{
+    std::ifstream manifest(path(SEGMENTS_MANIFEST));
+    if (!manifest)
+    {
+        std::cerr << "ERROR: Could not open the manifest of '" << m_directory << "'\n";
+        return false;
+    }
+
+    std::string tag;
+    unsigned version = 0;
+    if (!(manifest >> tag >> version) || tag != "SEGMENTS" || version != SEGMENTS_VERSION)
+    {
+        std::cerr << "ERROR: '" << m_directory << "' has no valid segments manifest\n";
+        return false;
+    }
+
+    if (!(manifest >> tag >> generation) || tag != "generation"
+        || !(manifest >> tag >> next_segment) || tag != "next")
+    {
+        std::cerr << "ERROR: Malformed segments manifest in '" << m_directory << "'\n";
+        return false;
+    }
+
+    // segment <name> <tombstones, '-' when none>
+    Segment segment {};
+    while (manifest >> tag >> segment.name >> segment.tombstones_name)
+    {
+        if (tag != "segment")
+        {
+            std::cerr << "ERROR: Unexpected '" << tag << "' in the segments manifest\n";
+            return false;
+        }
+
+        if (segment.tombstones_name == "-") segment.tombstones_name.clear();
+        segments.push_back(segment);
+    }
+
+    return true;
+}
+
+bool
+SearchEngine::SegmentedIndex::open_segment(Segment& segment)
+const
+{
+    auto reader = std::make_shared<IndexReader>();
+    if (!reader->open(path(segment.name)))
+    {
+        return false;
+    }
+
+    auto deleted = std::make_shared<IndexReader::Tombstones>(reader->document_count(), false);
+    segment.deleted_count = 0;
+
+    if (!segment.tombstones_name.empty())
+    {
+        std::ifstream file(path(segment.tombstones_name), std::ios::binary);
+        std::uint32_t magic = 0;
+        std::uint64_t count = 0;
+        file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        file.read(reinterpret_cast<char*>(&count), sizeof(count));
+
+        if (!file || magic != TOMBSTONES_MAGIC)
+        {
+            std::cerr << "ERROR: Could not read tombstones '" << segment.tombstones_name << "'\n";
+            return false;
+        }
+
+        for (std::uint64_t i = 0; i < count; ++i)
+        {
+            IndexReader::DocumentId id = 0;
+            if (!file.read(reinterpret_cast<char*>(&id), sizeof(id)) || id >= deleted->size())
+            {
+                std::cerr << "ERROR: Tombstones '" << segment.tombstones_name << "' are truncated\n";
+                return false;
+            }
+
+            if (!(*deleted)[id])
+            {
+                (*deleted)[id] = true;
+                ++segment.deleted_count;
+            }
+        }
+    }
+
+    segment.reader = std::move(reader);
+    segment.deleted = std::move(deleted);
+    count_live_document_frequencies(segment);
+
+    return true;
+}
+
+bool
+SearchEngine::SegmentedIndex::write_tombstones(Segment& segment, std::uint64_t generation)
+const
+{
+    std::string stem = std::filesystem::path(segment.name).stem().string();
+    segment.tombstones_name = stem + "." + std::to_string(generation) + ".del";
+
+    std::uint32_t magic = TOMBSTONES_MAGIC;
+    std::uint64_t count = segment.deleted_count;
+
+    std::ofstream file(path(segment.tombstones_name), std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (IndexReader::DocumentId id = 0; id < segment.deleted->size(); ++id)
+    {
+        if ((*segment.deleted)[id])
+        {
+            file.write(reinterpret_cast<const char*>(&id), sizeof(id));
+        }
+    }
+
+    if (!file)
+    {
+        std::cerr << "ERROR: Could not write tombstones '" << segment.tombstones_name << "'\n";
+        return false;
+    }
+
+    return true;
+}
+
+void
+SearchEngine::SegmentedIndex::remove_unreferenced(const Segments& segments)
+const
+{
+    std::unordered_set<std::string> referenced;
+    for (const Segment& segment : segments)
+    {
+        referenced.insert(segment.name);
+        referenced.insert(segment.tombstones_name);
+    }
+
+    // Readers still mapping a removed segment keep it alive until they refresh
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(m_directory, error))
+    {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("segment-", 0) == 0 && referenced.count(name) == 0)
+        {
+            std::filesystem::remove(entry.path(), error);
+        }
+    }
+}
+
+bool
+SearchEngine::SegmentedIndex::create(const std::string& directory)
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error)
+    {
+        std::cerr << "ERROR: Could not create index directory '" << directory << "': " << error.message() << "\n";
+        return false;
+    }
+
+    m_directory = directory;
+    if (!std::filesystem::exists(path(SEGMENTS_MANIFEST)) && !commit(Segments()))
+    {
+        return false;
+    }
+
+    return open(directory);
+}
+
+bool
+SearchEngine::SegmentedIndex::open(const std::string& directory)
+{
+    m_directory = directory;
+    m_manifest_time = std::filesystem::file_time_type::min();
+
+    return refresh();
+}
+
+bool
+SearchEngine::SegmentedIndex::refresh()
+{
+    std::error_code error;
+    std::filesystem::file_time_type manifest_time = std::filesystem::last_write_time(path(SEGMENTS_MANIFEST), error);
+    if (error)
+    {
+        std::cerr << "ERROR: Could not find the manifest of '" << m_directory << "'\n";
+        return false;
+    }
+
+    Snapshot current;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (manifest_time == m_manifest_time) return true;
+        current = m_segments;
+    }
+
+    Segments segments;
+    std::uint64_t generation = 0;
+    std::uint64_t next_segment = 0;
+    if (!read_manifest(segments, generation, next_segment))
+    {
+        return false;
+    }
+
+    // Segments are immutable, only the ones that are new or got new tombstones are opened again
+    for (Segment& segment : segments)
+    {
+        auto same = std::find_if(current->begin(), current->end(),
+            [&segment](const Segment& other)
+            {
+                return other.name == segment.name && other.tombstones_name == segment.tombstones_name;
+            });
+
+        if (same != current->end())
+        {
+            segment = *same;
+        }
+        else if (!open_segment(segment))
+        {
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (generation >= m_generation)
+    {
+        m_segments = std::make_shared<const Segments>(std::move(segments));
+        m_generation = generation;
+        m_next_segment = next_segment;
+        m_manifest_time = manifest_time;
+    }
+
+    return true;
+}
+
+SearchEngine::SegmentedIndex::Snapshot
+SearchEngine::SegmentedIndex::snapshot()
+const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_segments;
+}
+
+std::uint64_t
+SearchEngine::SegmentedIndex::generation()
+const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_generation;
+}
+
+bool
+SearchEngine::SegmentedIndex::lock(bool wait)
+{
+    if (m_lock_fd >= 0) return true;
+
+    int fd = ::open(path(SEGMENTS_LOCK).c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "ERROR: Could not open the lock of '" << m_directory << "'\n";
+        return false;
+    }
+
+    if (flock(fd, LOCK_EX | (wait ? 0 : LOCK_NB)) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    m_lock_fd = fd;
+    return true;
+}
+
+void
+SearchEngine::SegmentedIndex::unlock()
+noexcept
+{
+    if (m_lock_fd < 0) return;
+
+    flock(m_lock_fd, LOCK_UN);
+    ::close(m_lock_fd);
+    m_lock_fd = -1;
+}
+
+bool
+SearchEngine::SegmentedIndex::write_segment(const Dictionary& dictionary, Segment& segment)
+{
+    char name[32];
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        snprintf(name, sizeof(name), "segment-%06lu.idx", m_next_segment++);
+    }
+
+    segment = Segment {};
+    segment.name = name;
+    dictionary.write_to(path(segment.name));
+
+    return open_segment(segment);
+}
+
+void
+SearchEngine::SegmentedIndex::delete_documents(Segment& segment, const std::vector<IndexReader::DocumentId>& ids)
+const
+{
+    // Snapshots share the old bitmap, deletions go into a copy
+    auto deleted = std::make_shared<IndexReader::Tombstones>(*segment.deleted);
+    for (IndexReader::DocumentId id : ids)
+    {
+        if (!(*deleted)[id])
+        {
+            (*deleted)[id] = true;
+            ++segment.deleted_count;
+        }
+    }
+
+    segment.deleted = std::move(deleted);
+    segment.tombstones_name.clear();
+    count_live_document_frequencies(segment);
+}
+
+bool
+SearchEngine::SegmentedIndex::commit(const Segments& segments)
+{
+    std::uint64_t generation;
+    std::uint64_t next_segment;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        generation = m_generation + 1;
+        next_segment = m_next_segment;
+    }
+
+    Segments committed = segments;
+    for (Segment& segment : committed)
+    {
+        if (segment.deleted_count > 0 && segment.tombstones_name.empty() && !write_tombstones(segment, generation))
+        {
+            return false;
+        }
+    }
+
+    // The manifest is replaced in one rename, readers see either the old or the new segment list
+    std::string temporary = path(SEGMENTS_MANIFEST ".tmp");
+    {
+        std::ofstream manifest(temporary, std::ios::trunc);
+        manifest << "SEGMENTS " << SEGMENTS_VERSION << "\n";
+        manifest << "generation " << generation << "\n";
+        manifest << "next " << next_segment << "\n";
+        for (const Segment& segment : committed)
+        {
+            manifest << "segment " << segment.name << " "
+                << (segment.tombstones_name.empty() ? "-" : segment.tombstones_name) << "\n";
+        }
+
+        if (!manifest)
+        {
+            std::cerr << "ERROR: Could not write the manifest of '" << m_directory << "'\n";
+            return false;
+        }
+    }
+
+    if (std::rename(temporary.c_str(), path(SEGMENTS_MANIFEST).c_str()) != 0)
+    {
+        std::cerr << "ERROR: Could not replace the manifest of '" << m_directory << "'\n";
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::file_time_type manifest_time = std::filesystem::last_write_time(path(SEGMENTS_MANIFEST), error);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_segments = std::make_shared<const Segments>(committed);
+        m_generation = generation;
+        m_manifest_time = manifest_time;
+    }
+
+    remove_unreferenced(committed);
+
+    return true;
+}
+
+void
+SearchEngine::SegmentedIndex::read_documents(const Segments& segments, Dictionary& dictionary)
+{
+    for (const Segment& segment : segments)
+    {
+        Dictionary documents(dictionary.term_pool());
+        documents.read_from(*segment.reader);
+
+        for (IndexReader::DocumentId id = 0; id < segment.deleted->size(); ++id)
+        {
+            if ((*segment.deleted)[id])
+            {
+                documents.remove_file(std::string(segment.reader->document_name(id)));
+            }
+        }
+
+        dictionary.merge(std::move(documents));
+    }
+}
+
+bool
+SearchEngine::SegmentedIndex::merge()
+{
+    Snapshot snapshot = this->snapshot();
+
+    // Tiered policy: segments are bucketed by live size in powers of the merge factor, a tier
+    // holding enough segments is merged into one of the next tier. Segments with too many
+    // tombstones are rewritten alone to reclaim the space.
+    auto tier = [](std::size_t documents)
+    {
+        std::size_t level = 0;
+        for (std::size_t size = std::max<std::size_t>(documents, SEGMENT_MERGE_MIN_DOCUMENTS);
+             size >= SEGMENT_MERGE_MIN_DOCUMENTS * SEGMENT_MERGE_FACTOR;
+             size /= SEGMENT_MERGE_FACTOR)
+        {
+            ++level;
+        }
+        return level;
+    };
+
+    std::vector<std::size_t> candidates;
+    for (std::size_t i = 0; i < snapshot->size() && candidates.empty(); ++i)
+    {
+        const Segment& segment = (*snapshot)[i];
+        if (segment.deleted_count > segment.reader->document_count() * SEGMENT_MAX_DELETED_RATIO)
+        {
+            candidates.push_back(i);
+        }
+    }
+
+    if (candidates.empty())
+    {
+        std::map<std::size_t, std::vector<std::size_t>> tiers;
+        for (std::size_t i = 0; i < snapshot->size(); ++i)
+        {
+            tiers[tier((*snapshot)[i].live_count())].push_back(i);
+        }
+
+        for (auto& [_, members] : tiers)
+        {
+            if (members.size() < SEGMENT_MERGE_FACTOR) continue;
+
+            std::sort(members.begin(), members.end(),
+                [&snapshot](std::size_t a, std::size_t b)
+                {
+                    return (*snapshot)[a].live_count() < (*snapshot)[b].live_count();
+                });
+            candidates.assign(members.begin(), members.begin() + SEGMENT_MERGE_FACTOR);
+            break;
+        }
+    }
+
+    if (candidates.empty()) return false;
+
+    Segments merging;
+    Segments remaining;
+    for (std::size_t i = 0; i < snapshot->size(); ++i)
+    {
+        bool merged = std::find(candidates.begin(), candidates.end(), i) != candidates.end();
+        (merged ? merging : remaining).push_back((*snapshot)[i]);
+    }
+
+    Dictionary dictionary;
+    read_documents(merging, dictionary);
+    dictionary.build_inverted_index();
+
+    if (dictionary.document_count() > 0)
+    {
+        Segment segment;
+        if (!write_segment(dictionary, segment)) return false;
+        remaining.push_back(std::move(segment));
+    }
+
+    return commit(remaining);
+}
+
+void
+SearchEngine::SegmentedIndex::merge_in_background()
+{
+    std::unique_lock<std::mutex> wakeup(m_merger_mutex);
+    while (!m_merger_wakeup.wait_for(wakeup, SEGMENT_MERGE_INTERVAL, [this]() { return m_merger_stop; }))
+    {
+        wakeup.unlock();
+
+        // Another writer holding the directory just means this round is skipped
+        if (lock(false))
+        {
+            if (refresh())
+            {
+                while (merge());
+            }
+            unlock();
+        }
+
+        wakeup.lock();
+    }
+}
+
+void
+SearchEngine::SegmentedIndex::start_merging()
+{
+    if (m_merger.joinable()) return;
+
+    m_merger_stop = false;
+    m_merger = std::thread(&SegmentedIndex::merge_in_background, this);
+}
+
+void
+SearchEngine::SegmentedIndex::stop_merging()
+{
+    if (!m_merger.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_merger_mutex);
+        m_merger_stop = true;
+    }
+    m_merger_wakeup.notify_all();
+    m_merger.join();
+}
+
+std::list<SearchEngine::SegmentedIndex::Result>
+SearchEngine::SegmentedIndex::search(const std::list<std::string>& tokens, std::size_t top, float min_score, ThreadPool* pool,
+    QueryTimings* timings)
+const
+{
+    auto start = std::chrono::steady_clock::now();
+    Snapshot snapshot = this->snapshot();
+    const Segments& segments = *snapshot;
+
+    std::size_t document_count = 0;
+    for (const Segment& segment : segments)
+    {
+        document_count += segment.live_count();
+    }
+
+    // Idf is collection-wide: tombstoned postings don't count towards a term's document frequency,
+    // and each segment's MaxScore bound is rescaled from its own idf to the global one
+    std::vector<IndexReader::QueryTerms> terms(segments.size());
+    std::vector<const IndexFormat::TermRecord*> records(segments.size());
+    for (const auto& token : tokens)
+    {
+        std::size_t document_frequency = 0;
+        for (std::size_t i = 0; i < segments.size(); ++i)
+        {
+            records[i] = segments[i].reader->find_term(token);
+            if (records[i] != nullptr)
+            {
+                document_frequency += live_document_frequency(segments[i], *records[i]);
+            }
+        }
+
+        if (document_frequency == 0) continue;
+
+        float idf = std::log10(static_cast<float>(document_count) / document_frequency);
+        for (std::size_t i = 0; i < segments.size(); ++i)
+        {
+            const IndexFormat::TermRecord* record = records[i];
+            if (record == nullptr) continue;
+
+            float bound = record->idf > 0.0f ? record->max_score / record->idf * idf : idf;
+            terms[i].push_back({ record, idf, bound });
+        }
+    }
+
+    auto scoring_start = std::chrono::steady_clock::now();
+    std::vector<std::vector<IndexReader::ScoredDocument>> segment_results(segments.size());
+    auto score_segment = [&](std::size_t i)
+    {
+        const Segment& segment = segments[i];
+        if (terms[i].empty()) return;
+
+        const IndexReader::Tombstones* deleted = segment.deleted_count > 0 ? segment.deleted.get() : nullptr;
+        if (top != 0)
+        {
+            segment_results[i] = segment.reader->top_k(terms[i], top, min_score, 0, segment.reader->document_count(), deleted);
+            return;
+        }
+
+        for (const auto& scored : segment.reader->tf_idf(terms[i], 0, segment.reader->document_count(), deleted))
+        {
+            if (scored.second > min_score)
+            {
+                segment_results[i].push_back(scored);
+            }
+        }
+    };
+
+    for (std::size_t i = 0; i < segments.size(); ++i)
+    {
+        if (pool != nullptr)
+        {
+            pool->submit([&score_segment, i]() { score_segment(i); });
+        }
+        else
+        {
+            score_segment(i);
+        }
+    }
+
+    if (pool != nullptr) pool->wait();
+
+    std::list<Result> results = merge_results(segments, segment_results, top);
+
+    if (timings != nullptr)
+    {
+        auto end = std::chrono::steady_clock::now();
+        timings->candidates += scoring_start - start;
+        timings->scoring += end - scoring_start;
+    }
+
+    return results;
+}
+
+std::list<SearchEngine::SegmentedIndex::Result>
+SearchEngine::SegmentedIndex::search(const BooleanQuery& query, std::size_t top, ThreadPool* pool, QueryTimings* timings)
+const
+{
+    auto start = std::chrono::steady_clock::now();
+    Snapshot snapshot = this->snapshot();
+    const Segments& segments = *snapshot;
+
+    std::size_t document_count = 0;
+    for (const Segment& segment : segments)
+    {
+        document_count += segment.live_count();
+    }
+
+    // Same collection-wide idf as ranked queries, every segment scores its matches with it
+    BooleanQuery::IdfMap idf;
+    for (const auto& term : query.scored_terms())
+    {
+        std::size_t document_frequency = 0;
+        for (const Segment& segment : segments)
+        {
+            const IndexFormat::TermRecord* record = segment.reader->find_term(term);
+            if (record != nullptr)
+            {
+                document_frequency += live_document_frequency(segment, *record);
+            }
+        }
+
+        if (document_frequency > 0)
+        {
+            idf[term] = std::log10(static_cast<float>(document_count) / document_frequency);
+        }
+    }
+
+    auto scoring_start = std::chrono::steady_clock::now();
+    std::vector<std::vector<IndexReader::ScoredDocument>> segment_results(segments.size());
+    auto match_segment = [&](std::size_t i)
+    {
+        const Segment& segment = segments[i];
+        const IndexReader::Tombstones* deleted = segment.deleted_count > 0 ? segment.deleted.get() : nullptr;
+        segment_results[i] = query.search(*segment.reader, top, deleted, &idf);
+    };
+
+    for (std::size_t i = 0; i < segments.size(); ++i)
+    {
+        if (pool != nullptr)
+        {
+            pool->submit([&match_segment, i]() { match_segment(i); });
+        }
+        else
+        {
+            match_segment(i);
+        }
+    }
+
+    if (pool != nullptr) pool->wait();
+
+    std::list<Result> results = merge_results(segments, segment_results, top);
+
+    if (timings != nullptr)
+    {
+        auto end = std::chrono::steady_clock::now();
+        timings->candidates += scoring_start - start;
+        timings->scoring += end - scoring_start;
+    }
+
+    return results;
+}
+
+void
+SearchEngine::SegmentedIndex::count_live_document_frequencies(Segment& segment)
+{
+    if (segment.deleted_count == 0)
+    {
+        segment.live_document_frequencies.reset();
+        return;
+    }
+
+    const IndexReader& reader = *segment.reader;
+    const IndexReader::Tombstones& deleted = *segment.deleted;
+    auto frequencies = std::make_shared<std::vector<std::uint32_t>>(reader.term_count());
+    for (std::size_t i = 0; i < frequencies->size(); ++i)
+    {
+        std::uint32_t document_frequency = 0;
+        for (PostingCursor posting = reader.postings(reader.term_record(i)); !posting.at_end(); posting.next())
+        {
+            document_frequency += !deleted[posting.document_id()];
+        }
+
+        (*frequencies)[i] = document_frequency;
+    }
+
+    segment.live_document_frequencies = std::move(frequencies);
+}
+
+std::size_t
+SearchEngine::SegmentedIndex::live_document_frequency(const Segment& segment, const IndexFormat::TermRecord& record)
+{
+    if (segment.live_document_frequencies == nullptr) return record.document_frequency;
+
+    return (*segment.live_document_frequencies)[&record - &segment.reader->term_record(0)];
+}
+
+std::list<SearchEngine::SegmentedIndex::Result>
+SearchEngine::SegmentedIndex::merge_results(const Segments& segments,
+    const std::vector<std::vector<IndexReader::ScoredDocument>>& segment_results,
+    std::size_t top)
+{
+    std::vector<std::size_t> bases(segments.size());
+    std::vector<IndexReader::ScoredDocument> merged;
+    for (std::size_t i = 0, base = 0; i < segments.size(); base += segments[i].reader->document_count(), ++i)
+    {
+        bases[i] = base;
+        for (const auto& [id, score] : segment_results[i])
+        {
+            merged.push_back({ static_cast<IndexReader::DocumentId>(base + id), score });
+        }
+    }
+
+    if (top != 0)
+    {
+        IndexReader::sort_by_score(merged, top);
+    }
+
+    std::list<Result> results;
+    for (const auto& [id, score] : merged)
+    {
+        std::size_t i = std::upper_bound(bases.begin(), bases.end(), id) - bases.begin() - 1;
+        results.push_back({ std::string(segments[i].reader->document_name(id - bases[i])), score });
+    }
+
+    return results;
+}
+
+SearchEngine::SegmentedIndex::~SegmentedIndex()
+{
+    stop_merging();
+    unlock();
+}
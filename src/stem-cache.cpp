@@ -0,0 +1,108 @@
+#include "../includes/stem-cache.hpp"
+
+SearchEngine::StemCache::StemCache(std::size_t capacity)
+    : m_shard_capacity(std::max<std::size_t>(capacity / STEM_CACHE_SHARDS, 1)),
+      m_shards(new Shard[STEM_CACHE_SHARDS])
+{
+    for (std::size_t i = 0; i < STEM_CACHE_SHARDS; ++i)
+    {
+        m_shards[i].slots.reset(new Slot[m_shard_capacity]);
+        m_shards[i].slots_by_word.reserve(m_shard_capacity);
+        m_shards[i].used = 0;
+        m_shards[i].hand = 0;
+        m_shards[i].hits = 0;
+        m_shards[i].misses = 0;
+    }
+}
+
+SearchEngine::StemCache::Shard&
+SearchEngine::StemCache::shard_for(std::string_view word)
+const noexcept
+{
+    return m_shards[std::hash<std::string_view>()(word) % STEM_CACHE_SHARDS];
+}
+
+bool
+SearchEngine::StemCache::find(std::string_view word, std::string& stem)
+const
+{
+    Shard& shard = shard_for(word);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+    auto found = shard.slots_by_word.find(word);
+    if (found == shard.slots_by_word.end())
+    {
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Slot& slot = shard.slots[found->second];
+    if (!slot.referenced.load(std::memory_order_relaxed))
+    {
+        slot.referenced.store(true, std::memory_order_relaxed);
+    }
+
+    stem.assign(slot.stem);
+    shard.hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void
+SearchEngine::StemCache::insert(std::string_view word, std::string_view stem)
+{
+    Shard& shard = shard_for(word);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+    if (shard.slots_by_word.find(word) != shard.slots_by_word.end()) return;
+
+    std::size_t index;
+    if (shard.used < m_shard_capacity)
+    {
+        index = shard.used++;
+    }
+    else
+    {
+        // Sweep the clock hand, giving recently used entries a second chance
+        while (shard.slots[shard.hand].referenced.load(std::memory_order_relaxed))
+        {
+            shard.slots[shard.hand].referenced.store(false, std::memory_order_relaxed);
+            shard.hand = (shard.hand + 1) % m_shard_capacity;
+        }
+
+        index = shard.hand;
+        shard.hand = (shard.hand + 1) % m_shard_capacity;
+        shard.slots_by_word.erase(shard.slots[index].word);
+    }
+
+    Slot& slot = shard.slots[index];
+    slot.word.assign(word);
+    slot.stem.assign(stem);
+    slot.referenced.store(false, std::memory_order_relaxed);
+    shard.slots_by_word.insert({ slot.word, index });
+}
+
+std::size_t
+SearchEngine::StemCache::hits()
+const noexcept
+{
+    std::size_t hits = 0;
+    for (std::size_t i = 0; i < STEM_CACHE_SHARDS; ++i)
+    {
+        hits += m_shards[i].hits.load(std::memory_order_relaxed);
+    }
+
+    return hits;
+}
+
+std::size_t
+SearchEngine::StemCache::misses()
+const noexcept
+{
+    std::size_t misses = 0;
+    for (std::size_t i = 0; i < STEM_CACHE_SHARDS; ++i)
+    {
+        misses += m_shards[i].misses.load(std::memory_order_relaxed);
+    }
+
+    return misses;
+}
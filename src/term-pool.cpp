@@ -0,0 +1,82 @@
+#include "../includes/term-pool.hpp"
+
+SearchEngine::TermPool::TermPool()
+    : m_shards(new Shard[TERM_POOL_SHARDS])
+{
+    for (std::size_t i = 0; i < TERM_POOL_SHARDS; ++i)
+    {
+        m_shards[i].block_used = 0;
+        m_shards[i].block_size = 0;
+    }
+}
+
+std::string_view
+SearchEngine::TermPool::store(Shard& shard, std::string_view term)
+{
+    if (shard.block_used + term.size() > shard.block_size)
+    {
+        shard.block_size = std::max<std::size_t>(TERM_POOL_BLOCK_SIZE, term.size());
+        shard.blocks.emplace_back(new char[shard.block_size]);
+        shard.block_used = 0;
+    }
+
+    char* data = shard.blocks.back().get() + shard.block_used;
+    std::memcpy(data, term.data(), term.size());
+    shard.block_used += term.size();
+
+    return std::string_view(data, term.size());
+}
+
+SearchEngine::TermPool::TermId
+SearchEngine::TermPool::intern(std::string_view term)
+{
+    Shard& shard = m_shards[std::hash<std::string_view>()(term) % TERM_POOL_SHARDS];
+
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto found = shard.ids.find(term);
+        if (found != shard.ids.end()) return found->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto found = shard.ids.find(term);
+    if (found != shard.ids.end()) return found->second;
+
+    std::string_view stored = store(shard, term);
+
+    TermId id;
+    {
+        std::lock_guard<std::mutex> guard(m_terms_mutex);
+        id = m_terms.size();
+        m_terms.push_back(stored);
+    }
+
+    shard.ids.insert({ stored, id });
+    return id;
+}
+
+std::optional<SearchEngine::TermPool::TermId>
+SearchEngine::TermPool::find(std::string_view term)
+{
+    Shard& shard = m_shards[std::hash<std::string_view>()(term) % TERM_POOL_SHARDS];
+
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto found = shard.ids.find(term);
+    if (found == shard.ids.end()) return std::nullopt;
+
+    return found->second;
+}
+
+std::string_view
+SearchEngine::TermPool::term(TermId id)
+{
+    std::lock_guard<std::mutex> guard(m_terms_mutex);
+    return m_terms[id];
+}
+
+std::size_t
+SearchEngine::TermPool::size()
+{
+    std::lock_guard<std::mutex> guard(m_terms_mutex);
+    return m_terms.size();
+}
@@ -0,0 +1,160 @@
+#include "../includes/thread-pool.hpp"
+
+thread_local SearchEngine::ThreadPool* SearchEngine::ThreadPool::s_current_pool = nullptr;
+thread_local std::size_t SearchEngine::ThreadPool::s_current_worker = 0;
+
+SearchEngine::ThreadPool::ThreadPool(std::size_t threads)
+    : m_next_worker(0),
+      m_pending(0),
+      m_stop(false)
+{
+    threads = std::max<std::size_t>(threads, 1);
+
+    for (std::size_t i = 0; i < threads; ++i)
+    {
+        m_workers.emplace_back(new Worker());
+    }
+
+    for (std::size_t i = 0; i < threads; ++i)
+    {
+        m_workers[i]->thread = std::thread(&ThreadPool::run, this, i);
+    }
+}
+
+std::size_t
+SearchEngine::ThreadPool::default_size()
+noexcept
+{
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+std::size_t
+SearchEngine::ThreadPool::size()
+const noexcept
+{
+    return m_workers.size();
+}
+
+std::size_t
+SearchEngine::ThreadPool::current_worker()
+noexcept
+{
+    return s_current_worker;
+}
+
+void
+SearchEngine::ThreadPool::submit(Task task)
+{
+    // Tasks spawned from a worker stay on its own deque, others are spread round-robin
+    std::size_t index = s_current_pool == this
+        ? s_current_worker
+        : m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+
+    m_pending.fetch_add(1, std::memory_order_acq_rel);
+    {
+        std::lock_guard<std::mutex> guard(m_workers[index]->mutex);
+        m_workers[index]->tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+    }
+    m_work_available.notify_one();
+}
+
+bool
+SearchEngine::ThreadPool::pop_local(std::size_t index, Task& task)
+{
+    Worker& worker = *m_workers[index];
+    std::lock_guard<std::mutex> guard(worker.mutex);
+
+    if (worker.tasks.empty()) return false;
+
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool
+SearchEngine::ThreadPool::steal(std::size_t index, Task& task)
+{
+    for (std::size_t i = 1; i < m_workers.size(); ++i)
+    {
+        Worker& victim = *m_workers[(index + i) % m_workers.size()];
+        std::lock_guard<std::mutex> guard(victim.mutex);
+
+        if (victim.tasks.empty()) continue;
+
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+void
+SearchEngine::ThreadPool::run(std::size_t index)
+{
+    s_current_pool = this;
+    s_current_worker = index;
+
+    Task task;
+
+    while (true)
+    {
+        if (pop_local(index, task) || steal(index, task))
+        {
+            task();
+            task = nullptr;
+
+            if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                std::lock_guard<std::mutex> guard(m_mutex);
+                m_all_done.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_stop) break;
+
+        // Re-check under the lock so a submit between the steal and the wait isn't missed
+        bool has_work = false;
+        for (const auto& other : m_workers)
+        {
+            std::lock_guard<std::mutex> guard(other->mutex);
+            if (!other->tasks.empty())
+            {
+                has_work = true;
+                break;
+            }
+        }
+
+        if (!has_work)
+        {
+            m_work_available.wait(lock);
+        }
+    }
+}
+
+void
+SearchEngine::ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_all_done.wait(lock, [this]() { return m_pending.load(std::memory_order_acquire) == 0; });
+}
+
+SearchEngine::ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stop = true;
+    }
+    m_work_available.notify_all();
+
+    for (auto& worker : m_workers)
+    {
+        worker->thread.join();
+    }
+}
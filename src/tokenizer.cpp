@@ -1,107 +1,184 @@
 #include "../includes/tokenizer.hpp"
+#include "../includes/char-scan.hpp"
 
 std::string SearchEngine::Tokenizer::s_language = DEFAULT_LANGUAGE;
+SearchEngine::StemCache SearchEngine::Tokenizer::s_stem_cache(STEM_CACHE_CAPACITY);
 
-SearchEngine::Tokenizer::Tokenizer(const std::string &content)
-    : m_content(std::string_view(content)),
+SearchEngine::Tokenizer::Tokenizer()
+    : Tokenizer(std::string_view())
+{
+}
+
+SearchEngine::Tokenizer::Tokenizer(std::string_view content)
+    : m_content(content),
       m_current(0)
 {
-    m_stemmer_ptr = sb_stemmer_new(s_language.c_str(), NULL);
 }
 
-bool
-SearchEngine::Tokenizer::is_digit(const char c)
-    const noexcept
+SearchEngine::Tokenizer::StemmerPtr
+SearchEngine::Tokenizer::thread_stemmer()
 {
-    return c >= '0' && c <= '9';
+    // One stemmer per thread, created on first use and released when the thread exits
+    struct StemmerHolder
+    {
+        StemmerPtr stemmer = nullptr;
+
+        ~StemmerHolder()
+        {
+            if (stemmer != nullptr) sb_stemmer_delete(stemmer);
+        }
+    };
+
+    static thread_local StemmerHolder holder;
+    if (holder.stemmer == nullptr)
+    {
+        holder.stemmer = sb_stemmer_new(s_language.c_str(), NULL);
+    }
+
+    return holder.stemmer;
 }
 
-bool
-SearchEngine::Tokenizer::is_alpha(const char c)
-    const noexcept
+const SearchEngine::StemCache&
+SearchEngine::Tokenizer::stem_cache()
+noexcept
 {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    return s_stem_cache;
 }
 
-std::string
-SearchEngine::Tokenizer::scan_number()
+std::string_view
+SearchEngine::Tokenizer::stem(std::string_view word)
 {
-    auto start = m_current;
-    auto current_char = m_content.begin() + m_current;
-    while ((current_char = m_content.begin() + m_current) != m_content.end() && is_digit(*current_char))
+    if (m_buffer.size() < word.size())
     {
-        ++m_current;
+        m_buffer.resize(std::max(word.size(), 2 * m_buffer.size()));
     }
 
-    return std::string(m_content.substr(start, m_current - start));
-}
+    CharScan::to_lower(m_buffer.data(), word.data(), word.size());
+    std::string_view lowered(m_buffer.data(), word.size());
 
-std::string
-SearchEngine::Tokenizer::scan_alpha_numeric()
-{
-    auto start = m_current;
-    auto current_char = m_content.begin() + m_current;
-    while ((current_char = m_content.begin() + m_current) != m_content.end()
-        && (is_alpha(*current_char) || is_digit(*current_char) || *current_char == '_'))
+    if (s_stem_cache.find(lowered, m_stem))
     {
-        ++m_current;
+        return m_stem;
     }
 
-    std::string ret = std::string(m_content.substr(start, m_current - start));
-    std::transform(ret.begin(), ret.end(), ret.begin(), [](char& c)
+    IndexingStats::Timer timer(IndexingStats::Stage::Stem);
+    StemmerPtr stemmer = thread_stemmer();
+    const sb_symbol* stemmed = sb_stemmer_stem(stemmer, (const sb_symbol*) lowered.data(), lowered.size());
+    m_stem.assign((const char*) stemmed, sb_stemmer_length(stemmer));
+
+    s_stem_cache.insert(lowered, m_stem);
+    return m_stem;
+}
+
+std::string_view
+SearchEngine::Tokenizer::normalize(std::string_view token)
+{
+    // Numbers are kept as they are, words start with a letter and get lowercased & stemmed
+    return token.front() >= '0' && token.front() <= '9' ? token : stem(token);
+}
+
+std::optional<std::string_view>
+SearchEngine::Tokenizer::next_term()
+{
+    const char* begin = m_content.data();
+    const char* end = begin + m_content.size();
+
+    const char* start = CharScan::skip_separators(begin + m_current, end);
+    if (start == end)
     {
-        return std::tolower(c);
-    });
+        m_current = m_content.size();
+        return std::nullopt;
+    }
 
-    ret = (char*) sb_stemmer_stem(m_stemmer_ptr, (sb_symbol*) ret.c_str(), ret.length());
+    const char* stop = *start >= '0' && *start <= '9'
+        ? CharScan::scan_digits(start, end)
+        : CharScan::scan_word(start, end);
+    m_current = stop - begin;
 
-    return ret;
+    return normalize(std::string_view(start, stop - start));
 }
 
 std::pair<bool, std::optional<std::string>>
 SearchEngine::Tokenizer::next_token()
 {
-    auto current_char = m_content.begin() + m_current;
+    auto term = next_term();
 
-    if (current_char == m_content.end())
+    if (!term.has_value())
     {
         return { true, std::nullopt };
     }
 
-    if (is_digit(*current_char))
-    {
-        return { false, scan_number() };
-    }
-    else if (is_alpha(*current_char))
+    return { false, std::string(*term) };
+}
+
+SearchEngine::Dictionary::TermFreqMap
+SearchEngine::Tokenizer::scan_terms_in_file(TermPool& terms)
+{
+    Dictionary::TermFreqMap term_freq_map;
+
+    while (auto term = next_term())
     {
-        return { false, scan_alpha_numeric() };
+        term_freq_map[terms.intern(*term)] += 1;
     }
 
-    ++m_current;
-    return { false, std::nullopt };
+    return term_freq_map;
 }
 
-SearchEngine::Dictionary::TermFreqMap
-SearchEngine::Tokenizer::scan_terms_in_file()
+void
+SearchEngine::Tokenizer::feed(std::string_view chunk,
+    TermPool& terms,
+    Dictionary::TermFreqMap& term_freq_map,
+    Dictionary::TermSequence* sequence)
 {
-    Dictionary::TermFreqMap term_freq_map;
+    const char* begin = chunk.data();
+    const char* end = begin + chunk.size();
+
+    if (!m_pending.empty())
+    {
+        bool is_number = m_pending.front() >= '0' && m_pending.front() <= '9';
+        const char* stop = is_number ? CharScan::scan_digits(begin, end) : CharScan::scan_word(begin, end);
+        m_pending.append(begin, stop);
+
+        if (stop == end) return;
+
+        flush(terms, term_freq_map, sequence);
+        begin = stop;
+    }
 
-    while (true)
+    while ((begin = CharScan::skip_separators(begin, end)) != end)
     {
-        auto [eof, token] = next_token();
+        const char* stop = *begin >= '0' && *begin <= '9'
+            ? CharScan::scan_digits(begin, end)
+            : CharScan::scan_word(begin, end);
 
-        if (eof) break;
-        if (token.has_value())
+        if (stop == end)
         {
-            auto value_opt = term_freq_map.find(*token);
-            term_freq_map.insert_or_assign(*token,
-                value_opt != term_freq_map.end()
-                    ? (*value_opt).second + 1
-                    : 1);
+            m_pending.assign(begin, stop);
+            return;
         }
+
+        TermPool::TermId term = terms.intern(normalize(std::string_view(begin, stop - begin)));
+        term_freq_map[term] += 1;
+        if (sequence != nullptr)
+        {
+            sequence->push_back(term);
+        }
+        begin = stop;
     }
+}
 
-    return term_freq_map;
+void
+SearchEngine::Tokenizer::flush(TermPool& terms, Dictionary::TermFreqMap& term_freq_map, Dictionary::TermSequence* sequence)
+{
+    if (m_pending.empty()) return;
+
+    TermPool::TermId term = terms.intern(normalize(m_pending));
+    term_freq_map[term] += 1;
+    if (sequence != nullptr)
+    {
+        sequence->push_back(term);
+    }
+    m_pending.clear();
 }
 
 std::list<std::string>
@@ -109,18 +186,10 @@ SearchEngine::Tokenizer::scan_text()
 {
     std::list<std::string> tokens;
 
-    while (true)
+    while (auto term = next_term())
     {
-        auto [eof, token] = next_token();
-
-        if (eof) break;
-        if (token.has_value()) tokens.push_back(*token);
+        tokens.emplace_back(*term);
     }
 
     return tokens;
 }
-
-SearchEngine::Tokenizer::~Tokenizer()
-{
-    sb_stemmer_delete(m_stemmer_ptr);
-}
\ No newline at end of file
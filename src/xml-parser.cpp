@@ -1,24 +1,49 @@
 #include "../includes/xml-parser.hpp"
 
-const std::unordered_set<std::string> SearchEngine::XmlParser::s_ignore_tags = { "head", "style", "script", "footer" };
+// Checked for every element, a handful of names compare faster than they hash
+const std::array<std::string_view, 4> SearchEngine::XmlParser::s_ignore_tags = { "head", "style", "script", "footer" };
 
 SearchEngine::XmlParser::XmlParser(const std::string &filename)
     : m_reader(xmlReaderForFile(filename.c_str(), NULL, 0))
 {
 }
 
+SearchEngine::XmlParser::XmlParser(const std::string &filename, std::string_view content)
+    : m_reader(xmlReaderForMemory(content.data(), content.size(), filename.c_str(), NULL, 0))
+{
+}
+
+bool
+SearchEngine::XmlParser::is_ignored_tag(std::string_view name)
+{
+    return std::find(s_ignore_tags.begin(), s_ignore_tags.end(), name) != s_ignore_tags.end();
+}
+
 std::string
 SearchEngine::XmlParser::parse()
 {
-    int ret;
     std::string content;
 
+    parse([&content](std::string_view text)
+    {
+        content += text;
+        content += " ";
+    });
+
+    return content;
+}
+
+void
+SearchEngine::XmlParser::parse(const TextHandler& on_text)
+{
+    int ret;
+
     while ((ret = xmlTextReaderRead(m_reader)) == 1)
     {
         const xmlChar *name = xmlTextReaderConstName(m_reader);
         const int type = xmlTextReaderNodeType(m_reader);
 
-        if (std::find(s_ignore_tags.begin(), s_ignore_tags.end(), (char*) name) != s_ignore_tags.end())
+        if (name != NULL && is_ignored_tag((char*) name))
         {
             ret = xmlTextReaderNext(m_reader);
             continue;
@@ -26,12 +51,9 @@ SearchEngine::XmlParser::parse()
 
         if (type == XML_READER_TYPE_TEXT)
         {
-            content += (char*) xmlTextReaderConstValue(m_reader);
-            content += " ";
+            on_text((char*) xmlTextReaderConstValue(m_reader));
         }
     }
-
-    return content;
 }
 
 SearchEngine::XmlParser::~XmlParser()